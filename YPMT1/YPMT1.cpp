@@ -1,7 +1,26 @@
-﻿#include <iostream>
+#include <iostream>
 #include "tables.h"
 #include "scanner.h"
 #include "parser.h"
+#include "compiler.h"
+#include "optimizer.h"
+#include "jit.h"
+#include "vm.h"
+#include "bench.h"
+#include "source.h"
+#include "batch.h"
+#include "pipeline.h"
+#include "server.h"
+#include "output.h"
+#include "cemit.h"
+#include "gen.h"
+#include "stats.h"
+#include "cache.h"
+#include "ir.h"
+#include "iropt.h"
+#include <chrono>
+#include <charconv>
+#include <cstring>
 
 using namespace std;
 
@@ -40,7 +59,7 @@ void demonstrateParserExamples() {
         cout << "Tokens: ";
         print_tokens(tokens);
 
-        Parser parser(tokens);
+        Parser parser(tokens, default_context(), testCases[i].first);
         bool success = parser.parse();
 
         if (success && testCases[i].second == "accepted") {
@@ -62,6 +81,237 @@ void demonstrateParserExamples() {
     }
 }
 
+void demonstrateExecution() {
+    cout << "\n=== EXECUTION: BYTECODE VIRTUAL MACHINE ===" << endl;
+
+    string program = "do print counter; counter = counter + 1 while counter < 10#";
+    cout << "Program: \"" << program << "\"" << endl;
+
+    vector<Token> tokens = scanner(program);
+    Parser parser(tokens);
+    if (!parser.parse()) {
+        parser.printErrors();
+        return;
+    }
+
+    Bytecode bytecode;
+    Compiler compiler;
+    compiler.compile(parser.getContext(), parser.getAst(), parser.getParseTree(), bytecode);
+
+    cout << "Bytecode:" << endl;
+    print_bytecode(bytecode);
+
+    cout << "Output:" << endl;
+    OutputBuffer output;
+    Vm vm;
+    vm.run(bytecode, output);
+    output.flush();
+}
+
+void demonstrateOptimizer() {
+    cout << "\n=== OPTIMIZER: CONSTANT FOLDING ===" << endl;
+
+    string program = "do a = 1 + 2 - 3; do x = x + 2 - 1 + y - y while 1 > 2; print x while x < 2 + 3#";
+    cout << "Program: \"" << program << "\"" << endl;
+
+    vector<Token> tokens = scanner(program);
+    Parser parser(tokens);
+    if (!parser.parse()) {
+        parser.printErrors();
+        return;
+    }
+    parser.printParseTree();
+
+    AstArena optimized;
+    Optimizer optimizer;
+    NodeId root = optimizer.optimize(parser.getContext(), parser.getAst(), parser.getParseTree(), optimized);
+    cout << "\nAfter optimization:" << endl;
+    printTreeHelper(optimized, root);
+
+    const OptimizeStats& stats = optimizer.stats();
+    cout << "Nodes: " << stats.nodesBefore << " -> " << stats.nodesAfter << " (" << stats.eliminated()
+        << " eliminated), constants folded: " << stats.constantsFolded << ", terms cancelled: "
+        << stats.termsCancelled << ", conditions folded: " << stats.comparisonsFolded
+        << ", loops removed: " << stats.loopsRemoved << endl;
+}
+
+// Optimizes, compiles and runs a parsed program
+static int executeProgram(CompilationContext& context, const AstArena& ast, NodeId parseTree, bool jit) {
+    AstArena optimized;
+    Optimizer optimizer;
+    NodeId root = optimizer.optimize(context, ast, parseTree, optimized);
+
+    // Through the SSA form: copies, dead stores, repeated and loop
+    // invariant operations go before register allocation
+    IrProgram ir;
+    IrBuilder builder;
+    builder.build(context, optimized, root, ir);
+    IrOptimizer passes;
+    passes.optimize(ir);
+    Bytecode bytecode;
+    lower_ir(ir, bytecode);
+
+    OutputBuffer output;
+    Vm vm;
+    JitProgram native;
+    if (jit && !native.compile(bytecode)) {
+        cerr << "No native code for this host, interpreting" << endl;
+    }
+    auto start = chrono::steady_clock::now();
+    uint64_t iterations;
+    if (jit) {
+        native.run(output);
+        iterations = native.iterationCount();
+    }
+    else {
+        vm.run(bytecode, output);
+        iterations = vm.iterationCount();
+    }
+    output.flush();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cerr << "Executed " << iterations << " loop iterations in "
+        << seconds * 1000 << " ms (optimizer eliminated " << optimizer.stats().eliminated()
+        << " of " << optimizer.stats().nodesBefore << " nodes, IR " << passes.stats().instructionsBefore
+        << " -> " << passes.stats().instructionsAfter << " instructions)" << endl;
+    return 0;
+}
+
+// Runs a single program: YPMT1 --run "program#" or YPMT1 --run-file path,
+// with --jit as native code
+int runProgram(string_view source, bool jit) {
+    CompilationContext context;
+    Lexer lexer(context, source);
+    Parser parser(lexer);
+    if (!parser.parse()) {
+        parser.printErrors();
+        return 1;
+    }
+    return executeProgram(context, parser.getAst(), parser.getParseTree(), jit);
+}
+
+// Prints the errors of a cached program the way Parser::printErrors does
+static void printCachedErrors(const CachedProgram& entry) {
+    cout << entry.messages();
+    if (entry.errorCount() > 1) {
+        cout << entry.errorCount() << " errors" << endl;
+    }
+}
+
+// Scans and parses source into a new cache entry, the parser keeps the result
+static void parseAndStore(const ProgramCache& cache, string_view source, TokenBuffer& tokens, Parser& parser) {
+    parser.parse();
+    string message;
+    if (!cache.store(source, tokens, parser, message)) {
+        cerr << "Warning: " << message << endl;
+    }
+}
+
+// Checks a program file in place: YPMT1 --check path, with --cache dir
+// through the scan and parse cache
+int checkFile(const string& path, const string& cacheDirectory) {
+    MappedFile file;
+    if (!file.open(path)) {
+        cerr << "Error: " << file.error() << endl;
+        return 2;
+    }
+
+    if (!cacheDirectory.empty()) {
+        auto start = chrono::steady_clock::now();
+        ProgramCache cache(cacheDirectory);
+        CachedProgram entry;
+        bool hit = cache.lookup(file.text(), entry);
+        bool success;
+        size_t nodes;
+        CompilationContext context;
+        TokenBuffer tokens;
+        if (hit) {
+            success = entry.accepted();
+            nodes = entry.nodeCount();
+        }
+        else {
+            if (!scanner(context, file.text(), tokens)) {
+                return 2;
+            }
+            Parser parser(tokens, context, file.text());
+            parseAndStore(cache, file.text(), tokens, parser);
+            success = !parser.hasErrors();
+            nodes = parser.getAst().size();
+            if (!success) {
+                cout << "✗ Program contains syntax errors" << endl;
+                parser.printErrors();
+            }
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        if (success) {
+            cout << "✓ Program is syntactically correct" << endl;
+        }
+        else if (hit) {
+            cout << "✗ Program contains syntax errors" << endl;
+            printCachedErrors(entry);
+        }
+        cerr << "Checked " << file.text().size() << " bytes, " << nodes << " nodes in " << seconds * 1000
+            << " ms (cache " << (hit ? "hit" : "miss") << ")" << endl;
+        return success ? 0 : 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    CompilationContext context;
+    Lexer lexer(context, file.text());
+    Parser parser(lexer);
+    bool success = parser.parse();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if (success) {
+        cout << "✓ Program is syntactically correct" << endl;
+    }
+    else {
+        cout << "✗ Program contains syntax errors" << endl;
+        parser.printErrors();
+    }
+    cerr << "Checked " << file.text().size() << " bytes, " << parser.getAst().size()
+        << " nodes in " << seconds * 1000 << " ms" << endl;
+    return success ? 0 : 1;
+}
+
+int runFile(const string& path, bool jit, const string& cacheDirectory) {
+    MappedFile file;
+    if (!file.open(path)) {
+        cerr << "Error: " << file.error() << endl;
+        return 2;
+    }
+    if (cacheDirectory.empty()) {
+        return runProgram(file.text(), jit);
+    }
+
+    // A hit restores the tables and the tree, there is no scanning or parsing
+    ProgramCache cache(cacheDirectory);
+    CachedProgram entry;
+    CompilationContext context;
+    if (cache.lookup(file.text(), entry)) {
+        if (!entry.accepted()) {
+            printCachedErrors(entry);
+            return 1;
+        }
+        AstArena ast;
+        entry.restore(context, ast);
+        return executeProgram(context, ast, entry.root(), jit);
+    }
+
+    TokenBuffer tokens;
+    if (!scanner(context, file.text(), tokens)) {
+        return 2;
+    }
+    Parser parser(tokens, context, file.text());
+    parseAndStore(cache, file.text(), tokens, parser);
+    if (parser.hasErrors()) {
+        parser.printErrors();
+        return 1;
+    }
+    return executeProgram(context, parser.getAst(), parser.getParseTree(), jit);
+}
+
 void printRecursiveDescentSchemes() {
     cout << "\n=== RECURSIVE DESCENT PROCEDURE SCHEMES ===" << endl;
 
@@ -106,8 +356,184 @@ void printRecursiveDescentSchemes() {
     cout << "   ELSE ERROR: 'expected identifier or number'" << endl;
 }
 
-int main() {
-    initKeywords();
+// --stats anywhere on the command line prints the statistics when main
+// returns, --stats=json as JSON
+class StatsReport {
+private:
+    bool requested = false;
+    bool json = false;
+
+public:
+    StatsReport(int argc, char* argv[]) {
+        for (int i = 1; i < argc; i++) {
+            string arg = argv[i];
+            requested = requested || arg == "--stats" || arg == "--stats=json";
+            json = json || arg == "--stats=json";
+        }
+    }
+
+    ~StatsReport() {
+        if (requested) {
+            print_stats(stats_snapshot(), json);
+        }
+    }
+};
+
+// A whole number argument of option; prints a usage error otherwise
+template <typename T>
+static bool numberArgument(const char* option, const char* text, T& value) {
+    const char* end = text + strlen(text);
+    auto result = from_chars(text, end, value);
+    if (result.ec != errc() || result.ptr != end || end == text) {
+        cerr << "Error: " << option << " expects a number, not '" << text << "'" << endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    StatsReport report(argc, argv);
+
+    bool jit = argc > 3 && string(argv[3]) == "--jit";
+    string cacheDirectory;
+    for (int i = 3; i + 1 < argc; i++) {
+        if (string(argv[i]) == "--cache") {
+            cacheDirectory = argv[i + 1];
+        }
+    }
+    if (argc > 1 && string(argv[1]) == "--serve") {
+        return serve_main(argc > 2 ? argv[2] : "");
+    }
+    if (argc > 2 && string(argv[1]) == "--run") {
+        return runProgram(argv[2], jit);
+    }
+    if (argc > 2 && string(argv[1]) == "--run-file") {
+        return runFile(argv[2], jit, cacheDirectory);
+    }
+    if (argc > 2 && string(argv[1]) == "--emit-c") {
+        return aot_main(argv[2], false);
+    }
+    if (argc > 2 && string(argv[1]) == "--emit-ir") {
+        return emit_ir_main(argv[2]);
+    }
+    if (argc > 2 && string(argv[1]) == "--aot") {
+        return aot_main(argv[2], true);
+    }
+    if (argc > 2 && string(argv[1]) == "--check") {
+        return checkFile(argv[2], cacheDirectory);
+    }
+    if (argc > 2 && string(argv[1]) == "--batch") {
+        BatchOptions options;
+        for (int i = 3; i < argc; i++) {
+            string arg = argv[i];
+            if (arg == "--exec") {
+                options.execute = true;
+            }
+            else if (arg == "--threads" && i + 1 < argc) {
+                if (!numberArgument("--threads", argv[++i], options.threads)) {
+                    return 2;
+                }
+                if (options.threads > MAX_THREADS) {
+                    cerr << "Error: --threads expects at most " << MAX_THREADS << ", not " << options.threads << endl;
+                    return 2;
+                }
+            }
+        }
+        return batch_main(argv[2], options);
+    }
+    if (argc > 2 && string(argv[1]) == "--dump") {
+        OutputFormat format = FORMAT_TEXT;
+        if (argc > 4 && string(argv[3]) == "--format" && !parse_format(argv[4], format)) {
+            cerr << "Error: unknown format '" << argv[4] << "', expected text, json or binary" << endl;
+            return 2;
+        }
+        return dump_main(argv[2], format);
+    }
+    if (argc > 2 && string(argv[1]) == "--pipeline") {
+        PipelineOptions options;
+        for (int i = 3; i < argc; i++) {
+            options.execute = options.execute || string(argv[i]) == "--exec";
+        }
+        return pipeline_main(argv[2], options);
+    }
+    if (argc > 2 && string(argv[1]) == "--bench" && string(argv[2]) == "simd") {
+        benchmark_scan_runs();
+        return 0;
+    }
+    if (argc > 2 && string(argv[1]) == "--bench" && string(argv[2]) == "tables") {
+        benchmark_tables();
+        return 0;
+    }
+    if (argc > 2 && string(argv[1]) == "--bench" && string(argv[2]) == "incremental") {
+        benchmark_incremental();
+        return 0;
+    }
+    if (argc > 2 && string(argv[1]) == "--bench" && string(argv[2]) == "optimize") {
+        benchmark_optimizer();
+        return 0;
+    }
+    if (argc > 2 && string(argv[1]) == "--bench" && string(argv[2]) == "jit") {
+        benchmark_jit();
+        return 0;
+    }
+    if (argc > 2 && string(argv[1]) == "--bench" && string(argv[2]) == "aot") {
+        benchmark_aot();
+        return 0;
+    }
+    if (argc > 2 && string(argv[1]) == "--bench" && string(argv[2]) == "ir") {
+        benchmark_ir();
+        return 0;
+    }
+    if (argc > 2 && string(argv[1]) == "--bench" && string(argv[2]) == "serve") {
+        benchmark_server();
+        return 0;
+    }
+    if (argc > 2 && string(argv[1]) == "--bench" && string(argv[2]) == "output") {
+        benchmark_output();
+        return 0;
+    }
+    if (argc > 2 && string(argv[1]) == "--bench" && string(argv[2]) == "suite") {
+        GenOptions options;
+        bool json = false;
+        for (int i = 3; i < argc; i++) {
+            string arg = argv[i];
+            if (arg == "--json") {
+                json = true;
+            }
+            else if (i + 1 < argc && arg == "--seed") {
+                if (!numberArgument("--seed", argv[++i], options.seed)) {
+                    return 2;
+                }
+            }
+            else if (i + 1 < argc && arg == "--size") {
+                if (!numberArgument("--size", argv[++i], options.size)) {
+                    return 2;
+                }
+            }
+            else if (i + 1 < argc && arg == "--depth") {
+                if (!numberArgument("--depth", argv[++i], options.maxDepth)) {
+                    return 2;
+                }
+            }
+            else if (i + 1 < argc && arg == "--ids") {
+                if (!numberArgument("--ids", argv[++i], options.identifiers)) {
+                    return 2;
+                }
+            }
+            else if (i + 1 < argc && arg == "--consts") {
+                if (!numberArgument("--consts", argv[++i], options.constants)) {
+                    return 2;
+                }
+            }
+            else if (i + 1 < argc && arg == "--errors") {
+                if (!numberArgument("--errors", argv[++i], options.errorRate)) {
+                    return 2;
+                }
+            }
+        }
+        benchmark_suite(options, json);
+        return 0;
+    }
 
     cout << "LABORATORY WORKS 1, 2 and 3" << endl;
     cout << "1. Information tables" << endl;
@@ -169,18 +595,12 @@ int main() {
 
     cout << "\nTABLE CONTENTS" << endl;
 
-    cout << "\nIdentifiers table:" << endl;
-    for (const auto& id : identifiers) {
-        cout << "  " << id.first << " -> code " << id.second << endl;
-    }
-
-    cout << "\nConstants table:" << endl;
-    for (const auto& cnst : codeToConst) {
-        cout << "  code " << cnst.first << " -> value " << cnst.second << endl;
-    }
+    print_tables(default_context());
 
     printRecursiveDescentSchemes();
     demonstrateParserExamples();
+    demonstrateExecution();
+    demonstrateOptimizer();
 
     cout << "\nADDITIONAL TEST" << endl;
     cout << "Enter a program to check (end with #):" << endl;
@@ -200,7 +620,7 @@ int main() {
     cout << "Tokens: ";
     print_tokens(userTokens);
 
-    Parser userParser(userTokens);
+    Parser userParser(userTokens, default_context(), userProgram);
     bool userSuccess = userParser.parse();
 
     if (userSuccess) {
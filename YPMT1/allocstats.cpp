@@ -0,0 +1,49 @@
+// allocstats.cpp
+#include "allocstats.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+#ifdef YPMT_ALLOC_STATS
+
+static atomic<uint64_t> allocationCount(0);
+static atomic<uint64_t> allocationBytes(0);
+
+AllocationCounts allocation_counts() {
+    return { allocationCount.load(memory_order_relaxed), allocationBytes.load(memory_order_relaxed) };
+}
+
+// The array and nothrow forms call this one, and the default deletes call
+// operator delete(void*)
+void* operator new(size_t size) {
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    allocationBytes.fetch_add(size, memory_order_relaxed);
+    for (;;) {
+        if (void* p = malloc(size > 0 ? size : 1)) {
+            return p;
+        }
+        new_handler handler = get_new_handler();
+        if (!handler) {
+            throw bad_alloc();
+        }
+        handler();
+    }
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+#else
+
+AllocationCounts allocation_counts() {
+    return { 0, 0 };
+}
+
+#endif
@@ -0,0 +1,25 @@
+// allocstats.h
+#ifndef ALLOCSTATS_H
+#define ALLOCSTATS_H
+
+#include <cstdint>
+
+// Totals since the start of the program. With YPMT_ALLOC_STATS (the Debug
+// and Bench configurations define it) allocstats.cpp replaces the global
+// operator new, so every allocation of the program is counted; Release
+// keeps the default allocator and counts nothing. Bench is Release with
+// the counting allocator, for benchmarks that report both.
+#ifdef YPMT_ALLOC_STATS
+const bool ALLOCATIONS_COUNTED = true;
+#else
+const bool ALLOCATIONS_COUNTED = false;
+#endif
+
+struct AllocationCounts {
+    uint64_t count;
+    uint64_t bytes;
+};
+
+AllocationCounts allocation_counts();
+
+#endif
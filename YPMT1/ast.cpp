@@ -0,0 +1,117 @@
+// ast.cpp
+#include "ast.h"
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+NodeId AstArena::addLeaf(NodeType type, uint32_t value) {
+    NodeId id = static_cast<NodeId>(nodes.size());
+    nodes.push_back({ type, OP_NONE, value, static_cast<uint32_t>(children.size()), 0 });
+    return id;
+}
+
+NodeId AstArena::addNode(NodeType type, OpKind op, const NodeId* kids, uint32_t count) {
+    NodeId id = static_cast<NodeId>(nodes.size());
+    uint32_t first = static_cast<uint32_t>(children.size());
+    children.insert(children.end(), kids, kids + count);
+    nodes.push_back({ type, op, 0, first, count });
+    return id;
+}
+
+void AstArena::replaceChildren(NodeId id, uint32_t at, uint32_t removed, const NodeId* kids, uint32_t count) {
+    uint32_t first = nodes[id].firstChild;
+    uint32_t oldCount = nodes[id].childCount;
+    uint32_t newCount = oldCount - removed + count;
+
+    if (newCount > oldCount) {
+        size_t end = first + oldCount;
+        size_t room = 0;
+        while (room < newCount - oldCount && end + room < children.size() && children[end + room] == NO_NODE) {
+            room++;
+        }
+        if (room < newCount - oldCount) {
+            size_t moved = children.size();
+            children.resize(moved + newCount + newCount / 2, NO_NODE);
+            copy(children.begin() + first, children.begin() + end, children.begin() + moved);
+            fill(children.begin() + first, children.begin() + end, NO_NODE);
+            first = static_cast<uint32_t>(moved);
+        }
+    }
+
+    // The children after the replaced ones move to their new place
+    NodeId* block = children.data() + first;
+    if (count < removed) {
+        copy(block + at + removed, block + oldCount, block + at + count);
+        fill(block + newCount, block + oldCount, NO_NODE);
+    }
+    else if (count > removed) {
+        copy_backward(block + at + removed, block + oldCount, block + newCount);
+    }
+    copy(kids, kids + count, block + at);
+
+    nodes[id].firstChild = first;
+    nodes[id].childCount = newCount;
+}
+
+void AstArena::reserve(size_t nodeCount) {
+    nodes.reserve(nodeCount);
+    children.reserve(nodeCount);
+}
+
+void AstArena::reset() {
+    // AstNode and NodeId are trivially destructible, so clear() is O(1)
+    nodes.clear();
+    children.clear();
+}
+
+void AstArena::truncate(size_t nodeCount, size_t childCount) {
+    nodes.resize(nodeCount);
+    children.resize(childCount);
+}
+
+void AstArena::assign(const AstNode* nodeArray, size_t nodeCount, const NodeId* childArray, size_t childCount) {
+    nodes.assign(nodeArray, nodeArray + nodeCount);
+    children.assign(childArray, childArray + childCount);
+}
+
+NodeId AstArena::compact(NodeId root, vector<NodeId>& remap) {
+    remap.assign(nodes.size(), NO_NODE);
+    if (root == NO_NODE) {
+        reset();
+        return NO_NODE;
+    }
+
+    // Post-order copy with an explicit stack: the copy is bottom-up again
+    // even if setChildren() gave older nodes newer children
+    vector<AstNode> keptNodes;
+    vector<NodeId> keptChildren;
+    vector<pair<NodeId, uint32_t>> stack;   // node, next child to visit
+    vector<NodeId> done;                    // copies of finished children
+    stack.push_back({ root, 0 });
+
+    while (!stack.empty()) {
+        NodeId id = stack.back().first;
+        uint32_t next = stack.back().second;
+        const AstNode& node = nodes[id];
+        if (next < node.childCount) {
+            stack.back().second++;
+            stack.push_back({ children[node.firstChild + next], 0 });
+            continue;
+        }
+
+        AstNode copy = node;
+        copy.firstChild = static_cast<uint32_t>(keptChildren.size());
+        keptChildren.insert(keptChildren.end(), done.end() - node.childCount, done.end());
+        done.resize(done.size() - node.childCount);
+
+        remap[id] = static_cast<NodeId>(keptNodes.size());
+        keptNodes.push_back(copy);
+        done.push_back(remap[id]);
+        stack.pop_back();
+    }
+
+    nodes.swap(keptNodes);
+    children.swap(keptChildren);
+    return remap[root];
+}
@@ -0,0 +1,92 @@
+// ast.h
+#ifndef AST_H
+#define AST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Node types for parse tree
+enum NodeType : uint8_t {
+    NODE_PROGRAM,
+    NODE_DO_WHILE,
+    NODE_ASSIGNMENT,
+    NODE_PRINT,
+    NODE_BINARY_OP,
+    NODE_COMPARISON,
+    NODE_IDENTIFIER,
+    NODE_CONSTANT,
+    NODE_EXPRESSION,
+    NODE_TERM,
+    NODE_FACTOR
+};
+
+// Operators of NODE_BINARY_OP and NODE_COMPARISON
+enum OpKind : uint8_t {
+    OP_NONE,
+    OP_ADD,     // +
+    OP_SUB,     // -
+    OP_LT,      // <
+    OP_GT       // >
+};
+
+// Nodes are referenced by index in the arena
+typedef uint32_t NodeId;
+const NodeId NO_NODE = 0xFFFFFFFFu;
+
+// Parse tree node stored in the arena.
+// value is the identifiers table code for NODE_IDENTIFIER and
+// the constants table code for NODE_CONSTANT.
+struct AstNode {
+    NodeType type;
+    OpKind op;
+    uint32_t value;
+    uint32_t firstChild;   // index into the children array
+    uint32_t childCount;
+};
+
+// Flat parse tree: all nodes in one vector, children of a node are
+// a contiguous block in a side array. Nodes are created bottom-up,
+// so a node is added after all of its children.
+class AstArena {
+private:
+    std::vector<AstNode> nodes;
+    std::vector<NodeId> children;
+
+public:
+    NodeId addLeaf(NodeType type, uint32_t value);
+    NodeId addNode(NodeType type, OpKind op, const NodeId* kids, uint32_t count);
+
+    const AstNode& operator[](NodeId id) const { return nodes[id]; }
+    AstNode& operator[](NodeId id) { return nodes[id]; }
+    const NodeId* childrenOf(NodeId id) const { return children.data() + nodes[id].firstChild; }
+    NodeId* childrenOf(NodeId id) { return children.data() + nodes[id].firstChild; }
+    NodeId child(NodeId id, uint32_t i) const { return children[nodes[id].firstChild + i]; }
+
+    // Replaces children [at, at + removed) of a node with count others,
+    // which may be newer than the node. A block grows into the free slots
+    // (NO_NODE) after it, or moves to the end with room to grow further.
+    void replaceChildren(NodeId id, uint32_t at, uint32_t removed, const NodeId* kids, uint32_t count);
+
+    size_t size() const { return nodes.size(); }
+    size_t childSlots() const { return children.size(); }
+    const AstNode* nodeData() const { return nodes.data(); }
+    const NodeId* childData() const { return children.data(); }
+    bool empty() const { return nodes.empty(); }
+    void reserve(size_t nodeCount);
+
+    // Frees the whole tree at once, capacity is kept for the next parse
+    void reset();
+    // Drops the nodes and child slots added after the arena had nodeCount
+    // and childCount of them; nothing older may refer to them
+    void truncate(size_t nodeCount, size_t childCount);
+
+    // Replaces the tree with a copy of the two arrays
+    void assign(const AstNode* nodeArray, size_t nodeCount, const NodeId* childArray, size_t childCount);
+
+    // Keeps only the nodes reachable from root, copied bottom-up;
+    // remap[old id] is the new id (NO_NODE if dropped). Returns the new root.
+    NodeId compact(NodeId root, std::vector<NodeId>& remap);
+};
+
+#endif
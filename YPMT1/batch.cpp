@@ -0,0 +1,220 @@
+// batch.cpp
+#include "batch.h"
+#include "scanner.h"
+#include "parser.h"
+#include "compiler.h"
+#include "vm.h"
+#include "tables.h"
+#include "source.h"
+#include "simdscan.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <thread>
+
+using namespace std;
+
+void WorkQueue::push(size_t job) {
+    lock_guard<mutex> guard(lock);
+    items.push_back(job);
+}
+
+bool WorkQueue::pop(size_t& job) {
+    lock_guard<mutex> guard(lock);
+    if (items.empty()) {
+        return false;
+    }
+    job = items.front();
+    items.pop_front();
+    return true;
+}
+
+bool WorkQueue::steal(size_t& job) {
+    lock_guard<mutex> guard(lock);
+    if (items.empty()) {
+        return false;
+    }
+    job = items.back();
+    items.pop_back();
+    return true;
+}
+
+unsigned worker_count(unsigned requested, size_t count) {
+    unsigned threads = requested ? requested : max(1u, thread::hardware_concurrency());
+    if (threads > count) {
+        threads = static_cast<unsigned>(max<size_t>(count, 1));
+    }
+    return threads;
+}
+
+void run_work_stealing(size_t count, unsigned threads,
+    const function<void(size_t job, unsigned worker)>& task) {
+    threads = worker_count(threads, count);
+
+    // Every worker starts with a contiguous block of jobs
+    vector<WorkQueue> queues(threads);
+    for (unsigned w = 0; w < threads; w++) {
+        size_t begin = count * w / threads;
+        size_t end = count * (w + 1) / threads;
+        for (size_t job = begin; job < end; job++) {
+            queues[w].push(job);
+        }
+    }
+
+    auto worker = [&](unsigned self) {
+        size_t job;
+        for (;;) {
+            if (queues[self].pop(job)) {
+                task(job, self);
+                continue;
+            }
+            bool stolen = false;
+            for (unsigned k = 1; k < threads && !stolen; k++) {
+                stolen = queues[(self + k) % threads].steal(job);
+            }
+            if (!stolen) {
+                return;
+            }
+            task(job, self);
+        }
+    };
+
+    vector<thread> pool;
+    for (unsigned w = 1; w < threads; w++) {
+        pool.emplace_back(worker, w);
+    }
+    worker(0);
+    for (thread& t : pool) {
+        t.join();
+    }
+}
+
+static void check_program(CompilationContext& context, string_view text,
+    const BatchOptions& options, BatchResult& result) {
+    // Every program gets fresh codes, independent of what ran before on this worker
+    context.reset();
+
+    Lexer lexer(context, text);
+    Parser parser(lexer);
+    result.accepted = parser.parse();
+    if (!result.accepted) {
+        for (const Diagnostic& diagnostic : parser.getDiagnostics()) {
+            if (!result.message.empty()) {
+                result.message += "; ";
+            }
+            result.message += parser.formatDiagnostic(diagnostic);
+        }
+        return;
+    }
+    if (!options.execute) {
+        return;
+    }
+
+    Bytecode bytecode;
+    Compiler compiler;
+    compiler.compile(context, parser.getAst(), parser.getParseTree(), bytecode);
+
+    OutputBuffer output(nullptr);
+    Vm vm;
+    if (vm.run(bytecode, output, options.maxIterations) == VM_LOOP_LIMIT) {
+        result.message = "stopped after " + to_string(options.maxIterations) + " loop iterations";
+    }
+    result.output = output.text();
+}
+
+vector<BatchResult> run_batch(const vector<BatchJob>& jobs, const BatchOptions& options) {
+    vector<BatchResult> results(jobs.size());
+
+    // One context per worker, reused for all of its jobs
+    unsigned threads = worker_count(options.threads, jobs.size());
+    vector<CompilationContext> contexts(threads);
+
+    run_work_stealing(jobs.size(), threads, [&](size_t job, unsigned worker) {
+        const BatchJob& j = jobs[job];
+        if (!j.text.data()) {
+            MappedFile file;
+            if (!file.open(j.name)) {
+                results[job].message = "Error: " + file.error();
+                return;
+            }
+            check_program(contexts[worker], file.text(), options, results[job]);
+        }
+        else {
+            check_program(contexts[worker], j.text, options, results[job]);
+        }
+    });
+
+    return results;
+}
+
+// Splits a stream into programs, each one ending with its '#'
+static void split_programs(string_view stream, vector<BatchJob>& jobs) {
+    const ScanRuns& runs = active_scan_runs();
+    const char* p = stream.data();
+    const char* end = p + stream.size();
+
+    while (p < end) {
+        const char* hash = runs.findEnd(p, end);
+        const char* stop = (hash < end) ? hash + 1 : end;
+        if (runs.skipSpace(p, stop) < stop) {
+            jobs.push_back({ "#" + to_string(jobs.size() + 1), string_view(p, stop - p) });
+        }
+        p = stop;
+    }
+}
+
+int batch_main(const string& input, const BatchOptions& options) {
+    vector<BatchJob> jobs;
+    MappedFile file;
+    string stdinText;
+
+    if (input == "-") {
+        stdinText.assign(istreambuf_iterator<char>(cin), istreambuf_iterator<char>());
+        split_programs(stdinText, jobs);
+    }
+    else if (filesystem::is_directory(input)) {
+        for (const auto& entry : filesystem::directory_iterator(input)) {
+            if (entry.is_regular_file()) {
+                jobs.push_back({ entry.path().string(), string_view() });
+            }
+        }
+        sort(jobs.begin(), jobs.end(), [](const BatchJob& a, const BatchJob& b) {
+            return a.name < b.name;
+        });
+    }
+    else {
+        if (!file.open(input)) {
+            cerr << "Error: " << file.error() << endl;
+            return 2;
+        }
+        split_programs(file.text(), jobs);
+    }
+
+    auto start = chrono::steady_clock::now();
+    vector<BatchResult> results = run_batch(jobs, options);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // Results are reported in input order
+    size_t accepted = 0;
+    string report;
+    for (size_t i = 0; i < results.size(); i++) {
+        const BatchResult& r = results[i];
+        report += jobs[i].name;
+        report += r.accepted ? ": accepted" : ": rejected";
+        if (!r.message.empty()) {
+            report += " (" + r.message + ")";
+        }
+        report += '\n';
+        report += r.output;
+        accepted += r.accepted;
+    }
+    cout << report << flush;
+
+    unsigned threads = worker_count(options.threads, jobs.size());
+    cerr << results.size() << " programs, " << accepted << " accepted, "
+        << results.size() - accepted << " rejected in " << seconds * 1000 << " ms ("
+        << threads << " threads)" << endl;
+    return accepted == results.size() ? 0 : 1;
+}
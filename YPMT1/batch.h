@@ -0,0 +1,62 @@
+// batch.h
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Job indices of one worker. The owner takes jobs from the front,
+// other workers steal from the back.
+class alignas(64) WorkQueue {
+private:
+    std::mutex lock;
+    std::deque<size_t> items;
+
+public:
+    void push(size_t job);
+    bool pop(size_t& job);
+    bool steal(size_t& job);
+};
+
+// Most worker threads --threads accepts
+const unsigned MAX_THREADS = 1024;
+
+// Workers for count jobs: requested, or all hardware threads for 0, but
+// no more than there are jobs and at least one
+unsigned worker_count(unsigned requested, size_t count);
+
+// Runs task(job, worker) for jobs 0..count-1 on a work-stealing pool.
+// No new jobs appear while it runs, so a worker stops once it finds
+// nothing to steal.
+void run_work_stealing(size_t count, unsigned threads,
+    const std::function<void(size_t job, unsigned worker)>& task);
+
+struct BatchJob {
+    std::string name;           // file path, or "#n" for stream input
+    std::string_view text;      // program text when it is already in memory
+};
+
+struct BatchResult {
+    bool accepted = false;
+    std::string message;        // syntax errors or execution summary
+    std::string output;         // print output when executing
+};
+
+struct BatchOptions {
+    unsigned threads = 0;           // 0 = all hardware threads
+    bool execute = false;
+    uint64_t maxIterations = 1000000;
+};
+
+std::vector<BatchResult> run_batch(const std::vector<BatchJob>& jobs, const BatchOptions& options);
+
+// YPMT1 --batch <directory | file | -> [--threads N] [--exec]
+int batch_main(const std::string& input, const BatchOptions& options);
+
+#endif
@@ -0,0 +1,978 @@
+// bench.cpp
+#include "bench.h"
+#include "allocstats.h"
+#include "cemit.h"
+#include "compiler.h"
+#include "gen.h"
+#include "incremental.h"
+#include "ir.h"
+#include "iropt.h"
+#include "jit.h"
+#include "optimizer.h"
+#include "output.h"
+#include "parser.h"
+#include "simdscan.h"
+#include "scanner.h"
+#include "server.h"
+#include "tables.h"
+#include "vm.h"
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define BENCH_HAS_TSC 1
+#endif
+
+using namespace std;
+
+// Time stamp counter ticks, or nanoseconds where there is no TSC
+static inline uint64_t ticks() {
+#ifdef BENCH_HAS_TSC
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// Builds runs of `body` characters of length runLength separated by one `gap`
+static string makeRuns(size_t size, const string& body, size_t runLength, char gap) {
+    string s;
+    s.reserve(size + runLength + 1);
+    size_t k = 0;
+    while (s.size() < size) {
+        for (size_t i = 0; i < runLength; i++) {
+            s += body[k++ % body.size()];
+        }
+        s += gap;
+    }
+    return s;
+}
+
+// Sweeps the whole buffer with fn, returns bytes per tick (best of 5)
+static double sweep(RunFunction fn, const string& data) {
+    const char* begin = data.data();
+    const char* end = begin + data.size();
+    double best = 0;
+    volatile size_t sink = 0;
+
+    for (int rep = 0; rep < 5; rep++) {
+        uint64_t t0 = ticks();
+        const char* p = begin;
+        size_t runs = 0;
+        while (p < end) {
+            p = fn(p, end) + 1;
+            runs++;
+        }
+        uint64_t t1 = ticks();
+        sink = sink + runs;
+        double rate = static_cast<double>(data.size()) / static_cast<double>(t1 - t0 ? t1 - t0 : 1);
+        if (rate > best) best = rate;
+    }
+    return best;
+}
+
+static double scanRate(const string& program) {
+    double best = 0;
+    for (int rep = 0; rep < 3; rep++) {
+        uint64_t t0 = ticks();
+        vector<Token> tokens = scanner(program);
+        uint64_t t1 = ticks();
+        double rate = static_cast<double>(program.size()) / static_cast<double>(t1 - t0 ? t1 - t0 : 1);
+        if (rate > best) best = rate;
+    }
+    return best;
+}
+
+void benchmark_scan_runs() {
+    const size_t size = 32 << 20;
+    const ScanRuns& scalar = scalar_scan_runs();
+    const ScanRuns& simd = simd_scan_runs();
+
+    string spaces = makeRuns(size, " \t  \n ", 200, 'x');
+    string idents = makeRuns(size, "counterValue42abc", 64, ' ');
+    string digits = makeRuns(size, "9876543210", 48, ' ');
+    string noEnd = makeRuns(size, "do x = x + 1 while x < 10 ", 64, ' ');
+
+    const char* unit =
+#ifdef BENCH_HAS_TSC
+        "bytes/cycle (TSC)";
+#else
+        "bytes/ns";
+#endif
+
+    cout << "\n=== SCANNER RUN BENCHMARK (" << unit << ") ===" << endl;
+    cout << "SIMD implementation: " << simd.name << endl;
+    cout << left << setw(24) << "run" << setw(12) << scalar.name << setw(12) << simd.name << "speedup" << endl;
+
+    struct Case {
+        const char* name;
+        RunFunction ScanRuns::* fn;
+        const string* data;
+    } cases[] = {
+        { "whitespace (200)", &ScanRuns::skipSpace, &spaces },
+        { "identifier (64)", &ScanRuns::skipAlnum, &idents },
+        { "digits (48)", &ScanRuns::skipDigits, &digits },
+        { "find '#'", &ScanRuns::findEnd, &noEnd },
+    };
+
+    cout << fixed << setprecision(3);
+    for (const Case& c : cases) {
+        double a = sweep(scalar.*c.fn, *c.data);
+        double b = sweep(simd.*c.fn, *c.data);
+        cout << setw(24) << c.name << setw(12) << a << setw(12) << b << b / a << "x" << endl;
+    }
+
+    // Whole scanner on a program made of long lexemes
+    string program;
+    program.reserve(size + 128);
+    for (int k = 0; program.size() < size; k++) {
+        program += "do identifierNumber" + to_string(k % 512) + " = identifierNumber" +
+            to_string(k % 512) + " + 1234567890                                ;"
+            "                                print total while total < 99999\n";
+    }
+    program += "#";
+
+    select_scan_runs(scalar);
+    double a = scanRate(program);
+    select_scan_runs(simd);
+    double b = scanRate(program);
+    cout << setw(24) << "scanner()" << setw(12) << a << setw(12) << b << b / a << "x" << endl;
+    cout << right << defaultfloat;
+}
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static void reportRate(const char* name, size_t ops, double seconds, double baseline) {
+    cout << setw(36) << name << setw(10) << seconds * 1e9 / static_cast<double>(ops) << " ns/op";
+    if (baseline > 0) {
+        cout << "   std::map " << baseline * 1e9 / static_cast<double>(ops) << " ns/op";
+    }
+    cout << endl;
+}
+
+void benchmark_tables() {
+    const size_t distinct = 2000000;
+    const size_t repeats = 10000000;
+    const size_t hot = 1000;
+
+    vector<string> names;
+    names.reserve(distinct);
+    for (size_t i = 0; i < distinct; i++) {
+        names.push_back("identifier_" + to_string(i * 2654435761u % 100000007u));
+    }
+
+    cout << "\n=== INTERNING TABLES BENCHMARK ===" << endl;
+    cout << fixed << setprecision(1) << left;
+
+    InternTable table;
+    map<string, int, less<>> reference;
+    long long check = 0;
+
+    // Distinct names: every call inserts
+    auto t0 = chrono::steady_clock::now();
+    for (const string& n : names) {
+        check += table.intern(n);
+    }
+    double ours = secondsSince(t0);
+
+    t0 = chrono::steady_clock::now();
+    for (const string& n : names) {
+        auto it = reference.find(n);
+        if (it == reference.end()) {
+            reference.emplace(n, static_cast<int>(reference.size() + 1));
+        }
+    }
+    double theirs = secondsSince(t0);
+    reportRate("insert 2M distinct identifiers", distinct, ours, theirs);
+
+    // Repeated names from a small working set
+    t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < repeats; i++) {
+        check += table.intern(names[i % hot]);
+    }
+    ours = secondsSince(t0);
+
+    t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < repeats; i++) {
+        check += reference.find(names[i % hot])->second;
+    }
+    theirs = secondsSince(t0);
+    reportRate("10M repeats, 1K hot identifiers", repeats, ours, theirs);
+
+    // Repeated names spread over the whole table
+    t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < repeats; i++) {
+        check += table.intern(names[(i * 7919) % distinct]);
+    }
+    ours = secondsSince(t0);
+
+    t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < repeats; i++) {
+        check += reference.find(names[(i * 7919) % distinct])->second;
+    }
+    theirs = secondsSince(t0);
+    reportRate("10M repeats over 2M identifiers", repeats, ours, theirs);
+
+    // Constants
+    ConstTable consts;
+    t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < repeats; i++) {
+        check += consts.intern(static_cast<int>(i % distinct));
+    }
+    reportRate("10M make_dig, 2M distinct values", repeats, secondsSince(t0), 0);
+
+    t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < repeats; i++) {
+        check += consts.value(static_cast<int>(i % consts.size()) + 1);
+    }
+    reportRate("10M val_dig", repeats, secondsSince(t0), 0);
+
+    cout << right << defaultfloat << "(checksum " << check << ")" << endl;
+}
+
+void benchmark_incremental() {
+    const size_t statements = 200000;
+    const size_t edits = 20000;
+
+    string program = "do ";
+    for (size_t i = 0; i < statements; i++) {
+        if (i > 0) program += "; ";
+        if (i % 100 == 50) {
+            program += "do v" + to_string(i % 37) + " = v" + to_string(i % 37) + " + 1; print v1 while v1 < 7";
+        }
+        else {
+            program += "v" + to_string(i % 37) + " = v" + to_string(i % 11) + " + " + to_string(i % 1000) + " - w";
+        }
+    }
+    program += " while v0 < 10#";
+
+    cout << "\n=== INCREMENTAL PARSING BENCHMARK ===" << endl;
+    cout << "program: " << program.size() / 1024 << " KB, " << statements << " statements" << endl;
+
+    IncrementalProgram incremental;
+    double full = 1e9;
+    for (int rep = 0; rep < 3; rep++) {
+        auto t0 = chrono::steady_clock::now();
+        incremental.load(program);
+        double seconds = secondsSince(t0);
+        if (seconds < full) full = seconds;
+    }
+
+    // Valid edits near a cursor that jumps now and then: change a digit,
+    // rename a variable, insert a statement before a ';'
+    mt19937 random(42);
+    size_t lexed = 0, parsed = 0, fullParses = 0;
+    size_t cursor = 0;
+    auto text = [&](size_t i) { return incremental.charAt(i); };
+    auto t0 = chrono::steady_clock::now();
+    for (size_t e = 0; e < edits; e++) {
+        size_t size = incremental.size();
+        cursor = (e % 50 == 0) ? random() % size : (cursor + random() % 256) % size;
+        size_t at = cursor;
+        if (e % 3 == 0) {
+            while (!isdigit(static_cast<unsigned char>(text(at)))) at = (at + 1) % size;
+            incremental.edit({ at, 1, string(1, static_cast<char>('1' + random() % 9)) });
+        }
+        else if (e % 3 == 1) {
+            size_t end;
+            string word;
+            for (;; at = end % size) {
+                while (!isalpha(static_cast<unsigned char>(text(at))) || (at > 0 && isalnum(static_cast<unsigned char>(text(at - 1))))) {
+                    at = (at + 1) % size;
+                }
+                word.clear();
+                for (end = at; end < size && isalnum(static_cast<unsigned char>(text(end))); end++) {
+                    word += text(end);
+                }
+                if (find_word(word) == 0) break;
+            }
+            incremental.edit({ at, end - at, "x" + to_string(random() % 50) });
+        }
+        else {
+            while (text(at) != ';') at = (at + 1) % size;
+            incremental.edit({ at, 0, "; print x1" });
+        }
+
+        lexed += incremental.lastEdit().tokensLexed;
+        parsed += incremental.lastEdit().tokensParsed;
+        fullParses += incremental.lastEdit().fullParse;
+    }
+    double seconds = secondsSince(t0);
+
+    // Statements typed a byte at a time, as in an editor: the program is
+    // rejected until each one is complete
+    const string typed = "; v1 = v2 + 3";
+    size_t keys = 0, rejected = 0, typedFullParses = 0;
+    t0 = chrono::steady_clock::now();
+    for (size_t e = 0; e < edits / typed.size(); e++) {
+        size_t size = incremental.size();
+        size_t at = random() % size;
+        while (text(at) != ';') at = (at + 1) % size;
+        for (char c : typed) {
+            incremental.edit({ at++, 0, string_view(&c, 1) });
+            keys++;
+            rejected += !incremental.accepted();
+            typedFullParses += incremental.lastEdit().fullParse;
+        }
+    }
+    double typingSeconds = secondsSince(t0);
+
+    cout << fixed << setprecision(1);
+    cout << "scan + parse of the whole program: " << full * 1e6 << " us" << endl;
+    cout << "incremental edit: " << seconds * 1e6 / edits << " us, "
+        << static_cast<double>(lexed) / edits << " tokens lexed, "
+        << static_cast<double>(parsed) / edits << " tokens parsed, "
+        << fullParses << " full parses in " << edits << " edits" << endl;
+    cout << "typing: " << typingSeconds * 1e6 / keys << " us per key, " << rejected << " of " << keys
+        << " keys leave the program rejected, " << typedFullParses << " full parses" << endl;
+    cout << defaultfloat << "accepted after edits: " << (incremental.accepted() ? "yes" : "no") << endl;
+}
+
+void benchmark_optimizer() {
+    const size_t statements = 20000;
+    const int iterations = 200;
+
+    // Loop bodies full of constant arithmetic and cancelling terms
+    string program = "do i = i + 1";
+    for (size_t i = 0; i < statements; i++) {
+        string v = "v" + to_string(i % 29);
+        string w = "w" + to_string(i % 13);
+        switch (i % 4) {
+        case 0: program += "; " + v + " = 1 + 2 - 3 + " + w + " + " + to_string(i % 100); break;
+        case 1: program += "; " + v + " = " + w + " + 5 - " + w + " + i - 5"; break;
+        case 2: program += "; do " + w + " = " + w + " + 1 - 1 while 2 > 3"; break;
+        default: program += "; " + v + " = " + v + " + 0 - " + w + " + " + w; break;
+        }
+    }
+    program += "; print i while i < " + to_string(iterations) + " + 0#";
+
+    CompilationContext context;
+    vector<Token> tokens = scanner(context, program);
+    Parser parser(tokens, context, program);
+    if (!parser.parse()) {
+        parser.printErrors();
+        return;
+    }
+
+    AstArena optimized;
+    Optimizer optimizer;
+    NodeId root = NO_NODE;
+    double best = 1e9;
+    for (int rep = 0; rep < 5; rep++) {
+        auto t0 = chrono::steady_clock::now();
+        root = optimizer.optimize(context, parser.getAst(), parser.getParseTree(), optimized);
+        double seconds = secondsSince(t0);
+        if (seconds < best) best = seconds;
+    }
+    const OptimizeStats& stats = optimizer.stats();
+
+    Compiler compiler;
+    Bytecode plain, folded;
+    compiler.compile(context, parser.getAst(), parser.getParseTree(), plain);
+    compiler.compile(context, optimized, root, folded);
+
+    Vm vm;
+    OutputBuffer output(nullptr);
+    auto t0 = chrono::steady_clock::now();
+    vm.run(plain, output);
+    double plainSeconds = secondsSince(t0);
+    string plainOutput(output.text());
+    output.clear();
+    t0 = chrono::steady_clock::now();
+    vm.run(folded, output);
+    double foldedSeconds = secondsSince(t0);
+
+    cout << "\n=== OPTIMIZER BENCHMARK ===" << endl;
+    cout << "program: " << program.size() / 1024 << " KB, " << statements << " statements, "
+        << iterations << " iterations" << endl;
+    cout << fixed << setprecision(1);
+    cout << "pass: " << best * 1e3 << " ms, " << stats.nodesBefore / best / 1e6 << " M nodes/s" << endl;
+    cout << "nodes: " << stats.nodesBefore << " -> " << stats.nodesAfter << " (" << stats.eliminated()
+        << " eliminated, " << 100.0 * stats.eliminated() / stats.nodesBefore << "%)" << endl;
+    cout << "constants folded: " << stats.constantsFolded << ", terms cancelled: " << stats.termsCancelled
+        << ", conditions folded: " << stats.comparisonsFolded << ", loops removed: " << stats.loopsRemoved << endl;
+    cout << "bytecode: " << plain.code.size() << " -> " << folded.code.size() << " instructions" << endl;
+    cout << "run: " << plainSeconds * 1e3 << " ms -> " << foldedSeconds * 1e3 << " ms"
+        << (output.text() == plainOutput ? "" : "  OUTPUT DIFFERS") << endl;
+    cout << defaultfloat;
+}
+
+// Direct evaluation of the parse tree, the baseline for the JIT benchmark
+class TreeWalker {
+private:
+    const AstArena& ast;
+    const CompilationContext& context;
+    OutputBuffer& out;
+
+    int64_t value(NodeId id) const {
+        const AstNode& node = ast[id];
+        switch (node.type) {
+        case NODE_CONSTANT: return context.val_dig(node.value);
+        case NODE_IDENTIFIER: return vars[node.value];
+        default: {
+            uint64_t l = static_cast<uint64_t>(value(ast.child(id, 0)));
+            uint64_t r = static_cast<uint64_t>(value(ast.child(id, 1)));
+            return static_cast<int64_t>(node.op == OP_ADD ? l + r : l - r);
+        }
+        }
+    }
+
+public:
+    std::vector<int64_t> vars;
+
+    TreeWalker(const AstArena& tree, const CompilationContext& ctx, OutputBuffer& output)
+        : ast(tree), context(ctx), out(output), vars(ctx.identifiers.size() + 1, 0) {
+    }
+
+    void run(NodeId id) {
+        const AstNode& node = ast[id];
+        switch (node.type) {
+        case NODE_ASSIGNMENT:
+            vars[ast[ast.child(id, 0)].value] = value(ast.child(id, 1));
+            break;
+        case NODE_PRINT:
+            out.printValue(vars[ast[ast.child(id, 0)].value]);
+            break;
+        case NODE_DO_WHILE: {
+            NodeId cond = ast.child(id, node.childCount - 1);
+            bool less = ast[cond].op == OP_LT;
+            do {
+                for (uint32_t i = 0; i + 1 < node.childCount; i++) {
+                    run(ast.child(id, i));
+                }
+            } while (less ? value(ast.child(cond, 0)) < value(ast.child(cond, 1))
+                : value(ast.child(cond, 0)) > value(ast.child(cond, 1)));
+            break;
+        }
+        default:
+            break;
+        }
+    }
+};
+
+static const pair<const char*, const char*> loopPrograms[] = {
+    { "print loop", "do print counter; counter = counter + 1 while counter < 2000000#" },
+    { "nested loops", "do j = 0; do s = s + i - j + 3; j = j + 1 while j < 1000; i = i + 1 while i < 5000#" },
+    { "12 variables", "do a = a + 1; b = b + a; c = c + b - a; d = d + c; e = e + d - b; f = f + e; "
+        "g = g + f - e; h = h + g; k = k + h - g; m = m + k; n = n + m - k; i = i + 1 while i < 3000000#" },
+};
+
+void benchmark_jit() {
+
+    cout << "\n=== JIT BENCHMARK ===" << endl;
+#ifndef JIT_X86_64
+    cout << "no x86-64 code generator on this host, the JIT column interprets" << endl;
+#endif
+    cout << setw(14) << "program" << setw(14) << "tree (ms)" << setw(14) << "bytecode" << setw(14) << "native"
+        << setw(12) << "vs tree" << setw(12) << "vs vm" << endl;
+    cout << fixed << setprecision(1);
+
+    for (const auto& program : loopPrograms) {
+        CompilationContext context;
+        vector<Token> tokens = scanner(context, program.second);
+        Parser parser(tokens, context, program.second);
+        if (!parser.parse()) {
+            parser.printErrors();
+            continue;
+        }
+        Bytecode bytecode;
+        Compiler compiler;
+        compiler.compile(context, parser.getAst(), parser.getParseTree(), bytecode);
+        JitProgram native;
+        native.compile(bytecode);
+
+        OutputBuffer treeOut(nullptr), vmOut(nullptr), jitOut(nullptr);
+        TreeWalker walker(parser.getAst(), context, treeOut);
+        Vm vm;
+
+        auto t0 = chrono::steady_clock::now();
+        walker.run(parser.getParseTree());
+        double tree = secondsSince(t0);
+        t0 = chrono::steady_clock::now();
+        vm.run(bytecode, vmOut);
+        double interpreted = secondsSince(t0);
+        t0 = chrono::steady_clock::now();
+        native.run(jitOut);
+        double jitted = secondsSince(t0);
+
+        bool same = treeOut.text() == vmOut.text() && vmOut.text() == jitOut.text();
+        for (uint32_t r = 1; r < walker.vars.size(); r++) {
+            same = same && walker.vars[r] == vm.reg(r) && vm.reg(r) == native.reg(r);
+        }
+        cout << setw(14) << program.first << setw(14) << tree * 1e3 << setw(14) << interpreted * 1e3
+            << setw(14) << jitted * 1e3 << setw(11) << tree / jitted << "x" << setw(11) << interpreted / jitted << "x"
+            << (same ? "" : "  RESULTS DIFFER") << endl;
+    }
+    cout << defaultfloat;
+}
+
+// Programs with copies, dead stores, repeated and loop invariant sums
+static const pair<const char*, const char*> irPrograms[] = {
+    { "invariants", "do a = 7; b = 3; do t = a + b; s = s + t; u = a - b; s = s + u; "
+        "i = i + 1 while i < 3000000 while 0 > 1#" },
+    { "copies", "do do x = i; y = x; z = y + 1; w = z; q = w - 5; d = q + y; s = s + q; "
+        "i = i + 1 while i < 3000000; print s while 0 > 1#" },
+    { "repeated", "do do p = i + k; q = i + k; r = i + k - p; s = s + p - q + r; k = k + 2; "
+        "i = i + 1 while i < 3000000; print s while 0 > 1#" },
+};
+
+void benchmark_ir() {
+    cout << "\n=== SSA OPTIMIZER BENCHMARK ===" << endl;
+    cout << setw(14) << "program" << setw(10) << "instrs" << setw(10) << "ir" << setw(12) << "vm (ms)"
+        << setw(12) << "vm ir" << setw(12) << "jit (ms)" << setw(12) << "jit ir" << setw(10) << "vm" << setw(10) << "jit" << endl;
+    cout << fixed << setprecision(1);
+
+    vector<pair<const char*, const char*>> programs(begin(loopPrograms), end(loopPrograms));
+    programs.insert(programs.end(), begin(irPrograms), end(irPrograms));
+    for (const auto& program : programs) {
+        CompilationContext context;
+        vector<Token> tokens = scanner(context, program.second);
+        Parser parser(tokens, context, program.second);
+        if (!parser.parse()) {
+            parser.printErrors();
+            continue;
+        }
+        AstArena optimized;
+        Optimizer optimizer;
+        NodeId root = optimizer.optimize(context, parser.getAst(), parser.getParseTree(), optimized);
+
+        Bytecode direct, lowered;
+        Compiler compiler;
+        compiler.compile(context, optimized, root, direct);
+        IrProgram ir;
+        IrBuilder builder;
+        builder.build(context, optimized, root, ir);
+        IrOptimizer passes;
+        passes.optimize(ir);
+        lower_ir(ir, lowered);
+
+        JitProgram nativeDirect, nativeLowered;
+        nativeDirect.compile(direct);
+        nativeLowered.compile(lowered);
+        OutputBuffer out[4] = { OutputBuffer(nullptr), OutputBuffer(nullptr), OutputBuffer(nullptr), OutputBuffer(nullptr) };
+        Vm vm;
+        double seconds[4];
+
+        auto t0 = chrono::steady_clock::now();
+        vm.run(direct, out[0]);
+        seconds[0] = secondsSince(t0);
+        t0 = chrono::steady_clock::now();
+        vm.run(lowered, out[1]);
+        seconds[1] = secondsSince(t0);
+        t0 = chrono::steady_clock::now();
+        nativeDirect.run(out[2]);
+        seconds[2] = secondsSince(t0);
+        t0 = chrono::steady_clock::now();
+        nativeLowered.run(out[3]);
+        seconds[3] = secondsSince(t0);
+
+        bool same = out[0].text() == out[1].text() && out[0].text() == out[2].text() && out[0].text() == out[3].text();
+        cout << setw(14) << program.first << setw(10) << direct.code.size() << setw(10) << lowered.code.size()
+            << setw(12) << seconds[0] * 1e3 << setw(12) << seconds[1] * 1e3 << setw(12) << seconds[2] * 1e3
+            << setw(12) << seconds[3] * 1e3 << setw(9) << seconds[0] / seconds[1] << "x" << setw(9)
+            << seconds[2] / seconds[3] << "x" << (same ? "" : "  RESULTS DIFFER") << endl;
+    }
+    cout << defaultfloat;
+}
+
+void benchmark_aot() {
+    string stem = "ypmt1_bench_" + to_string(chrono::steady_clock::now().time_since_epoch().count());
+    filesystem::path directory = filesystem::temp_directory_path();
+    string sourcePath = (directory / (stem + ".c")).string();
+    string binaryPath = (directory / stem).string();
+    string outputPath = (directory / (stem + ".out")).string();
+#ifdef _WIN32
+    binaryPath += ".exe";
+#endif
+
+    cout << "\n=== AHEAD-OF-TIME C BENCHMARK ===" << endl;
+    cout << setw(14) << "program" << setw(14) << "bytecode" << setw(14) << "native" << setw(14) << "C (ms)"
+        << setw(14) << "cc (ms)" << setw(12) << "vs vm" << setw(12) << "vs jit" << endl;
+    cout << fixed << setprecision(1);
+
+    for (const auto& program : loopPrograms) {
+        CompilationContext context;
+        vector<Token> tokens = scanner(context, program.second);
+        Parser parser(tokens, context, program.second);
+        if (!parser.parse()) {
+            parser.printErrors();
+            continue;
+        }
+        Bytecode bytecode;
+        Compiler compiler;
+        compiler.compile(context, parser.getAst(), parser.getParseTree(), bytecode);
+        JitProgram native;
+        native.compile(bytecode);
+
+        string source;
+        CEmitter emitter;
+        emitter.emit(context, parser.getAst(), parser.getParseTree(), source);
+        ofstream(sourcePath, ios::binary) << source;
+
+        auto t0 = chrono::steady_clock::now();
+        string message;
+        bool compiled = compile_c(sourcePath, binaryPath, message);
+        double build = secondsSince(t0);
+        if (!compiled) {
+            cout << setw(14) << program.first << "  " << message << endl;
+            continue;
+        }
+
+        OutputBuffer vmOut(nullptr), jitOut(nullptr);
+        Vm vm;
+        t0 = chrono::steady_clock::now();
+        vm.run(bytecode, vmOut);
+        double interpreted = secondsSince(t0);
+        t0 = chrono::steady_clock::now();
+        native.run(jitOut);
+        double jitted = secondsSince(t0);
+
+        // The program writes to a file, which is then compared with the VM output
+        t0 = chrono::steady_clock::now();
+        int status = system(("\"" + binaryPath + "\" > \"" + outputPath + "\"").c_str());
+        double ahead = secondsSince(t0);
+        ifstream output(outputPath, ios::binary);
+        string text((istreambuf_iterator<char>(output)), istreambuf_iterator<char>());
+
+        bool same = status == 0 && text == vmOut.text() && vmOut.text() == jitOut.text();
+        cout << setw(14) << program.first << setw(14) << interpreted * 1e3 << setw(14) << jitted * 1e3
+            << setw(14) << ahead * 1e3 << setw(14) << build * 1e3 << setw(11) << interpreted / ahead << "x"
+            << setw(11) << jitted / ahead << "x" << (same ? "" : "  RESULTS DIFFER") << endl;
+    }
+    cout << defaultfloat;
+    cout << "C run times include starting the process" << endl;
+
+    error_code ignored;
+    filesystem::remove(sourcePath, ignored);
+    filesystem::remove(binaryPath, ignored);
+    filesystem::remove(outputPath, ignored);
+}
+
+// Best of several runs of one phase, with the allocations of the last run
+struct SuitePhase {
+    const char* name;
+    const char* unit;       // what items counts
+    size_t items = 0;
+    double seconds = 1e9;
+    uint64_t allocations = 0;
+    uint64_t allocatedBytes = 0;
+};
+
+template <class Run>
+static void measurePhase(SuitePhase& phase, Run run) {
+    for (int rep = 0; rep < 5; rep++) {
+        AllocationCounts before = allocation_counts();
+        auto t0 = chrono::steady_clock::now();
+        run();
+        double seconds = secondsSince(t0);
+        AllocationCounts after = allocation_counts();
+        phase.allocations = after.count - before.count;
+        phase.allocatedBytes = after.bytes - before.bytes;
+        if (seconds < phase.seconds) phase.seconds = seconds;
+    }
+}
+
+void benchmark_suite(const GenOptions& options, bool json) {
+    ProgramGenerator generator(options);
+    string program = generator.generate();
+
+    // scanner() with a new context every run, so the tables are filled too
+    SuitePhase scan = { "scanner", "tokens" };
+    vector<Token> tokens;
+    measurePhase(scan, [&]() {
+        CompilationContext fresh;
+        tokens = scanner(fresh, program);
+    });
+    scan.items = tokens.size();
+
+    // The same identifiers and constants interned without scanning
+    CompilationContext context;
+    tokens = scanner(context, program);
+    vector<string_view> names;
+    vector<int> values;
+    for (const Token& token : tokens) {
+        if (token.type == TOKEN_ID) {
+            names.push_back(token.lexeme(program));
+        }
+        else if (token.type == TOKEN_DIG) {
+            values.push_back(context.val_dig(token.code));
+        }
+    }
+    SuitePhase tables = { "make_id/make_dig", "lookups" };
+    long long check = 0;
+    measurePhase(tables, [&]() {
+        CompilationContext fresh;
+        for (string_view name : names) {
+            check += fresh.make_id(name);
+        }
+        for (int value : values) {
+            check += fresh.make_dig(value);
+        }
+    });
+    tables.items = names.size() + values.size();
+
+    SuitePhase parse = { "Parser::parse", "nodes" };
+    bool accepted = false;
+    size_t errors = 0;
+    measurePhase(parse, [&]() {
+        Parser parser(tokens, context, program);
+        accepted = parser.parse();
+        errors = parser.getDiagnostics().size();
+        parse.items = parser.getAst().size();
+    });
+
+    // The same with the structure-of-arrays token buffer
+    SuitePhase scanPacked = { "scanner packed", "tokens" };
+    TokenBuffer buffer;
+    measurePhase(scanPacked, [&]() {
+        CompilationContext fresh;
+        scanner(fresh, program, buffer);
+    });
+    scanPacked.items = buffer.size();
+
+    scanner(context, program, buffer);
+    SuitePhase parsePacked = { "parse packed", "nodes" };
+    bool same = true;
+    measurePhase(parsePacked, [&]() {
+        Parser parser(buffer, context, program);
+        same = parser.parse() == accepted && parser.getDiagnostics().size() == errors;
+        parsePacked.items = parser.getAst().size();
+    });
+    same = same && parsePacked.items == parse.items && buffer.size() == tokens.size();
+    size_t vectorBytes = tokens.capacity() * sizeof(Token);
+    size_t packedBytes = buffer.memoryUsed();
+
+    const SuitePhase* phases[] = { &scan, &tables, &parse, &scanPacked, &parsePacked };
+    double megabytes = static_cast<double>(program.size()) / 1e6;
+
+    if (json) {
+        cout << "{\"benchmark\":\"suite\",\"options\":{\"seed\":" << options.seed << ",\"size\":" << options.size
+            << ",\"depth\":" << options.maxDepth << ",\"identifiers\":" << options.identifiers
+            << ",\"constants\":" << options.constants << ",\"error_rate\":" << options.errorRate << "}"
+            << ",\"program\":{\"bytes\":" << program.size() << ",\"tokens\":" << tokens.size()
+            << ",\"statements\":" << generator.statements() << ",\"errors_injected\":" << generator.errorsInjected()
+            << ",\"errors_reported\":" << errors << ",\"accepted\":" << (accepted ? "true" : "false")
+            << ",\"identifiers\":" << context.identifiers.size() << ",\"constants\":" << context.constants.size()
+            << ",\"token_bytes\":" << vectorBytes << ",\"packed_token_bytes\":" << packedBytes
+            << ",\"packed_same\":" << (same ? "true" : "false") << "},\"phases\":[";
+        for (const SuitePhase* phase : phases) {
+            cout << (phase == phases[0] ? "" : ",") << "{\"name\":\"" << phase->name << "\",\"seconds\":"
+                << phase->seconds << ",\"mb_per_s\":" << megabytes / phase->seconds << ",\"" << phase->unit
+                << "\":" << phase->items << ",\"" << phase->unit << "_per_s\":" << phase->items / phase->seconds
+                << ",\"allocations\":";
+            if (ALLOCATIONS_COUNTED) {
+                cout << phase->allocations << ",\"allocated_bytes\":" << phase->allocatedBytes << "}";
+            }
+            else {
+                cout << "null,\"allocated_bytes\":null}";
+            }
+        }
+        cout << "]}" << endl;
+        return;
+    }
+
+    cout << "\n=== BENCHMARK SUITE ===" << endl;
+    cout << "program: seed " << options.seed << ", " << program.size() / 1024 << " KB, " << tokens.size()
+        << " tokens, " << generator.statements() << " statements, depth " << options.maxDepth << ", "
+        << context.identifiers.size() << " identifiers, " << context.constants.size() << " constants" << endl;
+    cout << "errors injected: " << generator.errorsInjected() << ", reported: " << errors
+        << ", accepted: " << (accepted ? "yes" : "no") << endl;
+    cout << "token memory: " << vectorBytes / 1024 << " KB as vector<Token>, " << packedBytes / 1024
+        << " KB packed" << (same ? "" : "  PACKED RESULTS DIFFER") << endl;
+    cout << left << setw(20) << "phase" << right << setw(10) << "ms" << setw(10) << "MB/s" << setw(16) << "items/s"
+        << setw(14) << "allocations" << setw(14) << "bytes" << endl;
+    cout << fixed << setprecision(1);
+    for (const SuitePhase* phase : phases) {
+        cout << left << setw(20) << phase->name << right << setw(10) << phase->seconds * 1e3
+            << setw(10) << megabytes / phase->seconds << setw(10) << phase->items / phase->seconds / 1e6 << " M "
+            << left << setw(8) << phase->unit << right;
+        if (ALLOCATIONS_COUNTED) {
+            cout << setw(12) << phase->allocations << setw(14) << phase->allocatedBytes << endl;
+        }
+        else {
+            cout << setw(12) << "-" << setw(14) << "-" << endl;
+        }
+    }
+    if (!ALLOCATIONS_COUNTED) {
+        cout << "allocations are counted in builds with YPMT_ALLOC_STATS defined (Bench configuration)" << endl;
+    }
+    cout << defaultfloat << "(checksum " << check << ")" << endl;
+}
+
+// Latency of one request to a warm server against a server made for
+// the request, as a process started per check would be at best
+void benchmark_server() {
+    const size_t requests = 20000;
+    vector<string> programs;
+    GenOptions options;
+    options.size = 200;
+    options.maxDepth = 2;
+    options.identifiers = 16;
+    options.constants = 16;
+    options.errorRate = 0.05;
+    for (size_t i = 0; i < requests; i++) {
+        options.seed = i + 1;
+        programs.push_back(ProgramGenerator(options).generate());
+    }
+
+    cout << "\n=== CHECK SERVER BENCHMARK ===" << endl;
+    cout << requests << " generated programs of about " << options.size
+        << " bytes, execution stops after 1000 loop iterations" << endl;
+    cout << fixed << setprecision(2);
+    cout << setw(22) << "request" << setw(14) << "p50 (us)" << setw(14) << "p99 (us)" << setw(14) << "max (us)"
+        << setw(16) << "allocs/request" << endl;
+
+    const pair<const char*, uint8_t> kinds[] = {
+        { "check", 0 },
+        { "tokens", REQUEST_TOKENS },
+        { "tree", REQUEST_TREE },
+        { "execute", REQUEST_EXECUTE },
+        { "check, cold server", 0 },
+    };
+    size_t check = 0;
+    string response;
+    vector<double> times(requests);
+    CheckServer warm;
+    warm.maxIterations = 1000;
+    for (const auto& kind : kinds) {
+        bool cold = &kind == &kinds[4];
+        for (const string& program : programs) {
+            warm.handle(kind.second, program, response);    // warms the buffers to the largest request
+        }
+        AllocationCounts before = allocation_counts();
+        for (size_t i = 0; i < requests; i++) {
+            auto t0 = chrono::steady_clock::now();
+            if (cold) {
+                CheckServer server;
+                server.handle(kind.second, programs[i], response);
+            }
+            else {
+                warm.handle(kind.second, programs[i], response);
+            }
+            times[i] = secondsSince(t0) * 1e6;
+            check += response.size();
+        }
+        AllocationCounts after = allocation_counts();
+        sort(times.begin(), times.end());
+        cout << setw(22) << kind.first << setw(14) << times[requests / 2] << setw(14) << times[requests * 99 / 100]
+            << setw(14) << times.back();
+        if (ALLOCATIONS_COUNTED) {
+            cout << setw(16) << static_cast<double>(after.count - before.count) / requests << endl;
+        }
+        else {
+            cout << setw(16) << "-" << endl;
+        }
+    }
+    if (!ALLOCATIONS_COUNTED) {
+        cout << "allocations are counted in builds with YPMT_ALLOC_STATS defined (Bench configuration)" << endl;
+    }
+    cout << defaultfloat << "(checksum " << check << ")" << endl;
+}
+
+// The tree printed the way it was before the output buffer: an ostream
+// and endl on every line, the baseline for the emitters
+static void printTreeWithEndl(ostream& out, const AstArena& ast, NodeId root) {
+    static const char* const names[] = {
+        "PROGRAM", "DO-WHILE", "ASSIGN", "PRINT", "BIN_OP", "COMPARE", "ID", "CONST", "EXPR", "TERM", "FACTOR"
+    };
+    vector<pair<NodeId, int>> pending(1, { root, 0 });
+    while (!pending.empty()) {
+        auto [id, depth] = pending.back();
+        pending.pop_back();
+        const AstNode& node = ast[id];
+        out << string(2 * static_cast<size_t>(depth), ' ') << "[" << names[node.type];
+        if (node.type == NODE_IDENTIFIER || node.type == NODE_CONSTANT) {
+            out << ": " << node.value;
+        }
+        out << "]" << endl;
+        const NodeId* kids = ast.childrenOf(id);
+        for (uint32_t i = node.childCount; i > 0; i--) {
+            pending.push_back({ kids[i - 1], depth + 1 });
+        }
+    }
+}
+
+void benchmark_output() {
+    GenOptions options;
+    options.size = 4 << 20;
+    string program = ProgramGenerator(options).generate();
+    CompilationContext context;
+    TokenBuffer tokens;
+    scanner(context, program, tokens);
+    Parser parser(tokens, context, program);
+    if (!parser.parse()) {
+        parser.printErrors();
+        return;
+    }
+    const AstArena& ast = parser.getAst();
+    size_t nodes = ast.size();
+    filesystem::path path = filesystem::temp_directory_path() / "ypmt_output_bench.out";
+
+    cout << "\n=== OUTPUT BENCHMARK ===" << endl;
+    cout << "program: " << program.size() / 1024 << " KB, " << tokens.size() << " tokens, " << nodes
+        << " nodes, written to " << path.string() << endl;
+    cout << fixed << setprecision(1);
+    cout << setw(24) << "tree" << setw(12) << "MB" << setw(12) << "ms" << setw(14) << "ns/node" << endl;
+
+    auto report = [&](const char* name, uintmax_t bytes, double seconds) {
+        cout << setw(24) << name << setw(12) << static_cast<double>(bytes) / (1 << 20) << setw(12) << seconds * 1e3
+            << setw(14) << seconds * 1e9 / static_cast<double>(nodes) << endl;
+    };
+
+    {
+        ofstream file(path, ios::binary);
+        auto t0 = chrono::steady_clock::now();
+        printTreeWithEndl(file, ast, parser.getParseTree());
+        file.close();
+        double seconds = secondsSince(t0);
+        report("ostream, endl", filesystem::file_size(path), seconds);
+    }
+
+    const pair<const char*, OutputFormat> formats[] = {
+        { "text", FORMAT_TEXT }, { "json", FORMAT_JSON }, { "binary", FORMAT_BINARY }
+    };
+    for (const auto& format : formats) {
+        FILE* file = fopen(path.string().c_str(), "wb");
+        if (!file) {
+            cout << "cannot open " << path.string() << endl;
+            break;
+        }
+        auto t0 = chrono::steady_clock::now();
+        {
+            OutputBuffer out(file);
+            Emitter(out, format.second).tree(ast, parser.getParseTree());
+        }
+        fclose(file);
+        double seconds = secondsSince(t0);
+        report(format.first, filesystem::file_size(path), seconds);
+    }
+
+    // Formatting alone, into a buffer that is kept between runs
+    OutputBuffer memory(nullptr);
+    Emitter emitter(memory);
+    emitter.tree(ast, parser.getParseTree());
+    memory.clear();
+    auto t0 = chrono::steady_clock::now();
+    emitter.tree(ast, parser.getParseTree());
+    report("text, in memory", memory.size(), secondsSince(t0));
+    cout << defaultfloat;
+    filesystem::remove(path);
+}
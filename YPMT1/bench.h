@@ -0,0 +1,39 @@
+// bench.h
+#ifndef BENCH_H
+#define BENCH_H
+
+struct GenOptions;
+
+// Scalar vs SIMD run scanning, bytes per cycle
+void benchmark_scan_runs();
+
+// Interning tables: distinct and repeated identifiers, constants
+void benchmark_tables();
+
+// Edits of a large program: incremental re-parse vs scanning and parsing again
+void benchmark_incremental();
+
+// Constant folding pass: nodes per second, nodes eliminated, bytecode size and run time
+void benchmark_optimizer();
+
+// Loop programs: tree walking vs bytecode interpreter vs native code
+void benchmark_jit();
+
+// Loop programs: bytecode interpreter vs native code vs C compiled by the system compiler
+void benchmark_aot();
+
+// Loop programs compiled directly vs through the optimized SSA form,
+// on the bytecode interpreter and as native code
+void benchmark_ir();
+
+// Generated programs: scanner(), make_id/make_dig and Parser::parse()
+// measured separately; json prints one JSON object instead of the table
+void benchmark_suite(const GenOptions& options, bool json);
+
+// Request latency of the check server, warm and made for each request
+void benchmark_server();
+
+// A large tree written with ostream and endl vs the text, JSON and binary emitters
+void benchmark_output();
+
+#endif
@@ -0,0 +1,215 @@
+// cache.cpp
+#include "cache.h"
+#include "parser.h"
+#include "tables.h"
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+using namespace std;
+
+static const char cacheMagic[8] = { 'Y', 'P', 'M', 'T', 'A', 'S', 'T', 0 };
+static const uint32_t BYTE_ORDER_MARK = 0x01020304u;
+
+static inline uint64_t mix64(uint64_t h) {
+    h ^= h >> 32;
+    h *= 0xD6E8FEB86659FD93ull;
+    h ^= h >> 32;
+    return h;
+}
+
+// Four independent lanes of 8 bytes each per step
+uint64_t hash_source(string_view source) {
+    const char* p = source.data();
+    size_t length = source.size();
+    uint64_t lanes[4] = {
+        0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0x27D4EB2F165667C5ull
+    };
+
+    while (length >= 32) {
+        for (int i = 0; i < 4; i++) {
+            uint64_t word;
+            memcpy(&word, p + 8 * i, 8);
+            lanes[i] = mix64(lanes[i] ^ word);
+        }
+        p += 32;
+        length -= 32;
+    }
+    uint64_t h = source.size();
+    for (int i = 0; i < 4; i++) {
+        h = mix64(h ^ lanes[i]);
+    }
+    while (length > 0) {
+        uint64_t word = 0;
+        size_t n = length < 8 ? length : 8;
+        memcpy(&word, p, n);
+        h = mix64(h ^ word);
+        p += n;
+        length -= n;
+    }
+    return mix64(h);
+}
+
+// Hash of the whole entry except the checksum field
+static uint64_t entryChecksum(string_view entry) {
+    size_t field = offsetof(CacheHeader, checksum);
+    return mix64(hash_source(entry.substr(0, field)) ^ hash_source(entry.substr(field + sizeof(uint64_t))));
+}
+
+// Checks that the sections fit in the file and agree with the counts,
+// and the checksum, so a damaged entry is never used
+bool CachedProgram::valid() const {
+    size_t fileSize = file.text().size();
+    for (int s = 0; s < SECTION_COUNT; s++) {
+        if (header->offsets[s] % 8 != 0 || header->offsets[s] < sizeof(CacheHeader) ||
+            header->offsets[s] > fileSize || header->sizes[s] > fileSize - header->offsets[s]) {
+            return false;
+        }
+    }
+    if (header->sizes[SECTION_TOKENS] != (header->tokenCount + TokenBuffer::SENTINELS) * sizeof(PackedToken) ||
+        header->sizes[SECTION_TOKEN_STARTS] != (header->tokenCount + TokenBuffer::SENTINELS) * sizeof(uint32_t) ||
+        header->sizes[SECTION_NODES] % sizeof(AstNode) != 0 ||
+        header->sizes[SECTION_CHILDREN] % sizeof(NodeId) != 0 ||
+        header->sizes[SECTION_NAME_ENDS] % sizeof(uint32_t) != 0 ||
+        header->sizes[SECTION_CONSTANTS] % sizeof(int32_t) != 0) {
+        return false;
+    }
+    return header->checksum == entryChecksum(file.text());
+}
+
+bool CachedProgram::open(const string& path, uint64_t hash, size_t sourceSize) {
+    header = nullptr;
+    if (!file.open(path) || file.text().size() < sizeof(CacheHeader)) {
+        return false;
+    }
+
+    // Mappings start on a page boundary, so the sections are aligned
+    const CacheHeader* h = reinterpret_cast<const CacheHeader*>(file.text().data());
+    if (memcmp(h->magic, cacheMagic, sizeof(cacheMagic)) != 0 || h->version != CACHE_VERSION ||
+        h->byteOrder != BYTE_ORDER_MARK || h->headerSize != sizeof(CacheHeader) ||
+        h->nodeSize != sizeof(AstNode) || h->sourceHash != hash || h->sourceSize != sourceSize) {
+        file.close();
+        return false;
+    }
+
+    header = h;
+    if (!valid()) {
+        header = nullptr;
+        file.close();
+        return false;
+    }
+    return true;
+}
+
+string_view CachedProgram::messages() const {
+    return string_view(section<char>(SECTION_MESSAGES), static_cast<size_t>(header->sizes[SECTION_MESSAGES]));
+}
+
+void CachedProgram::restore(CompilationContext& context, AstArena& ast) const {
+    // Interning in code order gives every name and constant its old code
+    context.reset();
+    const uint32_t* ends = section<uint32_t>(SECTION_NAME_ENDS);
+    const char* names = section<char>(SECTION_NAMES);
+    uint32_t start = 0;
+    for (size_t i = 0; i < count(SECTION_NAME_ENDS, sizeof(uint32_t)); i++) {
+        context.make_id(string_view(names + start, ends[i] - start));
+        start = ends[i];
+    }
+    const int32_t* values = section<int32_t>(SECTION_CONSTANTS);
+    for (size_t i = 0; i < count(SECTION_CONSTANTS, sizeof(int32_t)); i++) {
+        context.make_dig(values[i]);
+    }
+
+    ast.assign(nodes(), nodeCount(), children(), childCount());
+}
+
+string ProgramCache::entryPath(uint64_t hash, size_t sourceSize) const {
+    ostringstream name;
+    name << hex << setw(16) << setfill('0') << hash << "-" << dec << sourceSize << ".ypc";
+    return (filesystem::path(directory) / name.str()).string();
+}
+
+bool ProgramCache::lookup(string_view source, CachedProgram& entry) const {
+    uint64_t hash = hash_source(source);
+    return entry.open(entryPath(hash, source.size()), hash, source.size());
+}
+
+static void appendSection(string& blob, CacheHeader& header, CacheSection s, const void* data, size_t size) {
+    blob.resize((blob.size() + 7) & ~size_t(7), '\0');
+    header.offsets[s] = blob.size();
+    header.sizes[s] = size;
+    blob.append(static_cast<const char*>(data), size);
+}
+
+bool ProgramCache::store(string_view source, const TokenBuffer& tokens, const Parser& parser, string& message) const {
+    const CompilationContext& context = parser.getContext();
+    const AstArena& ast = parser.getAst();
+
+    CacheHeader header = {};
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = CACHE_VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.headerSize = sizeof(CacheHeader);
+    header.nodeSize = sizeof(AstNode);
+    header.sourceHash = hash_source(source);
+    header.sourceSize = source.size();
+    header.tokenCount = static_cast<uint32_t>(tokens.size());
+    header.root = parser.getParseTree();
+    header.accepted = parser.hasErrors() ? 0 : 1;
+    header.errorCount = static_cast<uint32_t>(parser.getDiagnostics().size());
+
+    vector<uint32_t> nameEnds;
+    string names;
+    for (size_t code = 1; code <= context.identifiers.size(); code++) {
+        names += context.identifiers.name(static_cast<int>(code));
+        nameEnds.push_back(static_cast<uint32_t>(names.size()));
+    }
+    vector<int32_t> values;
+    for (size_t code = 1; code <= context.constants.size(); code++) {
+        values.push_back(context.val_dig(static_cast<int>(code)));
+    }
+    string messages;
+    for (const Diagnostic& diagnostic : parser.getDiagnostics()) {
+        messages += parser.formatDiagnostic(diagnostic);
+        messages += '\n';
+    }
+
+    size_t tokenSlots = tokens.size() + TokenBuffer::SENTINELS;
+    string blob(sizeof(CacheHeader), '\0');
+    appendSection(blob, header, SECTION_TOKENS, tokens.tokens(), tokenSlots * sizeof(PackedToken));
+    appendSection(blob, header, SECTION_TOKEN_STARTS, tokens.starts(), tokenSlots * sizeof(uint32_t));
+    appendSection(blob, header, SECTION_NODES, ast.nodeData(), ast.size() * sizeof(AstNode));
+    appendSection(blob, header, SECTION_CHILDREN, ast.childData(), ast.childSlots() * sizeof(NodeId));
+    appendSection(blob, header, SECTION_NAME_ENDS, nameEnds.data(), nameEnds.size() * sizeof(uint32_t));
+    appendSection(blob, header, SECTION_NAMES, names.data(), names.size());
+    appendSection(blob, header, SECTION_CONSTANTS, values.data(), values.size() * sizeof(int32_t));
+    appendSection(blob, header, SECTION_MESSAGES, messages.data(), messages.size());
+    memcpy(&blob[0], &header, sizeof(CacheHeader));
+    header.checksum = entryChecksum(blob);
+    memcpy(&blob[0], &header, sizeof(CacheHeader));
+
+    error_code error;
+    filesystem::create_directories(directory, error);
+    string path = entryPath(header.sourceHash, source.size());
+    string temporary = path + ".tmp" + to_string(chrono::steady_clock::now().time_since_epoch().count());
+    {
+        ofstream out(temporary, ios::binary);
+        out.write(blob.data(), static_cast<streamsize>(blob.size()));
+        if (!out) {
+            message = "cannot write '" + temporary + "'";
+            filesystem::remove(temporary, error);
+            return false;
+        }
+    }
+    filesystem::rename(temporary, path, error);
+    if (error) {
+        message = "cannot rename '" + temporary + "': " + error.message();
+        filesystem::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
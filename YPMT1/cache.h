@@ -0,0 +1,105 @@
+// cache.h
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "ast.h"
+#include "scanner.h"
+#include "source.h"
+
+class CompilationContext;
+class Parser;
+
+// Raised whenever the layout below, the token encoding or the tree
+// changes; entries of other versions are ignored and written again
+const uint32_t CACHE_VERSION = 2;
+
+// 64-bit hash of the source bytes, the cache key together with the size
+uint64_t hash_source(std::string_view source);
+
+enum CacheSection {
+    SECTION_TOKENS,         // PackedToken, with the END sentinels
+    SECTION_TOKEN_STARTS,   // uint32_t offset of each token
+    SECTION_NODES,          // AstNode
+    SECTION_CHILDREN,       // NodeId
+    SECTION_NAME_ENDS,      // uint32_t end of the spelling of each identifier code
+    SECTION_NAMES,          // spellings, back to back
+    SECTION_CONSTANTS,      // int32_t value of each constant code
+    SECTION_MESSAGES,       // diagnostics, one per line
+    SECTION_COUNT
+};
+
+// An entry is this header followed by the sections, at 8-byte aligned
+// offsets from the start of the file. There are no pointers in it, so a
+// mapped entry is used in place.
+struct CacheHeader {
+    char magic[8];              // "YPMTAST" and a zero
+    uint32_t version;
+    uint32_t byteOrder;         // 0x01020304 as written
+    uint32_t headerSize;
+    uint32_t nodeSize;
+    uint64_t sourceHash;
+    uint64_t sourceSize;
+    uint32_t tokenCount;        // up to and including the END token
+    uint32_t root;
+    uint32_t accepted;
+    uint32_t errorCount;
+    uint64_t checksum;          // of the whole entry but this field
+    uint64_t offsets[SECTION_COUNT];
+    uint64_t sizes[SECTION_COUNT];      // in bytes
+};
+
+// One cache entry, mapped read-only
+class CachedProgram {
+private:
+    MappedFile file;
+    const CacheHeader* header = nullptr;
+
+    template <class T>
+    const T* section(CacheSection s) const {
+        return reinterpret_cast<const T*>(file.text().data() + header->offsets[s]);
+    }
+    size_t count(CacheSection s, size_t itemSize) const { return static_cast<size_t>(header->sizes[s] / itemSize); }
+    bool valid() const;
+
+public:
+    // False if the entry is missing, of another version or source, or damaged
+    bool open(const std::string& path, uint64_t hash, size_t sourceSize);
+
+    bool accepted() const { return header->accepted != 0; }
+    NodeId root() const { return header->root; }
+    size_t errorCount() const { return header->errorCount; }
+
+    size_t tokenCount() const { return header->tokenCount; }
+    const PackedToken* tokens() const { return section<PackedToken>(SECTION_TOKENS); }
+    const uint32_t* tokenStarts() const { return section<uint32_t>(SECTION_TOKEN_STARTS); }
+    size_t nodeCount() const { return count(SECTION_NODES, sizeof(AstNode)); }
+    const AstNode* nodes() const { return section<AstNode>(SECTION_NODES); }
+    size_t childCount() const { return count(SECTION_CHILDREN, sizeof(NodeId)); }
+    const NodeId* children() const { return section<NodeId>(SECTION_CHILDREN); }
+    // The diagnostics as Parser::printErrors prints them, one per line
+    std::string_view messages() const;
+
+    // Fills the tables and the tree as the parser left them
+    void restore(CompilationContext& context, AstArena& ast) const;
+};
+
+// Directory of entries named after the hash and the size of the source
+class ProgramCache {
+private:
+    std::string directory;
+
+public:
+    explicit ProgramCache(const std::string& path) : directory(path) {}
+
+    std::string entryPath(uint64_t hash, size_t sourceSize) const;
+    bool lookup(std::string_view source, CachedProgram& entry) const;
+    // Writes the result of parser, which parsed the tokens of source. The
+    // entry is renamed into place, readers never see a partial one.
+    bool store(std::string_view source, const TokenBuffer& tokens, const Parser& parser, std::string& message) const;
+};
+
+#endif
@@ -0,0 +1,216 @@
+// cemit.cpp
+#include "cemit.h"
+#include "scanner.h"
+#include "parser.h"
+#include "optimizer.h"
+#include "source.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+void CEmitter::emit(const CompilationContext& ctx, const AstArena& tree, NodeId root, string& source) {
+    context = &ctx;
+    ast = &tree;
+    out = &source;
+
+    source.clear();
+    source += "/* Generated by YPMT1 */\n";
+    source += "#include <inttypes.h>\n#include <stdint.h>\n#include <stdio.h>\n\n";
+    source += "static char output[1 << 16];\n\n";
+    source += "int main(void) {\n";
+    source += "    setvbuf(stdout, output, _IOFBF, sizeof output);\n";
+    for (size_t code = 1; code <= ctx.identifiers.size(); code++) {
+        source += "    int64_t v" + to_string(code) + " = 0;    /* ";
+        source += ctx.identifiers.name(static_cast<int>(code));
+        source += " */\n";
+    }
+
+    loops.clear();
+    if (root != NO_NODE) {
+        emitStatement(root);
+    }
+    while (!loops.empty()) {
+        LoopFrame& frame = loops.back();
+        if (frame.next + 1 < (*ast)[frame.id].childCount) {
+            emitStatement(ast->child(frame.id, frame.next++));
+            continue;
+        }
+        NodeId done = frame.id;
+        loops.pop_back();
+        emitCondition(done);
+    }
+    source += "    return 0;\n}\n";
+}
+
+// Lines deeper than this keep its indentation, so deeply nested loops
+// do not make the text quadratic in their size
+static const size_t INDENT_LEVELS = 32;
+
+void CEmitter::indent(size_t depth) {
+    out->append(4 * min(depth, INDENT_LEVELS), ' ');
+}
+
+// Statements of a loop body are emitted by emit() after the do line
+void CEmitter::emitStatement(NodeId id) {
+    const AstNode& node = (*ast)[id];
+    size_t depth = loops.size() + 1;
+
+    switch (node.type) {
+    case NODE_DO_WHILE:
+        indent(depth);
+        *out += "do {\n";
+        loops.push_back({ id, 0 });
+        break;
+    case NODE_ASSIGNMENT:
+        indent(depth);
+        *out += "v" + to_string((*ast)[ast->child(id, 0)].value) + " = ";
+        emitValue(ast->child(id, 1));
+        *out += ";\n";
+        break;
+    case NODE_PRINT:
+        indent(depth);
+        *out += "printf(\"%\" PRId64 \"\\n\", v" + to_string((*ast)[ast->child(id, 0)].value) + ");\n";
+        break;
+    default:
+        break;
+    }
+}
+
+void CEmitter::emitCondition(NodeId id) {
+    NodeId cond = ast->child(id, (*ast)[id].childCount - 1);
+    indent(loops.size() + 1);
+    *out += "} while (";
+    emitValue(ast->child(cond, 0));
+    *out += (*ast)[cond].op == OP_LT ? " < " : " > ";
+    emitValue(ast->child(cond, 1));
+    *out += ");\n";
+}
+
+// The conversion back from uint64_t keeps the bits on all targets we build for
+void CEmitter::emitValue(NodeId id) {
+    const AstNode& node = (*ast)[id];
+    if (node.type == NODE_IDENTIFIER) {
+        *out += "v" + to_string(node.value);
+    }
+    else if (node.type == NODE_CONSTANT) {
+        *out += "INT64_C(" + to_string(context->val_dig(node.value)) + ")";
+    }
+    else {
+        *out += "(int64_t)(";
+        emitSum(id);
+        *out += ")";
+    }
+}
+
+void CEmitter::emitSum(NodeId id) {
+    // Left-deep chain: operands from the innermost one outwards, so a
+    // long sum does not nest
+    size_t mark = spine.size();
+    while ((*ast)[id].type == NODE_BINARY_OP) {
+        spine.push_back(id);
+        id = ast->child(id, 0);
+    }
+    emitOperand(id);
+
+    for (size_t i = spine.size(); i > mark; i--) {
+        NodeId op = spine[i - 1];
+        NodeId right = ast->child(op, 1);
+        *out += (*ast)[op].op == OP_ADD ? " + " : " - ";
+        if ((*ast)[right].type == NODE_BINARY_OP) {
+            *out += "(";
+            emitSum(right);
+            *out += ")";
+        }
+        else {
+            emitOperand(right);
+        }
+    }
+    spine.resize(mark);
+}
+
+void CEmitter::emitOperand(NodeId id) {
+    const AstNode& node = (*ast)[id];
+    if (node.type == NODE_IDENTIFIER) {
+        *out += "(uint64_t)v" + to_string(node.value);
+    }
+    else {
+        int value = context->val_dig(node.value);
+        *out += value >= 0 ? "UINT64_C(" + to_string(value) + ")" : "(uint64_t)INT64_C(" + to_string(value) + ")";
+    }
+}
+
+bool compile_c(const string& sourcePath, const string& binaryPath, string& message) {
+    const char* cc = getenv("CC");
+    string compiler = (cc && *cc) ? cc : "cc";
+    string command = compiler + " -O2 -o \"" + binaryPath + "\" \"" + sourcePath + "\"";
+
+    int status = system(command.c_str());
+    if (status != 0) {
+        message = "'" + command + "' failed with status " + to_string(status);
+        return false;
+    }
+    return true;
+}
+
+int aot_main(const string& path, bool run) {
+    MappedFile file;
+    if (!file.open(path)) {
+        cerr << "Error: " << file.error() << endl;
+        return 2;
+    }
+
+    CompilationContext context;
+    Lexer lexer(context, file.text());
+    Parser parser(lexer);
+    if (!parser.parse()) {
+        parser.printErrors();
+        return 1;
+    }
+
+    AstArena optimized;
+    Optimizer optimizer;
+    NodeId root = optimizer.optimize(context, parser.getAst(), parser.getParseTree(), optimized);
+
+    string source;
+    CEmitter emitter;
+    emitter.emit(context, optimized, root, source);
+    if (!run) {
+        cout << source;
+        return 0;
+    }
+
+    // Source and binary go to the temporary directory and are removed afterwards
+    string stem = "ypmt1_aot_" + to_string(chrono::steady_clock::now().time_since_epoch().count());
+    filesystem::path directory = filesystem::temp_directory_path();
+    string sourcePath = (directory / (stem + ".c")).string();
+    string binaryPath = (directory / stem).string();
+#ifdef _WIN32
+    binaryPath += ".exe";
+#endif
+    ofstream(sourcePath, ios::binary) << source;
+
+    auto start = chrono::steady_clock::now();
+    string message;
+    bool compiled = compile_c(sourcePath, binaryPath, message);
+    double compileSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    filesystem::remove(sourcePath);
+    if (!compiled) {
+        cerr << "Error: " << message << endl;
+        return 2;
+    }
+
+    cout.flush();
+    start = chrono::steady_clock::now();
+    int status = system(("\"" + binaryPath + "\"").c_str());
+    double runSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    filesystem::remove(binaryPath);
+
+    cerr << "Compiled " << source.size() << " bytes of C in " << compileSeconds * 1000
+        << " ms, ran in " << runSeconds * 1000 << " ms" << endl;
+    return status == 0 ? 0 : 1;
+}
@@ -0,0 +1,46 @@
+// cemit.h
+#ifndef CEMIT_H
+#define CEMIT_H
+
+#include <string>
+#include <vector>
+#include "ast.h"
+#include "tables.h"
+
+// Translates the parse tree into a standalone C program: one int64_t
+// local per identifier code, do { } while () loops, printf into a fully
+// buffered stdout. Sums are computed in uint64_t, so they wrap around
+// like the VM registers instead of overflowing.
+class CEmitter {
+private:
+    // A do-while whose body is being emitted, walked without recursion
+    struct LoopFrame {
+        NodeId id;
+        uint32_t next;          // next body statement
+    };
+
+    const CompilationContext* context;
+    const AstArena* ast;
+    std::string* out;
+    std::vector<NodeId> spine;
+    std::vector<LoopFrame> loops;
+
+    void indent(size_t depth);
+    void emitStatement(NodeId id);
+    void emitCondition(NodeId id);
+    void emitSum(NodeId id);        // as uint64_t
+    void emitOperand(NodeId id);
+    void emitValue(NodeId id);      // as int64_t
+
+public:
+    void emit(const CompilationContext& ctx, const AstArena& tree, NodeId root, std::string& source);
+};
+
+// Compiles a C file with $CC (default cc); false with the reason in message
+bool compile_c(const std::string& sourcePath, const std::string& binaryPath, std::string& message);
+
+// YPMT1 --emit-c path: prints the C program
+// YPMT1 --aot path: compiles it with the system compiler and runs it
+int aot_main(const std::string& path, bool run);
+
+#endif
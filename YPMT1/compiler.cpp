@@ -0,0 +1,200 @@
+// compiler.cpp
+#include "compiler.h"
+
+using namespace std;
+
+void Compiler::compile(const CompilationContext& ctx, const AstArena& tree, NodeId root, Bytecode& program) {
+    context = &ctx;
+    ast = &tree;
+    out = &program;
+    tempBase = static_cast<uint32_t>(ctx.identifiers.size() + 1);
+    tempTop = 0;
+
+    program.code.clear();
+    program.registerCount = tempBase;
+
+    loops.clear();
+    if (root != NO_NODE) {
+        compileStatement(root);
+    }
+    while (!loops.empty()) {
+        LoopFrame& frame = loops.back();
+        if (frame.next + 1 < (*ast)[frame.id].childCount) {
+            compileStatement(ast->child(frame.id, frame.next++));
+            continue;
+        }
+        LoopFrame done = frame;
+        loops.pop_back();
+        compileCondition(done);
+    }
+    emit(OPC_HALT, 0);
+}
+
+void Compiler::emit(OpCode op, uint32_t a, uint32_t b, uint32_t c) {
+    out->code.push_back({ op, a, b, c });
+}
+
+uint32_t Compiler::allocTemp() {
+    uint32_t reg = tempBase + tempTop++;
+    if (reg >= out->registerCount) {
+        out->registerCount = reg + 1;
+    }
+    return reg;
+}
+
+void Compiler::compileStatement(NodeId id) {
+    const AstNode& node = (*ast)[id];
+
+    switch (node.type) {
+    case NODE_DO_WHILE:
+        // The body is compiled by compile(), then the condition
+        loops.push_back({ id, 0, static_cast<uint32_t>(out->code.size()) });
+        break;
+    case NODE_ASSIGNMENT:
+        compileAssignment(id);
+        break;
+    case NODE_PRINT:
+        emit(OPC_PRINT, (*ast)[ast->child(id, 0)].value);
+        break;
+    default:
+        break;
+    }
+}
+
+void Compiler::compileAssignment(NodeId id) {
+    uint32_t slot = (*ast)[ast->child(id, 0)].value;
+    NodeId expr = ast->child(id, 1);
+    const AstNode& e = (*ast)[expr];
+
+    if (e.type == NODE_IDENTIFIER) {
+        if (e.value != slot) {
+            emit(OPC_MOV, slot, e.value);
+        }
+        return;
+    }
+
+    // Compute straight into the variable unless the chain reads it
+    // after the first operation has already overwritten it
+    if (!exprReadsAfterStart(expr, slot)) {
+        compileExpr(expr, slot);
+        return;
+    }
+
+    uint32_t temp = allocTemp();
+    compileExpr(expr, temp);
+    emit(OPC_MOV, slot, temp);
+    freeTemp();
+}
+
+bool Compiler::exprReadsAfterStart(NodeId id, uint32_t slot) const {
+    // E is a left-deep chain: walk the spine and look for right operands
+    // that are read after the variable has been written
+    while ((*ast)[id].type == NODE_BINARY_OP) {
+        NodeId left = ast->child(id, 0);
+        const AstNode& right = (*ast)[ast->child(id, 1)];
+        bool reads = right.type == NODE_BINARY_OP ||
+            (right.type == NODE_IDENTIFIER && right.value == slot);
+        // A constant on the far left is loaded into the variable first
+        if (reads && ((*ast)[left].type == NODE_BINARY_OP ||
+            (*ast)[left].type == NODE_CONSTANT)) {
+            return true;
+        }
+        id = left;
+    }
+    return false;
+}
+
+uint32_t Compiler::compileExpr(NodeId id, uint32_t dst) {
+    size_t mark = spine.size();
+    while ((*ast)[id].type == NODE_BINARY_OP) {
+        spine.push_back(id);
+        id = ast->child(id, 0);
+    }
+
+    const AstNode& leaf = (*ast)[id];
+    if (spine.size() == mark) {
+        if (leaf.type == NODE_CONSTANT) {
+            emit(OPC_LOADK, dst, constValue(leaf));
+            return dst;
+        }
+        return leaf.value;
+    }
+
+    uint32_t acc;
+    if (leaf.type == NODE_CONSTANT) {
+        emit(OPC_LOADK, dst, constValue(leaf));
+        acc = dst;
+    }
+    else {
+        acc = leaf.value;
+    }
+
+    // Operations from the innermost one outwards
+    for (size_t i = spine.size(); i > mark; i--) {
+        NodeId opId = spine[i - 1];
+        OpKind op = (*ast)[opId].op;
+        NodeId rightId = ast->child(opId, 1);
+        const AstNode& right = (*ast)[rightId];
+
+        if (right.type == NODE_CONSTANT) {
+            emit(op == OP_ADD ? OPC_ADDK : OPC_SUBK, dst, acc, constValue(right));
+        }
+        else if (right.type == NODE_IDENTIFIER) {
+            emit(op == OP_ADD ? OPC_ADD : OPC_SUB, dst, acc, right.value);
+        }
+        else {
+            uint32_t temp = allocTemp();
+            uint32_t rreg = compileExpr(rightId, temp);
+            emit(op == OP_ADD ? OPC_ADD : OPC_SUB, dst, acc, rreg);
+            freeTemp();
+        }
+        acc = dst;
+    }
+
+    spine.resize(mark);
+    return dst;
+}
+
+// Children of a do-while: statements..., condition
+void Compiler::compileCondition(const LoopFrame& frame) {
+    const AstNode& node = (*ast)[frame.id];
+    uint32_t loopStart = frame.loopStart;
+
+    NodeId cond = ast->child(frame.id, node.childCount - 1);
+    const AstNode& c = (*ast)[cond];
+    const AstNode& left = (*ast)[ast->child(cond, 0)];
+    const AstNode& right = (*ast)[ast->child(cond, 1)];
+    bool less = (c.op == OP_LT);
+
+    if (left.type == NODE_CONSTANT && right.type == NODE_CONSTANT) {
+        int32_t l = static_cast<int32_t>(constValue(left));
+        int32_t r = static_cast<int32_t>(constValue(right));
+        if (less ? l < r : l > r) {
+            emit(OPC_JMP, 0, 0, loopStart);
+        }
+        return;
+    }
+
+    if (left.type == NODE_CONSTANT && right.type != NODE_BINARY_OP) {
+        // k < E  is the same as  E > k
+        uint32_t temp = allocTemp();
+        uint32_t rreg = compileExpr(ast->child(cond, 1), temp);
+        emit(less ? OPC_JGTK : OPC_JLTK, rreg, constValue(left), loopStart);
+        freeTemp();
+        return;
+    }
+
+    uint32_t ltemp = allocTemp();
+    uint32_t lreg = compileExpr(ast->child(cond, 0), ltemp);
+
+    if (right.type == NODE_CONSTANT) {
+        emit(less ? OPC_JLTK : OPC_JGTK, lreg, constValue(right), loopStart);
+    }
+    else {
+        uint32_t rtemp = allocTemp();
+        uint32_t rreg = compileExpr(ast->child(cond, 1), rtemp);
+        emit(less ? OPC_JLT : OPC_JGT, lreg, rreg, loopStart);
+        freeTemp();
+    }
+    freeTemp();
+}
@@ -0,0 +1,45 @@
+// compiler.h
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include <vector>
+#include "ast.h"
+#include "vm.h"
+#include "tables.h"
+
+// Translates the parse tree into register bytecode
+class Compiler {
+private:
+    // A do-while whose body is being compiled, walked without recursion
+    struct LoopFrame {
+        NodeId id;
+        uint32_t next;          // next body statement
+        uint32_t loopStart;     // first instruction of the body
+    };
+
+    const CompilationContext* context;
+    const AstArena* ast;
+    Bytecode* out;
+    uint32_t tempBase;      // first register after the identifier slots
+    uint32_t tempTop;       // temporaries in use
+    std::vector<NodeId> spine;
+    std::vector<LoopFrame> loops;
+
+    void emit(OpCode op, uint32_t a, uint32_t b = 0, uint32_t c = 0);
+    uint32_t allocTemp();
+    void freeTemp() { tempTop--; }
+
+    void compileStatement(NodeId id);
+    void compileAssignment(NodeId id);
+    void compileCondition(const LoopFrame& frame);
+    uint32_t compileExpr(NodeId id, uint32_t dst);
+    bool exprReadsAfterStart(NodeId id, uint32_t slot) const;
+    uint32_t constValue(const AstNode& node) const {
+        return static_cast<uint32_t>(context->val_dig(node.value));
+    }
+
+public:
+    void compile(const CompilationContext& ctx, const AstArena& tree, NodeId root, Bytecode& program);
+};
+
+#endif
@@ -0,0 +1,119 @@
+// gen.cpp
+#include "gen.h"
+
+using namespace std;
+
+ProgramGenerator::ProgramGenerator(const GenOptions& generatorOptions)
+    : options(generatorOptions), random(generatorOptions.seed) {
+    if (options.identifiers == 0) options.identifiers = 1;
+    if (options.constants == 0) options.constants = 1;
+    if (options.maxDepth < 1) options.maxDepth = 1;
+
+    // Letters and a unique number: never a keyword, 2 to 9 characters or so
+    names.reserve(options.identifiers);
+    for (size_t i = 0; i < options.identifiers; i++) {
+        string name;
+        for (size_t n = 1 + pick(6); n > 0; n--) {
+            name += static_cast<char>('a' + pick(26));
+        }
+        names.push_back(name + to_string(i));
+    }
+
+    // Small values first, then spread over the int range
+    values.reserve(options.constants);
+    for (size_t i = 0; i < options.constants; i++) {
+        uint64_t value = i < 100 ? i : i * 2654435761u % 2147483647u;
+        values.push_back(to_string(value));
+    }
+}
+
+string ProgramGenerator::generate() {
+    string out;
+    out.reserve(options.size + 256);
+    statementCount = 0;
+    errorCount = 0;
+
+    out += "do ";
+    statement(out, 1);
+    while (out.size() < options.size) {
+        out += "; ";
+        statement(out, 1);
+    }
+    out += " while ";
+    condition(out);
+    out += "#";
+    return out;
+}
+
+void ProgramGenerator::statement(string& out, int depth) {
+    size_t start = out.size();
+    statementCount++;
+
+    size_t kind = pick(10);
+    if (kind < 2 && depth < options.maxDepth) {
+        out += "do ";
+        statement(out, depth + 1);
+        for (size_t n = pick(4); n > 0; n--) {
+            out += "; ";
+            statement(out, depth + 1);
+        }
+        out += " while ";
+        condition(out);
+    }
+    else if (kind < 8) {
+        out += names[pick(names.size())];
+        out += " = ";
+        expression(out);
+    }
+    else {
+        out += "print ";
+        out += names[pick(names.size())];
+    }
+
+    if (options.errorRate > 0 && chance(options.errorRate)) {
+        corrupt(out, start);
+    }
+}
+
+void ProgramGenerator::condition(string& out) {
+    expression(out);
+    out += pick(2) ? " < " : " > ";
+    expression(out);
+}
+
+void ProgramGenerator::expression(string& out) {
+    term(out);
+    for (size_t n = pick(4); n > 0; n--) {
+        out += pick(2) ? " + " : " - ";
+        term(out);
+    }
+}
+
+void ProgramGenerator::term(string& out) {
+    if (pick(2)) {
+        out += names[pick(names.size())];
+    }
+    else {
+        out += values[pick(values.size())];
+    }
+}
+
+// Every variant leaves a token no statement can start or continue with
+void ProgramGenerator::corrupt(string& out, size_t start) {
+    errorCount++;
+    switch (pick(4)) {
+    case 0:
+        out += " =";            // x = a =
+        break;
+    case 1:
+        out += " +";            // operator without a right term
+        break;
+    case 2:
+        out.insert(start, "= ");
+        break;
+    default:
+        out += " ";             // two operands in a row
+        out += values[pick(values.size())];
+        break;
+    }
+}
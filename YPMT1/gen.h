@@ -0,0 +1,53 @@
+// gen.h
+#ifndef GEN_H
+#define GEN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+// Shape of the generated programs
+struct GenOptions {
+    uint64_t seed = 1;
+    size_t size = 1 << 20;          // approximate length in bytes
+    int maxDepth = 4;               // nesting of do ... while
+    size_t identifiers = 256;       // distinct identifier names
+    size_t constants = 1024;        // distinct constant values
+    double errorRate = 0;           // share of statements with a syntax error
+};
+
+// Seeded generator of programs of the grammar S/B/E/T: the top level is
+// one do ... while loop whose body grows until the size is reached. With
+// an error rate, some statements lose or gain a token, so the program is
+// invalid. The same options and seed give the same program on every
+// platform.
+class ProgramGenerator {
+private:
+    GenOptions options;
+    std::mt19937_64 random;
+    std::vector<std::string> names;
+    std::vector<std::string> values;
+    size_t statementCount = 0;
+    size_t errorCount = 0;
+
+    size_t pick(size_t n) { return static_cast<size_t>(random() % n); }
+    bool chance(double p) { return static_cast<double>(random() >> 11) * 0x1.0p-53 < p; }
+
+    void statement(std::string& out, int depth);
+    void condition(std::string& out);
+    void expression(std::string& out);
+    void term(std::string& out);
+    void corrupt(std::string& out, size_t start);     // of the statement at start
+
+public:
+    explicit ProgramGenerator(const GenOptions& generatorOptions);
+
+    std::string generate();         // one program, ending in '#'
+
+    size_t statements() const { return statementCount; }
+    size_t errorsInjected() const { return errorCount; }
+};
+
+#endif
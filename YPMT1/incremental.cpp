@@ -0,0 +1,525 @@
+// incremental.cpp
+#include "incremental.h"
+#include "language.h"
+#include <algorithm>
+
+using namespace std;
+
+// Free token slots added when the gap is full
+const size_t GAP_SLOTS = 256;
+// Free bytes added when the text gap is full
+const size_t GAP_BYTES = 4096;
+// Bytes after an edit the lexer sees at first, doubled while a token
+// reaches the end of them
+const size_t RELEX_WINDOW = 64;
+
+const uint32_t NO_SUMS = 0xFFFFFFFFu;
+
+// Fenwick trees over the statements of a body: tree[i] is the sum of the
+// weights of items (i - (i & -i), i], tree[0] is unused
+static void fenwick_add(vector<uint32_t>& tree, size_t item, uint32_t delta) {
+    for (size_t i = item + 1; i < tree.size(); i += i & (0 - i)) {
+        tree[i] += delta;
+    }
+}
+
+// Sum of the weights of items [0, count)
+static size_t fenwick_prefix(const vector<uint32_t>& tree, size_t count) {
+    uint32_t sum = 0;
+    for (size_t i = count; i > 0; i -= i & (0 - i)) {
+        sum += tree[i];
+    }
+    return sum;
+}
+
+// Rebuilds the entries for items [from, count) after their weights
+// changed. Entries for items before from hold sums of them alone and are
+// kept; those whose range ends before from and whose parent is past it
+// pass their sum on.
+static void fenwick_build(vector<uint32_t>& tree, const vector<uint32_t>& weights, size_t from) {
+    size_t count = weights.size();
+    tree.resize(count + 1);
+    copy(weights.begin() + from, weights.end(), tree.begin() + from + 1);
+    for (size_t i = from; i > 0; i -= i & (0 - i)) {
+        size_t parent = i + (i & (0 - i));
+        if (parent <= count) {
+            tree[parent] += tree[i];
+        }
+    }
+    for (size_t i = from + 1; i <= count; i++) {
+        size_t parent = i + (i & (0 - i));
+        if (parent <= count) {
+            tree[parent] += tree[i];
+        }
+    }
+}
+
+// The first item whose weight and those before it add up to target or
+// more; the item count if there is none
+static size_t fenwick_search(const vector<uint32_t>& tree, size_t target) {
+    size_t step = 1;
+    while (step * 2 < tree.size()) {
+        step *= 2;
+    }
+    size_t item = 0;
+    size_t sum = 0;
+    for (; step > 0; step /= 2) {
+        if (item + step < tree.size() && sum + tree[item + step] < target) {
+            item += step;
+            sum += tree[item];
+        }
+    }
+    return item;
+}
+
+IncrementalProgram::IncrementalProgram()
+    : textGapStart(0), textGapEnd(0), gapStart(0), gapEnd(0), parser(tokens, context), checker(tokens, context),
+    checked(false), root(NO_NODE), liveSize(0), stats(), damaged(false), damageFirst(0), damageLast(0), damageDelta(0) {
+}
+
+string_view IncrementalProgram::source() {
+    moveTextGap(textSize());
+    return string_view(text.data(), textGapStart);
+}
+
+const vector<Token>& IncrementalProgram::getTokens() {
+    moveGap(tokenCount());
+    tokens.resize(gapStart);
+    gapEnd = gapStart;
+    return tokens;
+}
+
+// Moves the gap before token index. A token crossing it changes its
+// span from an offset to one counted from the end, or back.
+void IncrementalProgram::moveGap(size_t index) {
+    while (gapStart > index) {
+        Token& token = tokens[--gapEnd] = tokens[--gapStart];
+        token.setSpan(textSize() - token.offset(), token.length());
+    }
+    while (gapStart < index) {
+        Token& token = tokens[gapStart++] = tokens[gapEnd++];
+        token.setSpan(textSize() - token.offset(), token.length());
+    }
+    markGap();
+}
+
+// Makes room for count tokens and the END token
+void IncrementalProgram::reserveGap(size_t count) {
+    if (gapEnd - gapStart < count + 1) {
+        size_t grow = count + 1 + GAP_SLOTS + tokens.size() / 8;
+        tokens.insert(tokens.begin() + gapEnd, grow, Token{ TOKEN_END, 0, 0 });
+        gapEnd += grow;
+    }
+    markGap();
+}
+
+void IncrementalProgram::markGap() {
+    if (gapStart < gapEnd) {
+        tokens[gapStart] = Token{ TOKEN_END, 0, 0 };
+        tokens[gapStart].setSpan(textSize(), 0);
+    }
+}
+
+void IncrementalProgram::moveTextGap(size_t offset) {
+    if (offset < textGapStart) {
+        size_t count = textGapStart - offset;
+        copy_backward(text.begin() + offset, text.begin() + textGapStart, text.begin() + textGapEnd);
+        textGapStart -= count;
+        textGapEnd -= count;
+    }
+    else if (offset > textGapStart) {
+        size_t count = offset - textGapStart;
+        copy(text.begin() + textGapEnd, text.begin() + textGapEnd + count, text.begin() + textGapStart);
+        textGapStart += count;
+        textGapEnd += count;
+    }
+}
+
+void IncrementalProgram::replaceText(size_t offset, size_t removed, string_view inserted) {
+    moveTextGap(offset);
+    textGapEnd += removed;
+    if (textGapEnd - textGapStart < inserted.size()) {
+        size_t grow = inserted.size() + GAP_BYTES + text.size() / 8;
+        text.insert(textGapEnd, grow, '\0');
+        textGapEnd += grow;
+    }
+    inserted.copy(&text[textGapStart], inserted.size());
+    textGapStart += inserted.size();
+}
+
+bool IncrementalProgram::load(string_view source) {
+    text.assign(source.data(), source.size());
+    textGapStart = textGapEnd = text.size();
+    context.reset();
+    tokens = scanner(context, text);
+    gapStart = gapEnd = tokens.size();
+    reserveGap(0);
+    root = NO_NODE;
+    damaged = false;
+
+    stats = { tokenCount(), 0, 0, false };
+    return fullParse();
+}
+
+bool IncrementalProgram::edit(const TextEdit& change) {
+    stats = { 0, 0, 0, false };
+    checked = false;
+    size_t offset = min(change.offset, textSize());
+    size_t removed = min(change.removed, textSize() - offset);
+
+    // The first token that ends at or after the edit may be extended by it,
+    // the tokens before it end at unchanged bytes
+    size_t low = 0, high = tokenCount();
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (offsetOf(middle) + tokenAt(middle).length() < offset) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    size_t first = low;
+
+    // The tokens after the gap keep their spans when the text changes
+    moveGap(first);
+    replaceText(offset, removed, change.inserted);
+    markGap();
+
+    if (first > 0 && tokenAt(first - 1).type == TOKEN_END) {
+        return accepted();      // nothing after # is scanned
+    }
+
+    size_t last = relex(offset + change.inserted.size(), first);
+    size_t oldCount = last - first;
+    stats.tokensLexed = fresh.size();
+    stats.tokensReplaced = oldCount;
+
+    bool unchanged = fresh.size() == oldCount;
+    for (size_t i = 0; unchanged && i < oldCount; i++) {
+        const Token& now = fresh[i];
+        const Token& before = tokenAt(first + i);
+        unchanged = now.type == before.type && now.code == before.code && now.length() == before.length();
+    }
+
+    // Old tokens [first, last) are the first ones after the gap
+    gapEnd += oldCount;
+    reserveGap(fresh.size());
+    copy(fresh.begin(), fresh.end(), tokens.begin() + gapStart);
+    gapStart += fresh.size();
+    markGap();
+
+    if (root == NO_NODE) {
+        return fullParse();     // no tree to reuse
+    }
+    if (unchanged) {
+        return accepted();      // e.g. whitespace, the tree does not change
+    }
+
+    // Tokens of the accepted tree to parse again: those of this edit and
+    // those replaced since the tree was accepted
+    ptrdiff_t delta = static_cast<ptrdiff_t>(fresh.size()) - static_cast<ptrdiff_t>(oldCount);
+    if (damaged) {
+        size_t damageEnd = static_cast<size_t>(static_cast<ptrdiff_t>(damageLast) + damageDelta);
+        first = min(first, damageFirst);
+        last = static_cast<size_t>(static_cast<ptrdiff_t>(max(last, damageEnd)) - damageDelta);
+        delta += damageDelta;
+    }
+    return reparse(first, last, delta);
+}
+
+// Scans the edited text from the end of the token before first into fresh,
+// returns the index of the first old token that is kept
+size_t IncrementalProgram::relex(size_t editEnd, size_t first) {
+    size_t start = first > 0 ? offsetOf(first - 1) + tokenAt(first - 1).length() : 0;
+    size_t count = tokenCount();
+    size_t size = textSize();
+
+    // The lexer reads the text before the gap. A token that reaches the
+    // end of it may go on after the gap, then the gap moves further out.
+    for (size_t window = RELEX_WINDOW;; window *= 2) {
+        moveTextGap(min(editEnd + window, size));
+        string_view visible(text.data(), textGapStart);
+        bool whole = visible.size() == size;
+        size_t last = first;
+        Lexer lexer(context, visible, start);
+        Token token;
+
+        fresh.clear();
+        while (lexer.next(token)) {
+            // A token starting after the edit where an old token started is
+            // that token again, and so are all the tokens after it. The old
+            // ones are after the gap, counted from the end of the text.
+            if (token.offset() >= editEnd) {
+                size_t fromEnd = size - token.offset();
+                while (last < count && tokenAt(last).offset() > fromEnd) {
+                    last++;
+                }
+                if (last < count && tokenAt(last).offset() == fromEnd) {
+                    return last;
+                }
+            }
+            if (!whole && token.offset() + token.length() >= visible.size()) {
+                break;
+            }
+            fresh.push_back(token);
+        }
+        if (whole || (!fresh.empty() && fresh.back().type == TOKEN_END)) {
+            return count;   // up to the end of the text, or to '#'
+        }
+    }
+}
+
+// first and last are the replaced tokens of the accepted tree, tokenDelta
+// the change in count
+bool IncrementalProgram::reparse(size_t first, size_t last, ptrdiff_t tokenDelta) {
+    AstArena& ast = parser.getAst();
+
+    // Path to the innermost do-while body statements covering [first, last).
+    // Statement i of a body covers the tokens up to the ';' or 'while'
+    // after it, bodyStart + sum(0..i) - 1.
+    path.clear();
+    NodeId id = root;
+    size_t start = 0;
+    while (ast[id].type == NODE_DO_WHILE) {
+        size_t body = ast[id].childCount - 1;   // the last child is the condition
+        size_t bodyStart = start + 1;           // after 'do'
+        if (first < bodyStart) {
+            break;                              // in 'do'
+        }
+        const vector<uint32_t>& sums = sumsFor(id).tree;
+        size_t from = fenwick_search(sums, first - bodyStart + 1);
+        size_t to = fenwick_search(sums, last - bodyStart + 1);
+        if (to >= body) {
+            break;                              // in 'while' or the condition
+        }
+
+        size_t begin = bodyStart + fenwick_prefix(sums, from);
+        size_t end = bodyStart + fenwick_prefix(sums, to + 1) - 1;
+        path.push_back({ id, static_cast<uint32_t>(from), static_cast<uint32_t>(to - from + 1), begin, end });
+        if (from != to) {
+            break;
+        }
+        id = ast.child(id, static_cast<uint32_t>(from));
+        start = begin;
+    }
+
+    // Innermost statement first, then the enclosing ones. A failed attempt
+    // leaves no nodes behind.
+    size_t nodeMark = ast.size();
+    size_t childMark = ast.childSlots();
+    for (size_t f = path.size(); f-- > 0;) {
+        const Frame& frame = path[f];
+        size_t newLast = static_cast<size_t>(static_cast<ptrdiff_t>(frame.last) + tokenDelta);
+
+        // The parser sees the token at newLast and stops at the gap after it
+        moveGap(min(newLast + 1, tokenCount()));
+        statements.clear();
+        stats.tokensParsed += newLast - frame.first;
+        if (!parser.parseStatementsAt(frame.first, newLast, statements)) {
+            ast.truncate(nodeMark, childMark);
+            continue;
+        }
+
+        tokenCounts.resize(ast.size(), 0);
+        size_t p = frame.first;
+        for (NodeId statement : statements) {
+            p += measure(statement, p) + 1;
+        }
+
+        // The sums of the body follow its statements, those of the
+        // enclosing bodies the statement that holds the edit
+        uint32_t index = frame.doWhile < sumsOf.size() ? sumsOf[frame.doWhile] : NO_SUMS;
+        if (index != NO_SUMS) {
+            BodySums& sums = bodySums[index];
+            if (statements.size() == frame.count) {
+                for (uint32_t k = 0; k < frame.count; k++) {
+                    uint32_t weight = tokenCounts[statements[k]] + 1;
+                    fenwick_add(sums.tree, frame.child + k, weight - sums.weights[frame.child + k]);
+                    sums.weights[frame.child + k] = weight;
+                }
+            }
+            else {
+                auto end = sums.weights.begin() + frame.child + frame.count;
+                if (statements.size() > frame.count) {
+                    sums.weights.insert(end, statements.size() - frame.count, 0);
+                }
+                else {
+                    sums.weights.erase(end - (frame.count - statements.size()), end);
+                }
+                for (size_t k = 0; k < statements.size(); k++) {
+                    sums.weights[frame.child + k] = tokenCounts[statements[k]] + 1;
+                }
+                fenwick_build(sums.tree, sums.weights, frame.child);
+            }
+        }
+        ast.replaceChildren(frame.doWhile, frame.child, frame.count,
+            statements.data(), static_cast<uint32_t>(statements.size()));
+
+        for (size_t g = 0; g <= f; g++) {
+            tokenCounts[path[g].doWhile] = static_cast<uint32_t>(tokenCounts[path[g].doWhile] + tokenDelta);
+            uint32_t outer = g > 0 && path[g - 1].doWhile < sumsOf.size() ? sumsOf[path[g - 1].doWhile] : NO_SUMS;
+            if (outer != NO_SUMS) {
+                BodySums& sums = bodySums[outer];
+                fenwick_add(sums.tree, path[g - 1].child, static_cast<uint32_t>(tokenDelta));
+                sums.weights[path[g - 1].child] = static_cast<uint32_t>(sums.weights[path[g - 1].child] + tokenDelta);
+            }
+        }
+        parser.setParseTree(root);
+        damaged = false;
+
+        // Replaced subtrees stay in the arena until the next compaction
+        if (ast.size() + ast.childSlots() > 2 * liveSize + 4096) {
+            compact();
+        }
+        return true;
+    }
+
+    // The tree is kept for the next edits. When the statements of the
+    // top-level body around the edit do not parse, the program does not
+    // either: the tokens before and after them are those of the accepted
+    // tree, so it would have to parse them as statements of that body.
+    damaged = true;
+    damageFirst = first;
+    damageLast = last;
+    damageDelta = tokenDelta;
+    if (!path.empty()) {
+        return false;
+    }
+    return fullParse();
+}
+
+bool IncrementalProgram::fullParse() {
+    stats.fullParse = true;
+    stats.tokensParsed += tokenCount();
+    parseAll();
+    return accepted();
+}
+
+// Parses the whole program with the checker. An accepted tree takes the
+// place of the kept one, a rejected program keeps it.
+void IncrementalProgram::parseAll() {
+    moveGap(tokenCount());     // all spans are offsets again, for the error positions
+    checker.setSource(source());
+    checked = true;
+    if (!checker.parse()) {
+        return;
+    }
+
+    swap(parser.getAst(), checker.getAst());
+    root = checker.getParseTree();
+    parser.setParseTree(root);
+    damaged = false;
+    tokenCounts.assign(parser.getAst().size(), 0);
+    measure(root, 0);
+    sumsOf.clear();
+    bodySums.clear();
+    liveSize = parser.getAst().size() + parser.getAst().childSlots();
+}
+
+const Parser& IncrementalProgram::check() {
+    if (!checked) {
+        parseAll();
+    }
+    return checker;
+}
+
+IncrementalProgram::BodySums& IncrementalProgram::sumsFor(NodeId id) {
+    if (id >= sumsOf.size()) {
+        sumsOf.resize(parser.getAst().size(), NO_SUMS);
+    }
+    if (sumsOf[id] == NO_SUMS) {
+        const AstArena& ast = parser.getAst();
+        const NodeId* kids = ast.childrenOf(id);
+        sumsOf[id] = static_cast<uint32_t>(bodySums.size());
+        BodySums& sums = bodySums.emplace_back();
+        for (uint32_t i = 0; i + 1 < ast[id].childCount; i++) {   // the last child is the condition
+            sums.weights.push_back(tokenCounts[kids[i]] + 1);
+        }
+        fenwick_build(sums.tree, sums.weights, 0);
+    }
+    return bodySums[sumsOf[id]];
+}
+
+// Records the number of tokens of a statement that starts at token first,
+// and of the statements inside it
+size_t IncrementalProgram::measure(NodeId id, size_t first) {
+    const AstArena& ast = parser.getAst();
+    if (ast[id].type != NODE_DO_WHILE) {
+        // Assignments, prints and conditions have one token per node
+        size_t count = subtreeSize(id);
+        tokenCounts[id] = static_cast<uint32_t>(count);
+        return count;
+    }
+
+    size_t count = 0;
+    measuring.clear();
+    measuring.push_back({ id, 0, first, first + 1 });  // after do
+    while (!measuring.empty()) {
+        MeasureFrame& frame = measuring.back();
+        uint32_t body = ast[frame.id].childCount - 1;
+        if (frame.next < body) {
+            NodeId statement = ast.child(frame.id, frame.next++);
+            if (ast[statement].type == NODE_DO_WHILE) {
+                size_t start = frame.p;
+                measuring.push_back({ statement, 0, start, start + 1 });
+                continue;
+            }
+            count = subtreeSize(statement);
+            tokenCounts[statement] = static_cast<uint32_t>(count);
+        }
+        else {
+            frame.p++;  // while
+            frame.p += subtreeSize(ast.child(frame.id, body));
+            count = frame.p - frame.first;
+            tokenCounts[frame.id] = static_cast<uint32_t>(count);
+            measuring.pop_back();
+            if (measuring.empty()) {
+                break;
+            }
+        }
+
+        // A body statement of count tokens is done, step over it
+        MeasureFrame& parent = measuring.back();
+        parent.p += count;
+        const Token& token = tokenAt(parent.p);     // the END token after the last one
+        if (token.type == TOKEN_WORD && token.code == WORD_SEMICOLON) {
+            parent.p++;     // ; (also one before 'while')
+        }
+    }
+    return count;
+}
+
+size_t IncrementalProgram::subtreeSize(NodeId id) {
+    const AstArena& ast = parser.getAst();
+    size_t count = 0;
+
+    pending.clear();
+    pending.push_back(id);
+    while (!pending.empty()) {
+        NodeId top = pending.back();
+        pending.pop_back();
+        count++;
+        const NodeId* children = ast.childrenOf(top);
+        pending.insert(pending.end(), children, children + ast[top].childCount);
+    }
+    return count;
+}
+
+void IncrementalProgram::compact() {
+    AstArena& ast = parser.getAst();
+    root = ast.compact(root, remap);
+    parser.setParseTree(root);
+
+    vector<uint32_t> counts(ast.size(), 0);
+    for (size_t old = 0; old < remap.size(); old++) {
+        if (remap[old] != NO_NODE) {
+            counts[remap[old]] = tokenCounts[old];
+        }
+    }
+    tokenCounts.swap(counts);
+    sumsOf.clear();
+    bodySums.clear();
+
+    liveSize = ast.size() + ast.childSlots();
+}
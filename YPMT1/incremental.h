@@ -0,0 +1,148 @@
+// incremental.h
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "scanner.h"
+#include "parser.h"
+#include "tables.h"
+
+// Replaces `removed` bytes at offset with `inserted`
+struct TextEdit {
+    size_t offset;
+    size_t removed;
+    std::string_view inserted;
+};
+
+// Work done by the last load() or edit()
+struct EditStats {
+    size_t tokensLexed;         // tokens produced by the lexer
+    size_t tokensReplaced;      // old tokens they replaced
+    size_t tokensParsed;        // tokens covered by the re-parsed statements
+    bool fullParse;             // the whole program was parsed again
+};
+
+// A program kept scanned and parsed between edits (editor integration).
+// An edit is re-lexed from the token it touches until a new token starts
+// where an old one did, after the edited text; from there on the old
+// tokens are kept. Then only the statements of the innermost do-while
+// body that contain the changed tokens are parsed again and put in place
+// of the old ones, the rest of the tree is reused. If they do not parse
+// on their own, the enclosing statement is tried, up to the top-level
+// statement. When none of them parses the program is rejected, but its
+// last accepted tree is kept with the range of tokens that differ from
+// it; the next edits parse that range again, together with their own.
+// Only edits of the top-level 'do', 'while' and condition, and edits of
+// a program that was never accepted, parse the whole program.
+class IncrementalProgram {
+private:
+    struct Frame {
+        NodeId doWhile;         // do-while whose body holds the edit
+        uint32_t child;         // statements of the body [child, child + count)
+        uint32_t count;
+        size_t first, last;     // their tokens, [first, last)
+    };
+    // A do-while whose tokens are being counted, walked without recursion
+    struct MeasureFrame {
+        NodeId id;
+        uint32_t next;          // next body statement
+        size_t first;           // its do token
+        size_t p;               // token after the statements counted so far
+    };
+
+    CompilationContext context;
+
+    // Text with a gap at the last edit, bytes [textGapStart, textGapEnd)
+    // are free
+    std::string text;
+    size_t textGapStart, textGapEnd;
+
+    // Tokens with a gap at the last edit. Spans before the gap are offsets
+    // in the text, after it they count back from the end of the text, so
+    // they stay valid when the text at the gap changes. The first slot of
+    // the gap holds an END token, the parser stops there.
+    std::vector<Token> tokens;
+    size_t gapStart, gapEnd;
+
+    Parser parser;                      // reads tokens, owns the tree
+    Parser checker;                     // parses the whole program
+    bool checked;                       // checker has parsed the current tokens
+    NodeId root;                        // last accepted tree, NO_NODE if there is none
+    std::vector<uint32_t> tokenCounts;  // tokens of each statement node
+    size_t liveSize;                    // nodes and child slots after the last full parse or compaction
+    EditStats stats;
+
+    // While the program is rejected: tokens [damageFirst, damageLast) of
+    // the accepted tree have been replaced, by damageDelta more tokens
+    bool damaged;
+    size_t damageFirst, damageLast;
+    ptrdiff_t damageDelta;
+
+    // Prefix sums of the statements of a do-while body. Each statement
+    // weighs its tokens and the ';' or 'while' after it; the weights are
+    // kept in order so the tree is rebuilt from them without the arena.
+    struct BodySums {
+        std::vector<uint32_t> weights;
+        std::vector<uint32_t> tree;     // Fenwick tree over the weights
+    };
+    std::vector<uint32_t> sumsOf;      // index into bodySums by node, NO_SUMS for none yet
+    std::vector<BodySums> bodySums;
+
+    std::vector<Token> fresh;           // re-lexed tokens
+    std::vector<Frame> path;
+    std::vector<MeasureFrame> measuring;
+    std::vector<NodeId> statements;     // re-parsed statements
+    std::vector<NodeId> pending;
+    std::vector<NodeId> remap;
+
+    size_t textSize() const { return text.size() - (textGapEnd - textGapStart); }
+    size_t tokenCount() const { return tokens.size() - (gapEnd - gapStart); }
+    const Token& tokenAt(size_t i) const { return tokens[i < gapStart ? i : i + (gapEnd - gapStart)]; }
+    size_t offsetOf(size_t i) const {
+        return i < gapStart ? tokens[i].offset() : textSize() - tokenAt(i).offset();
+    }
+    void moveGap(size_t index);
+    void reserveGap(size_t count);
+    void markGap();
+    void moveTextGap(size_t offset);
+    void replaceText(size_t offset, size_t removed, std::string_view inserted);
+
+    size_t relex(size_t editEnd, size_t first);
+    bool reparse(size_t first, size_t last, ptrdiff_t tokenDelta);
+    bool fullParse();
+    void parseAll();
+    BodySums& sumsFor(NodeId id);
+    size_t measure(NodeId id, size_t first);
+    size_t subtreeSize(NodeId id);
+    void compact();
+
+public:
+    IncrementalProgram();
+    IncrementalProgram(const IncrementalProgram&) = delete;
+    IncrementalProgram& operator=(const IncrementalProgram&) = delete;
+
+    // Scans and parses the whole program; true if it is accepted
+    bool load(std::string_view source);
+    // Applies an edit to the text; true if the program is accepted
+    bool edit(const TextEdit& change);
+
+    bool accepted() const { return root != NO_NODE && !damaged; }
+    size_t size() const { return textSize(); }
+    char charAt(size_t offset) const {
+        return text[offset < textGapStart ? offset : offset + (textGapEnd - textGapStart)];
+    }
+    std::string_view source();                  // closes the gap
+    const std::vector<Token>& getTokens();      // closes the gap
+    // Parser of the whole program, for the errors of the current text;
+    // edits parse the whole program only when they must, this does
+    const Parser& check();
+    const AstArena& getAst() const { return parser.getAst(); }
+    NodeId getParseTree() const { return accepted() ? root : NO_NODE; }
+    CompilationContext& getContext() { return context; }
+    const EditStats& lastEdit() const { return stats; }
+};
+
+#endif
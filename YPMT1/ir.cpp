@@ -0,0 +1,930 @@
+// ir.cpp
+#include "ir.h"
+#include <algorithm>
+#include <queue>
+#include <utility>
+
+using namespace std;
+
+uint32_t IrProgram::add(IrOp op, uint32_t block, uint32_t a, uint32_t b) {
+    uint32_t id = static_cast<uint32_t>(values.size());
+    values.push_back({ op, block, 0, 0, { a, b } });
+    blocks[block].code.push_back(id);
+    return id;
+}
+
+uint32_t IrProgram::constant(int64_t value) {
+    uint32_t id = static_cast<uint32_t>(values.size());
+    values.push_back({ IR_CONST, 0, 0, value, { 0, 0 } });
+    return id;
+}
+
+size_t IrProgram::instructionCount() const {
+    size_t n = 0;
+    for (const IrBlock& block : blocks) {
+        n += block.code.size();
+    }
+    return n;
+}
+
+bool IrProgram::inLoop(uint32_t block, uint32_t loop) const {
+    uint32_t l = blocks[block].loop;
+    return l != NO_LOOP && l >= loop && l < loops[loop].end;
+}
+
+void IrProgram::clear() {
+    values.clear();
+    blocks.clear();
+    loops.clear();
+}
+
+void IrBuilder::build(const CompilationContext& ctx, const AstArena& tree, NodeId root, IrProgram& program) {
+    context = &ctx;
+    ast = &tree;
+    out = &program;
+
+    program.clear();
+    currentLoop = NO_LOOP;
+    current = newBlock(NO_LOOP);
+
+    // Value 0 is the constant 0, the start value of every identifier
+    program.constant(0);
+    defs.assign(ctx.identifiers.size() + 1, 0);
+    constants.assign(ctx.constants.size() + 1, 0);
+    stamp.assign(ctx.identifiers.size() + 1, 0);
+    stampNow = 0;
+
+    if (root == NO_NODE) {
+        return;
+    }
+    collectAssigned(root);
+    walk.clear();
+    phis.clear();
+    statement(root);
+    while (!walk.empty()) {
+        Frame& frame = walk.back();
+        if (frame.next + 1 < (*ast)[frame.id].childCount) {
+            statement(ast->child(frame.id, frame.next++));
+            continue;
+        }
+        Frame done = frame;
+        walk.pop_back();
+        finishLoop(done);
+    }
+}
+
+uint32_t IrBuilder::newBlock(uint32_t loop) {
+    out->blocks.push_back({ {}, loop });
+    return static_cast<uint32_t>(out->blocks.size() - 1);
+}
+
+// Every identifier assigned in a loop, nested loops included, gets a phi.
+// The sets are made bottom-up in one pass: a loop's set is its own
+// assignments and the sets of the loops in it, duplicates removed.
+// Loops are numbered in layout order, as build() creates them.
+void IrBuilder::collectAssigned(NodeId root) {
+    assigned.clear();
+    loopSets.clear();
+    setBounds.clear();
+    walk.clear();
+
+    auto enter = [&](NodeId id) {
+        const AstNode& node = (*ast)[id];
+        if (node.type == NODE_ASSIGNMENT) {
+            assigned.push_back((*ast)[ast->child(id, 0)].value);
+        }
+        else if (node.type == NODE_DO_WHILE) {
+            walk.push_back({ id, 0, static_cast<uint32_t>(setBounds.size()), assigned.size() });
+            setBounds.push_back({ 0, 0 });
+        }
+    };
+
+    enter(root);
+    while (!walk.empty()) {
+        Frame& frame = walk.back();
+        if (frame.next + 1 < (*ast)[frame.id].childCount) {
+            enter(ast->child(frame.id, frame.next++));
+            continue;
+        }
+
+        stampNow++;
+        size_t kept = frame.mark;
+        for (size_t i = frame.mark; i < assigned.size(); i++) {
+            uint32_t slot = assigned[i];
+            if (stamp[slot] != stampNow) {
+                stamp[slot] = stampNow;
+                assigned[kept++] = slot;
+            }
+        }
+        assigned.resize(kept);
+        setBounds[frame.loop] = { loopSets.size(), loopSets.size() + kept - frame.mark };
+        loopSets.insert(loopSets.end(), assigned.begin() + static_cast<ptrdiff_t>(frame.mark), assigned.end());
+        walk.pop_back();
+    }
+}
+
+void IrBuilder::statement(NodeId id) {
+    const AstNode& node = (*ast)[id];
+
+    switch (node.type) {
+    case NODE_DO_WHILE: {
+        // The body is built by build(), then finishLoop() adds the condition
+        uint32_t index = static_cast<uint32_t>(out->loops.size());
+        out->loops.push_back({ 0, 0, currentLoop, 0, OP_LT, 0, 0 });
+        currentLoop = index;
+        uint32_t header = newBlock(index);
+        out->loops[index].header = header;
+        current = header;
+
+        walk.push_back({ id, 0, index, phis.size() });
+        for (size_t i = setBounds[index].first; i < setBounds[index].second; i++) {
+            uint32_t slot = loopSets[i];
+            uint32_t phi = out->add(IR_PHI, header, defs[slot], 0);
+            out->values[phi].var = slot;
+            defs[slot] = phi;
+            phis.push_back(phi);
+        }
+        break;
+    }
+    case NODE_ASSIGNMENT: {
+        uint32_t slot = (*ast)[ast->child(id, 0)].value;
+        uint32_t value = expression(ast->child(id, 1));
+        uint32_t copy = out->add(IR_COPY, current, value);
+        out->values[copy].var = slot;
+        defs[slot] = copy;
+        break;
+    }
+    case NODE_PRINT:
+        out->add(IR_PRINT, current, defs[(*ast)[ast->child(id, 0)].value]);
+        break;
+    default:
+        break;
+    }
+}
+
+void IrBuilder::finishLoop(const Frame& frame) {
+    const AstNode& node = (*ast)[frame.id];
+    NodeId cond = ast->child(frame.id, node.childCount - 1);
+    uint32_t left = expression(ast->child(cond, 0));
+    uint32_t right = expression(ast->child(cond, 1));
+    IrLoop& l = out->loops[frame.loop];
+    l.latch = current;
+    l.compare = (*ast)[cond].op;
+    l.left = left;
+    l.right = right;
+    l.end = static_cast<uint32_t>(out->loops.size());
+
+    for (size_t i = frame.mark; i < phis.size(); i++) {
+        IrInstr& phi = out->values[phis[i]];
+        phi.args[1] = defs[phi.var];
+    }
+    phis.resize(frame.mark);
+
+    currentLoop = l.parent;
+    current = newBlock(currentLoop);
+}
+
+uint32_t IrBuilder::operand(NodeId id) {
+    const AstNode& node = (*ast)[id];
+    if (node.type == NODE_IDENTIFIER) {
+        return defs[node.value];
+    }
+    if (node.type == NODE_CONSTANT) {
+        if (constants[node.value] == 0) {
+            int value = context->val_dig(node.value);
+            constants[node.value] = value == 0 ? 0 : out->constant(value);
+        }
+        return constants[node.value];
+    }
+    return expression(id);
+}
+
+uint32_t IrBuilder::expression(NodeId id) {
+    size_t mark = spine.size();
+    while ((*ast)[id].type == NODE_BINARY_OP) {
+        spine.push_back(id);
+        id = ast->child(id, 0);
+    }
+
+    uint32_t acc = operand(id);
+    // Operations from the innermost one outwards
+    for (size_t i = spine.size(); i > mark; i--) {
+        NodeId opId = spine[i - 1];
+        OpKind op = (*ast)[opId].op;
+        uint32_t right = operand(ast->child(opId, 1));
+        acc = out->add(op == OP_ADD ? IR_ADD : IR_SUB, current, acc, right);
+    }
+
+    spine.resize(mark);
+    return acc;
+}
+
+static void printOperand(const IrProgram& program, uint32_t v, ostream& out) {
+    if (program.values[v].op == IR_CONST) {
+        out << program.values[v].value;
+    }
+    else {
+        out << "v" << v;
+    }
+}
+
+void print_ir(const IrProgram& program, const CompilationContext& ctx, ostream& out) {
+    vector<uint32_t> latchOf(program.blocks.size(), NO_LOOP);
+    for (uint32_t l = 0; l < program.loops.size(); l++) {
+        latchOf[program.loops[l].latch] = l;
+    }
+
+    for (uint32_t b = 0; b < program.blocks.size(); b++) {
+        const IrBlock& block = program.blocks[b];
+        out << "b" << b << ":";
+        if (block.loop != NO_LOOP) {
+            out << " loop " << block.loop;
+            if (program.loops[block.loop].header == b) {
+                out << " header";
+            }
+        }
+        out << "\n";
+
+        for (uint32_t v : block.code) {
+            const IrInstr& instr = program.values[v];
+            out << "    ";
+            switch (instr.op) {
+            case IR_PHI:
+                out << "v" << v << " = phi ";
+                printOperand(program, instr.args[0], out);
+                out << ", ";
+                printOperand(program, instr.args[1], out);
+                break;
+            case IR_ADD:
+            case IR_SUB:
+                out << "v" << v << " = " << (instr.op == IR_ADD ? "add " : "sub ");
+                printOperand(program, instr.args[0], out);
+                out << ", ";
+                printOperand(program, instr.args[1], out);
+                break;
+            case IR_COPY:
+                out << "v" << v << " = copy ";
+                printOperand(program, instr.args[0], out);
+                break;
+            case IR_PRINT:
+                out << "print ";
+                printOperand(program, instr.args[0], out);
+                break;
+            default:
+                out << "?";
+                break;
+            }
+            if (instr.var != 0 && instr.op != IR_PRINT) {
+                out << "    ; " << ctx.identifiers.name(static_cast<int>(instr.var));
+            }
+            out << "\n";
+        }
+
+        if (latchOf[b] != NO_LOOP) {
+            const IrLoop& loop = program.loops[latchOf[b]];
+            out << "    loop " << latchOf[b] << " while ";
+            printOperand(program, loop.left, out);
+            out << (loop.compare == OP_LT ? " < " : " > ");
+            printOperand(program, loop.right, out);
+            out << " goto b" << loop.header << "\n";
+        }
+    }
+}
+
+bool verify_ir(const IrProgram& program, string& message) {
+    const size_t count = program.values.size();
+    const uint32_t UNDEFINED = 0xFFFFFFFFu;
+
+    // Order of definition: constants first, then instructions in layout order
+    vector<uint32_t> order(count, UNDEFINED);
+    vector<uint32_t> blockEnd(program.blocks.size(), 0);
+    uint32_t position = 1;
+    for (size_t v = 0; v < count; v++) {
+        if (program.values[v].op == IR_CONST) {
+            order[v] = 0;
+        }
+    }
+
+    for (uint32_t l = 0; l < program.loops.size(); l++) {
+        const IrLoop& loop = program.loops[l];
+        if (loop.header == 0 || loop.header > loop.latch || loop.latch >= program.blocks.size()) {
+            message = "loop " + to_string(l) + " has bad blocks";
+            return false;
+        }
+        if (loop.end <= l || loop.end > program.loops.size() ||
+            (loop.parent != NO_LOOP && (loop.parent >= l || loop.end > program.loops[loop.parent].end))) {
+            message = "loop " + to_string(l) + " has bad numbering";
+            return false;
+        }
+        if (program.blocks[loop.header].loop != l || !program.inLoop(loop.latch, l) ||
+            program.blocks[loop.header - 1].loop != loop.parent) {
+            message = "loop " + to_string(l) + " is not nested in its parent";
+            return false;
+        }
+        if (loop.compare != OP_LT && loop.compare != OP_GT) {
+            message = "loop " + to_string(l) + " has no comparison";
+            return false;
+        }
+    }
+
+    // The loops open at each block, in one pass: a block is in the
+    // innermost one, and loops start in the order they are numbered
+    vector<uint32_t> open;
+    uint32_t nextLoop = 0;
+    auto close = [&]() {
+        uint32_t l = open.back();
+        open.pop_back();
+        if (program.loops[l].end != nextLoop) {
+            message = "loop " + to_string(l) + " has bad numbering";
+            return false;
+        }
+        return true;
+    };
+    for (uint32_t b = 0; b < program.blocks.size(); b++) {
+        while (!open.empty() && program.loops[open.back()].latch < b) {
+            if (!close()) {
+                return false;
+            }
+        }
+        uint32_t l = program.blocks[b].loop;
+        if (l != NO_LOOP && l < program.loops.size() && program.loops[l].header == b) {
+            if (l != nextLoop) {
+                message = "loop " + to_string(l) + " is out of order";
+                return false;
+            }
+            nextLoop++;
+            open.push_back(l);
+        }
+        if (l != (open.empty() ? NO_LOOP : open.back())) {
+            message = "block b" + to_string(b) + " is not in the innermost loop around it";
+            return false;
+        }
+    }
+    while (!open.empty()) {
+        if (!close()) {
+            return false;
+        }
+    }
+
+    for (uint32_t b = 0; b < program.blocks.size(); b++) {
+        const IrBlock& block = program.blocks[b];
+        bool header = block.loop != NO_LOOP && program.loops[block.loop].header == b;
+        bool phis = header;
+        for (uint32_t v : block.code) {
+            if (v >= count) {
+                message = "block b" + to_string(b) + " refers to v" + to_string(v);
+                return false;
+            }
+            const IrInstr& instr = program.values[v];
+            if (instr.block != b || order[v] != UNDEFINED) {
+                message = "v" + to_string(v) + " is not in block b" + to_string(b) + " once";
+                return false;
+            }
+            if (instr.op == IR_CONST || instr.op == IR_REMOVED) {
+                message = "v" + to_string(v) + " cannot be in a block";
+                return false;
+            }
+            if (instr.op == IR_PHI && !phis) {
+                message = "phi v" + to_string(v) + " is not at the start of a loop header";
+                return false;
+            }
+            phis = phis && instr.op == IR_PHI;
+            order[v] = position++;
+        }
+        blockEnd[b] = position++;
+    }
+
+    auto defined = [&](uint32_t v, uint32_t before) {
+        return v < count && program.values[v].op != IR_REMOVED && order[v] < before;
+    };
+
+    for (uint32_t b = 0; b < program.blocks.size(); b++) {
+        for (uint32_t v : program.blocks[b].code) {
+            const IrInstr& instr = program.values[v];
+            bool ok = true;
+            if (instr.op == IR_PHI) {
+                const IrLoop& loop = program.loops[program.blocks[b].loop];
+                ok = defined(instr.args[0], blockEnd[loop.header - 1]) && defined(instr.args[1], blockEnd[loop.latch]);
+            }
+            else {
+                int operands = (instr.op == IR_ADD || instr.op == IR_SUB) ? 2 : 1;
+                for (int i = 0; i < operands; i++) {
+                    ok = ok && defined(instr.args[i], order[v]);
+                }
+            }
+            if (!ok) {
+                message = "an operand of v" + to_string(v) + " is not defined before it";
+                return false;
+            }
+        }
+    }
+
+    for (uint32_t l = 0; l < program.loops.size(); l++) {
+        const IrLoop& loop = program.loops[l];
+        if (!defined(loop.left, blockEnd[loop.latch]) || !defined(loop.right, blockEnd[loop.latch])) {
+            message = "the condition of loop " + to_string(l) + " uses an undefined value";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Register allocation and code generation for lower_ir. Every loop has
+// four kinds of positions: the entry copies into its phis before the
+// header, its instructions, the copies into its phis at the end of the
+// latch, and the branch back to the header.
+class IrLowering {
+private:
+    struct Interval {
+        uint32_t start;
+        uint32_t end;
+    };
+
+    IrProgram program;
+    vector<uint32_t> position;          // of each value
+    vector<uint32_t> entryAt, copyAt, branchAt;     // of each loop
+    vector<uint32_t> headerOf, latchOf;             // loop of each block
+    vector<Interval> live;
+    vector<uint32_t> leader;            // union-find of values sharing a register
+    vector<uint32_t> nextMember;        // members of each class, linked
+    vector<uint32_t> lastMember, classSize;         // of each leader
+    vector<bool> carried;               // phi copied into at the latch
+    vector<uint32_t> reg;
+
+    bool isConst(uint32_t v) const { return program.values[v].op == IR_CONST; }
+    void number();
+    void saveLatePhis();
+    void use(uint32_t v, uint32_t at, uint32_t loop);
+    void computeLiveness();
+    uint32_t find(uint32_t v);
+    bool interferes(uint32_t a, uint32_t b) const;
+    bool conflict(uint32_t a, uint32_t b);
+    void merge(uint32_t a, uint32_t b);
+    void coalesce();
+    uint32_t allocate();
+
+    Bytecode* out;
+    uint32_t scratch, temp;
+    uint32_t r(uint32_t v) { return reg[find(v)]; }
+    static uint32_t immediate(int64_t value) { return static_cast<uint32_t>(static_cast<int32_t>(value)); }
+    void emit(OpCode op, uint32_t a, uint32_t b = 0, uint32_t c = 0) { out->code.push_back({ op, a, b, c }); }
+    void emitMoves(uint32_t loop, int arg);
+    void emitInstr(uint32_t v);
+    void emitBranch(uint32_t loop, uint32_t target);
+
+public:
+    explicit IrLowering(const IrProgram& ir) : program(ir) {}
+    void lower(Bytecode& bytecode);
+};
+
+void IrLowering::number() {
+    size_t loops = program.loops.size();
+    position.assign(program.values.size(), 0);
+    entryAt.assign(loops, 0);
+    copyAt.assign(loops, 0);
+    branchAt.assign(loops, 0);
+    headerOf.assign(program.blocks.size(), NO_LOOP);
+    latchOf.assign(program.blocks.size(), NO_LOOP);
+    for (uint32_t l = 0; l < loops; l++) {
+        headerOf[program.loops[l].header] = l;
+        latchOf[program.loops[l].latch] = l;
+    }
+
+    uint32_t at = 1;
+    for (uint32_t b = 0; b < program.blocks.size(); b++) {
+        if (headerOf[b] != NO_LOOP) {
+            entryAt[headerOf[b]] = at++;
+        }
+        for (uint32_t v : program.blocks[b].code) {
+            position[v] = program.values[v].op == IR_PHI ? entryAt[headerOf[b]] : at++;
+        }
+        if (latchOf[b] != NO_LOOP) {
+            copyAt[latchOf[b]] = at++;
+            branchAt[latchOf[b]] = at++;
+        }
+    }
+}
+
+// The latch copies overwrite the register of a phi, so a phi still needed
+// by the branch or after the loop is saved into a value of its own first
+void IrLowering::saveLatePhis() {
+    // At most one copy per phi: the references below stay valid
+    size_t count = program.values.size();
+    size_t phis = 0;
+    for (const IrInstr& instr : program.values) {
+        phis += instr.op == IR_PHI ? 1 : 0;
+    }
+    program.values.reserve(count + phis);
+    vector<uint32_t> saved(count, 0);
+    auto late = [&](uint32_t& v, uint32_t at) {
+        const IrInstr& instr = program.values[v];
+        if (instr.op != IR_PHI) {
+            return;
+        }
+        uint32_t loop = program.blocks[instr.block].loop;
+        if (at <= copyAt[loop]) {
+            return;
+        }
+        if (saved[v] == 0) {
+            uint32_t copy = program.add(IR_COPY, program.loops[loop].latch, v);
+            program.values[copy].var = program.values[v].var;
+            saved[v] = copy;
+        }
+        v = saved[v];
+    };
+
+    for (size_t v = 0; v < count; v++) {
+        IrInstr& instr = program.values[v];
+        if (instr.op == IR_PHI) {
+            uint32_t loop = program.blocks[instr.block].loop;
+            late(instr.args[0], entryAt[loop]);
+            late(instr.args[1], copyAt[loop]);
+        }
+        else if (instr.op == IR_ADD || instr.op == IR_SUB) {
+            late(instr.args[0], position[v]);
+            late(instr.args[1], position[v]);
+        }
+        else if (instr.op == IR_COPY || instr.op == IR_PRINT) {
+            late(instr.args[0], position[v]);
+        }
+    }
+    for (uint32_t l = 0; l < program.loops.size(); l++) {
+        late(program.loops[l].left, branchAt[l]);
+        late(program.loops[l].right, branchAt[l]);
+    }
+}
+
+// A value used in a loop it is not defined in stays live to the end of
+// the outermost such loop, it is read again in the next iteration
+void IrLowering::use(uint32_t v, uint32_t at, uint32_t loop) {
+    if (isConst(v)) {
+        return;
+    }
+    uint32_t block = program.values[v].block;
+    uint32_t outermost = NO_LOOP;
+    for (uint32_t l = loop; l != NO_LOOP && !program.inLoop(block, l); l = program.loops[l].parent) {
+        outermost = l;
+    }
+    if (outermost != NO_LOOP) {
+        at = max(at, branchAt[outermost]);
+    }
+    live[v].end = max(live[v].end, at);
+}
+
+void IrLowering::computeLiveness() {
+    live.assign(program.values.size(), { 0, 0 });
+    for (uint32_t b = 0; b < program.blocks.size(); b++) {
+        for (uint32_t v : program.blocks[b].code) {
+            live[v] = { position[v], position[v] };
+        }
+    }
+    for (uint32_t b = 0; b < program.blocks.size(); b++) {
+        uint32_t loop = program.blocks[b].loop;
+        for (uint32_t v : program.blocks[b].code) {
+            const IrInstr& instr = program.values[v];
+            switch (instr.op) {
+            case IR_PHI:
+                use(instr.args[0], entryAt[loop], program.loops[loop].parent);
+                use(instr.args[1], copyAt[loop], loop);
+                break;
+            case IR_ADD:
+            case IR_SUB:
+                use(instr.args[0], position[v], loop);
+                use(instr.args[1], position[v], loop);
+                break;
+            case IR_COPY:
+            case IR_PRINT:
+                use(instr.args[0], position[v], loop);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    for (uint32_t l = 0; l < program.loops.size(); l++) {
+        use(program.loops[l].left, branchAt[l], l);
+        use(program.loops[l].right, branchAt[l], l);
+    }
+}
+
+uint32_t IrLowering::find(uint32_t v) {
+    while (leader[v] != v) {
+        leader[v] = leader[leader[v]];
+        v = leader[v];
+    }
+    return v;
+}
+
+static bool overlaps(uint32_t s1, uint32_t e1, uint32_t s2, uint32_t e2) {
+    // Touching is fine: an instruction reads its operands before it
+    // writes. Two values defined by the same parallel copy are not.
+    return s1 == s2 || (s1 < e2 && s2 < e1);
+}
+
+bool IrLowering::interferes(uint32_t a, uint32_t b) const {
+    uint32_t loopA = program.blocks[program.values[a].block].loop;
+    uint32_t loopB = program.blocks[program.values[b].block].loop;
+    if (overlaps(live[a].start, live[a].end, live[b].start, live[b].end)) {
+        return true;
+    }
+    // The register of a phi copied into at the latch is busy from the
+    // copies to the branch
+    if (carried[a] && overlaps(copyAt[loopA], branchAt[loopA], live[b].start, live[b].end)) {
+        return true;
+    }
+    if (carried[b] && overlaps(copyAt[loopB], branchAt[loopB], live[a].start, live[a].end)) {
+        return true;
+    }
+    return carried[a] && carried[b] && loopA == loopB;
+}
+
+// Every member against every member, so classes stay small: a phi
+// left out only costs a copy, deep loop nests would cost quadratic time
+const uint32_t MAX_CLASS_SIZE = 64;
+
+bool IrLowering::conflict(uint32_t a, uint32_t b) {
+    if (classSize[find(a)] + classSize[find(b)] > MAX_CLASS_SIZE) {
+        return true;
+    }
+    for (uint32_t x = find(a); x != NO_LOOP; x = nextMember[x]) {
+        for (uint32_t y = find(b); y != NO_LOOP; y = nextMember[y]) {
+            if (interferes(x, y)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void IrLowering::merge(uint32_t a, uint32_t b) {
+    a = find(a);
+    b = find(b);
+    nextMember[lastMember[a]] = b;
+    lastMember[a] = lastMember[b];
+    classSize[a] += classSize[b];
+    leader[b] = a;
+}
+
+// A phi shares the register of its latch value where their live ranges
+// allow, then the register of its entry value. Loops are numbered in
+// layout order, so the phis of a loop are coalesced before those of the
+// loops inside it can take a phi as their entry value.
+void IrLowering::coalesce() {
+    size_t count = program.values.size();
+    leader.resize(count);
+    lastMember.resize(count);
+    for (size_t v = 0; v < count; v++) {
+        leader[v] = static_cast<uint32_t>(v);
+        lastMember[v] = static_cast<uint32_t>(v);
+    }
+    nextMember.assign(count, NO_LOOP);
+    classSize.assign(count, 1);
+    carried.assign(count, false);
+
+    for (const IrLoop& loop : program.loops) {
+        for (uint32_t v : program.blocks[loop.header].code) {
+            const IrInstr& phi = program.values[v];
+            if (phi.op != IR_PHI) {
+                break;
+            }
+            uint32_t latchValue = phi.args[1];
+            if (!isConst(latchValue) && find(latchValue) != find(v) && !conflict(v, latchValue)) {
+                merge(v, latchValue);
+            }
+            carried[v] = isConst(latchValue) || find(latchValue) != find(v);
+
+            uint32_t entryValue = phi.args[0];
+            if (!isConst(entryValue) && find(entryValue) != find(v) && !conflict(v, entryValue)) {
+                merge(v, entryValue);
+            }
+        }
+    }
+}
+
+// Linear scan over the hull of each class, lowest free register first.
+// Returns the number of registers used, register 0 is not.
+uint32_t IrLowering::allocate() {
+    struct ClassInterval {
+        uint32_t start;
+        uint32_t end;
+        uint32_t leader;
+    };
+
+    vector<ClassInterval> classes;
+    vector<uint32_t> slot(program.values.size(), NO_LOOP);
+    for (const IrBlock& block : program.blocks) {
+        for (uint32_t v : block.code) {
+            const IrInstr& instr = program.values[v];
+            if (instr.op == IR_PRINT) {
+                continue;
+            }
+            uint32_t l = program.blocks[instr.block].loop;
+            uint32_t start = live[v].start;
+            uint32_t end = carried[v] ? max(live[v].end, branchAt[l]) : live[v].end;
+            uint32_t root = find(v);
+            if (slot[root] == NO_LOOP) {
+                slot[root] = static_cast<uint32_t>(classes.size());
+                classes.push_back({ start, end, root });
+            }
+            else {
+                ClassInterval& c = classes[slot[root]];
+                c.start = min(c.start, start);
+                c.end = max(c.end, end);
+            }
+        }
+    }
+    sort(classes.begin(), classes.end(), [](const ClassInterval& a, const ClassInterval& b) {
+        return a.start != b.start ? a.start < b.start : a.leader < b.leader;
+    });
+
+    reg.assign(program.values.size(), 0);
+    typedef pair<pair<uint32_t, uint32_t>, uint32_t> Active;     // (end, start), register
+    priority_queue<Active, vector<Active>, greater<Active>> active;
+    priority_queue<uint32_t, vector<uint32_t>, greater<uint32_t>> free;
+    uint32_t registers = 1;
+    for (const ClassInterval& c : classes) {
+        while (!active.empty()) {
+            const Active& top = active.top();
+            uint32_t end = top.first.first;
+            uint32_t start = top.first.second;
+            if (end > c.start || (end == c.start && start == c.start)) {
+                break;
+            }
+            free.push(top.second);
+            active.pop();
+        }
+        uint32_t r;
+        if (free.empty()) {
+            r = registers++;
+        }
+        else {
+            r = free.top();
+            free.pop();
+        }
+        reg[c.leader] = r;
+        active.push({ { c.end, c.start }, r });
+    }
+    return registers;
+}
+
+// Parallel copies into the phis of a loop: arg 0 on entry, 1 at the latch.
+// A cycle is broken through the temporary register, constants are loaded
+// after all the copies.
+void IrLowering::emitMoves(uint32_t loop, int arg) {
+    vector<pair<uint32_t, uint32_t>> moves;     // destination, source
+    for (uint32_t v : program.blocks[program.loops[loop].header].code) {
+        const IrInstr& phi = program.values[v];
+        if (phi.op != IR_PHI) {
+            break;
+        }
+        uint32_t source = phi.args[arg];
+        if (!isConst(source) && r(source) != r(v)) {
+            moves.push_back({ r(v), r(source) });
+        }
+    }
+
+    while (!moves.empty()) {
+        bool progress = false;
+        for (size_t i = 0; i < moves.size(); i++) {
+            bool read = false;
+            for (size_t j = 0; j < moves.size() && !read; j++) {
+                read = j != i && moves[j].second == moves[i].first;
+            }
+            if (!read) {
+                emit(OPC_MOV, moves[i].first, moves[i].second);
+                moves.erase(moves.begin() + i);
+                progress = true;
+                break;
+            }
+        }
+        if (!progress) {
+            uint32_t source = moves[0].second;
+            emit(OPC_MOV, temp, source);
+            for (auto& move : moves) {
+                if (move.second == source) {
+                    move.second = temp;
+                }
+            }
+        }
+    }
+
+    for (uint32_t v : program.blocks[program.loops[loop].header].code) {
+        const IrInstr& phi = program.values[v];
+        if (phi.op != IR_PHI) {
+            break;
+        }
+        if (isConst(phi.args[arg])) {
+            emit(OPC_LOADK, r(v), immediate(program.values[phi.args[arg]].value));
+        }
+    }
+}
+
+void IrLowering::emitInstr(uint32_t v) {
+    const IrInstr& instr = program.values[v];
+    uint32_t a = instr.args[0];
+    uint32_t b = instr.args[1];
+
+    switch (instr.op) {
+    case IR_ADD:
+    case IR_SUB: {
+        bool add = instr.op == IR_ADD;
+        if (isConst(a) && isConst(b)) {
+            emit(OPC_LOADK, r(v), immediate(program.values[a].value));
+            emit(add ? OPC_ADDK : OPC_SUBK, r(v), r(v), immediate(program.values[b].value));
+        }
+        else if (isConst(b)) {
+            emit(add ? OPC_ADDK : OPC_SUBK, r(v), r(a), immediate(program.values[b].value));
+        }
+        else if (isConst(a) && add) {
+            emit(OPC_ADDK, r(v), r(b), immediate(program.values[a].value));
+        }
+        else if (isConst(a)) {
+            emit(OPC_LOADK, scratch, immediate(program.values[a].value));
+            emit(OPC_SUB, r(v), scratch, r(b));
+        }
+        else {
+            emit(add ? OPC_ADD : OPC_SUB, r(v), r(a), r(b));
+        }
+        break;
+    }
+    case IR_COPY:
+        if (isConst(a)) {
+            emit(OPC_LOADK, r(v), immediate(program.values[a].value));
+        }
+        else if (r(a) != r(v)) {
+            emit(OPC_MOV, r(v), r(a));
+        }
+        break;
+    case IR_PRINT:
+        if (isConst(a)) {
+            emit(OPC_LOADK, scratch, immediate(program.values[a].value));
+            emit(OPC_PRINT, scratch);
+        }
+        else {
+            emit(OPC_PRINT, r(a));
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void IrLowering::emitBranch(uint32_t loop, uint32_t target) {
+    const IrLoop& l = program.loops[loop];
+    bool less = l.compare == OP_LT;
+
+    if (isConst(l.left) && isConst(l.right)) {
+        int64_t left = program.values[l.left].value;
+        int64_t right = program.values[l.right].value;
+        if (less ? left < right : left > right) {
+            emit(OPC_JMP, 0, 0, target);
+        }
+    }
+    else if (isConst(l.left)) {
+        // k < E  is the same as  E > k
+        emit(less ? OPC_JGTK : OPC_JLTK, r(l.right), immediate(program.values[l.left].value), target);
+    }
+    else if (isConst(l.right)) {
+        emit(less ? OPC_JLTK : OPC_JGTK, r(l.left), immediate(program.values[l.right].value), target);
+    }
+    else {
+        emit(less ? OPC_JLT : OPC_JGT, r(l.left), r(l.right), target);
+    }
+}
+
+void IrLowering::lower(Bytecode& bytecode) {
+    number();
+    saveLatePhis();
+    number();
+    computeLiveness();
+    coalesce();
+    uint32_t registers = allocate();
+
+    out = &bytecode;
+    scratch = registers;
+    temp = registers + 1;
+    bytecode.code.clear();
+    bytecode.registerCount = registers + 2;
+
+    vector<uint32_t> loopStart(program.loops.size(), 0);
+    for (uint32_t b = 0; b < program.blocks.size(); b++) {
+        if (headerOf[b] != NO_LOOP) {
+            emitMoves(headerOf[b], 0);
+            loopStart[headerOf[b]] = static_cast<uint32_t>(bytecode.code.size());
+        }
+        for (uint32_t v : program.blocks[b].code) {
+            emitInstr(v);
+        }
+        if (latchOf[b] != NO_LOOP) {
+            uint32_t loop = latchOf[b];
+            emitMoves(loop, 1);
+            emitBranch(loop, loopStart[loop]);
+        }
+    }
+    emit(OPC_HALT, 0);
+}
+
+void lower_ir(const IrProgram& program, Bytecode& bytecode) {
+    IrLowering lowering(program);
+    lowering.lower(bytecode);
+}
@@ -0,0 +1,121 @@
+// ir.h
+#ifndef IR_H
+#define IR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ast.h"
+#include "tables.h"
+#include "vm.h"
+
+// SSA form of a program. Values are instructions, referenced by index.
+// Blocks are kept in program order and fall through to the next one;
+// the last block of a loop (its latch) ends with the loop condition and
+// jumps back to the first one (its header). Since a do-while body always
+// runs, a value dominates every instruction after it in this order.
+enum IrOp : uint8_t {
+    IR_CONST,       // value
+    IR_PHI,         // args[0] on entry to the loop, args[1] from the latch
+    IR_ADD,
+    IR_SUB,
+    IR_COPY,        // args[0]
+    IR_PRINT,       // print args[0], no value
+    IR_REMOVED
+};
+
+const uint32_t NO_LOOP = 0xFFFFFFFFu;
+
+struct IrInstr {
+    IrOp op;
+    uint32_t block;         // 0 for constants, which are not in any block
+    uint32_t var;           // identifier assigned this value, 0 if none (for printing)
+    int64_t value;          // IR_CONST, always within int32
+    uint32_t args[2];
+};
+
+struct IrBlock {
+    std::vector<uint32_t> code;     // phis first
+    uint32_t loop;                  // innermost loop, NO_LOOP at the top level
+};
+
+struct IrLoop {
+    uint32_t header;        // first and last block
+    uint32_t latch;
+    uint32_t parent;        // NO_LOOP at the top level
+    uint32_t end;           // loops are numbered in layout order, those up to end are inside this one
+    OpKind compare;         // loop again while left <compare> right
+    uint32_t left;
+    uint32_t right;
+};
+
+class IrProgram {
+public:
+    std::vector<IrInstr> values;
+    std::vector<IrBlock> blocks;
+    std::vector<IrLoop> loops;
+
+    uint32_t add(IrOp op, uint32_t block, uint32_t a = 0, uint32_t b = 0);
+    uint32_t constant(int64_t value);
+    size_t instructionCount() const;    // not counting removed ones
+    bool inLoop(uint32_t block, uint32_t loop) const;   // loop or a loop inside it
+    void clear();
+};
+
+// Builds the SSA form of an (optimized) parse tree. Assignments of an
+// identifier become copies, every identifier starts as the constant 0.
+// Loop bodies are walked with an explicit stack.
+class IrBuilder {
+private:
+    struct Frame {
+        NodeId id;              // a do-while
+        uint32_t next;          // next body statement
+        uint32_t loop;
+        size_t mark;            // of assigned, or of phis
+    };
+
+    const CompilationContext* context;
+    const AstArena* ast;
+    IrProgram* out;
+    uint32_t current;                   // block being filled
+    uint32_t currentLoop;
+    std::vector<uint32_t> defs;         // current value of each identifier
+    std::vector<uint32_t> constants;    // value of each constants table code, 0 if not made yet
+    std::vector<Frame> walk;
+    std::vector<uint32_t> phis;         // of the loops on the walk
+    std::vector<uint32_t> assigned;
+    std::vector<uint32_t> stamp;
+    uint32_t stampNow = 0;
+    std::vector<uint32_t> loopSets;     // identifiers assigned in each loop, back to back
+    std::vector<std::pair<size_t, size_t>> setBounds;
+    std::vector<NodeId> spine;
+
+    uint32_t newBlock(uint32_t loop);
+    void collectAssigned(NodeId root);
+    void statement(NodeId id);
+    void finishLoop(const Frame& frame);
+    uint32_t expression(NodeId id);
+    uint32_t operand(NodeId id);
+
+public:
+    void build(const CompilationContext& ctx, const AstArena& tree, NodeId root, IrProgram& program);
+};
+
+// Text form, with the identifier names of ctx
+void print_ir(const IrProgram& program, const CompilationContext& ctx, std::ostream& out);
+
+// Checks the SSA rules: every operand is defined before it is used, phis
+// come first in loop headers, loops nest. False with the first problem
+// in message.
+bool verify_ir(const IrProgram& program, std::string& message);
+
+// Register bytecode for the VM and the JIT. Values get registers by
+// linear scan over their live ranges; phis share a register with their
+// incoming values where the ranges allow, the others get copies at the
+// loop entry and the latch. Registers do not correspond to identifiers.
+void lower_ir(const IrProgram& program, Bytecode& bytecode);
+
+#endif
@@ -0,0 +1,336 @@
+// iropt.cpp
+#include "iropt.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "source.h"
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+void IrOptimizer::optimize(IrProgram& ir) {
+    program = &ir;
+    counts = IrStats();
+    counts.instructionsBefore = ir.instructionCount();
+
+    forward.resize(ir.values.size());
+    for (size_t v = 0; v < forward.size(); v++) {
+        forward[v] = static_cast<uint32_t>(v);
+    }
+    constants.clear();
+
+    bool changed = true;
+    while (changed) {
+        changed = propagateCopies();
+        changed = simplify() || changed;
+        rewrite();
+    }
+    hoistInvariants();
+    removeDead();
+
+    counts.instructionsAfter = ir.instructionCount();
+}
+
+uint32_t IrOptimizer::resolve(uint32_t v) {
+    while (forward[v] != v) {
+        forward[v] = forward[forward[v]];
+        v = forward[v];
+    }
+    return v;
+}
+
+// Constants are shared by value
+uint32_t IrOptimizer::constant(int64_t value) {
+    auto it = constants.find(value);
+    if (it != constants.end()) {
+        return it->second;
+    }
+    uint32_t id = program->constant(value);
+    forward.push_back(id);
+    constants.emplace(value, id);
+    return id;
+}
+
+void IrOptimizer::replace(uint32_t v, uint32_t by) {
+    forward[v] = by;
+    IrInstr& instr = program->values[v];
+    IrInstr& target = program->values[by];
+    // The replacement keeps the name of the identifier for print_ir
+    if (target.var == 0 && target.op != IR_CONST) {
+        target.var = instr.var;
+    }
+}
+
+// Copies are replaced by their source, and so are phis whose incoming
+// values are the same or the phi itself: the identifier is not really
+// changed in the loop. Repeated because a phi refers to later values.
+bool IrOptimizer::propagateCopies() {
+    bool any = false;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const IrBlock& block : program->blocks) {
+            for (uint32_t v : block.code) {
+                if (forward[v] != v) {
+                    continue;
+                }
+                const IrInstr& instr = program->values[v];
+                if (instr.op == IR_COPY) {
+                    replace(v, resolve(instr.args[0]));
+                }
+                else if (instr.op == IR_PHI) {
+                    uint32_t entry = resolve(instr.args[0]);
+                    uint32_t latch = resolve(instr.args[1]);
+                    if (latch != v && latch != entry) {
+                        continue;
+                    }
+                    replace(v, entry);
+                }
+                else {
+                    continue;
+                }
+                counts.copiesRemoved++;
+                changed = true;
+                any = true;
+            }
+        }
+    }
+    return any;
+}
+
+// Folds operations on constants whose result fits an immediate operand,
+// x + 0, 0 + x, x - 0 and x - x, and replaces an operation by an earlier
+// one on the same values
+bool IrOptimizer::simplify() {
+    bool any = false;
+    for (size_t v = 0; v < program->values.size(); v++) {
+        if (isConst(static_cast<uint32_t>(v)) && forward[v] == v) {
+            uint32_t c = constant(program->values[v].value);
+            if (c != v) {
+                forward[v] = c;
+            }
+        }
+    }
+
+    sums.clear();
+    differences.clear();
+    sums.reserve(program->values.size() / 4);
+    differences.reserve(program->values.size() / 4);
+    for (const IrBlock& block : program->blocks) {
+        for (uint32_t v : block.code) {
+            IrInstr& instr = program->values[v];
+            if (forward[v] != v || (instr.op != IR_ADD && instr.op != IR_SUB)) {
+                continue;
+            }
+            uint32_t a = resolve(instr.args[0]);
+            uint32_t b = resolve(instr.args[1]);
+            instr.args[0] = a;
+            instr.args[1] = b;
+            bool add = instr.op == IR_ADD;
+
+            uint32_t by = v;
+            if (isConst(a) && isConst(b)) {
+                int64_t x = program->values[a].value;
+                int64_t y = program->values[b].value;
+                int64_t result = add ? x + y : x - y;
+                if (result >= INT32_MIN && result <= INT32_MAX) {
+                    by = constant(result);
+                }
+            }
+            else if (isConst(b) && program->values[b].value == 0) {
+                by = a;
+            }
+            else if (add && isConst(a) && program->values[a].value == 0) {
+                by = b;
+            }
+            else if (!add && a == b) {
+                by = constant(0);
+            }
+            if (by != v) {
+                replace(v, by);
+                counts.constantsFolded++;
+                any = true;
+                continue;
+            }
+
+            // Operands are ordered for a sum, it commutes
+            if (add && a > b) {
+                swap(a, b);
+            }
+            uint64_t key = (static_cast<uint64_t>(a) << 32) | b;
+            auto& table = add ? sums : differences;
+            auto found = table.emplace(key, v);
+            if (!found.second) {
+                replace(v, found.first->second);
+                counts.expressionsReused++;
+                any = true;
+            }
+        }
+    }
+    return any;
+}
+
+// Points every operand at its replacement and drops replaced values
+void IrOptimizer::rewrite() {
+    for (IrBlock& block : program->blocks) {
+        size_t kept = 0;
+        for (uint32_t v : block.code) {
+            IrInstr& instr = program->values[v];
+            if (forward[v] != v) {
+                instr.op = IR_REMOVED;
+                continue;
+            }
+            instr.args[0] = resolve(instr.args[0]);
+            instr.args[1] = resolve(instr.args[1]);
+            block.code[kept++] = v;
+        }
+        block.code.resize(kept);
+    }
+    for (IrLoop& loop : program->loops) {
+        loop.left = resolve(loop.left);
+        loop.right = resolve(loop.right);
+    }
+}
+
+// An operation whose operands are all computed before a loop moves to
+// the block before its header, out of as many loops as it can. The body
+// of a do-while always runs, so this never computes anything extra.
+void IrOptimizer::hoistInvariants() {
+    for (uint32_t b = 0; b < program->blocks.size(); b++) {
+        IrBlock& block = program->blocks[b];
+        size_t kept = 0;
+        for (size_t i = 0; i < block.code.size(); i++) {
+            uint32_t v = block.code[i];
+            IrInstr& instr = program->values[v];
+            uint32_t target = b;
+            if (instr.op == IR_ADD || instr.op == IR_SUB) {
+                for (uint32_t l = block.loop; l != NO_LOOP; l = program->loops[l].parent) {
+                    bool invariant = true;
+                    for (uint32_t arg : instr.args) {
+                        if (!isConst(arg) && program->inLoop(program->values[arg].block, l)) {
+                            invariant = false;
+                        }
+                    }
+                    if (!invariant) {
+                        break;
+                    }
+                    target = program->loops[l].header - 1;
+                }
+            }
+            if (target == b) {
+                block.code[kept++] = v;
+                continue;
+            }
+            // The block before a header comes earlier, it is not being filled
+            instr.block = target;
+            program->blocks[target].code.push_back(v);
+            counts.invariantsHoisted++;
+        }
+        block.code.resize(kept);
+    }
+}
+
+// Only printed values and loop conditions are observable; everything
+// they do not depend on goes, including identifiers stored and never read
+void IrOptimizer::removeDead() {
+    vector<bool> needed(program->values.size(), false);
+    vector<uint32_t> work;
+    auto mark = [&](uint32_t v) {
+        if (!needed[v]) {
+            needed[v] = true;
+            work.push_back(v);
+        }
+    };
+
+    for (const IrBlock& block : program->blocks) {
+        for (uint32_t v : block.code) {
+            if (program->values[v].op == IR_PRINT) {
+                mark(v);
+            }
+        }
+    }
+    for (const IrLoop& loop : program->loops) {
+        mark(loop.left);
+        mark(loop.right);
+    }
+    while (!work.empty()) {
+        uint32_t v = work.back();
+        work.pop_back();
+        const IrInstr& instr = program->values[v];
+        switch (instr.op) {
+        case IR_PHI:
+        case IR_ADD:
+        case IR_SUB:
+            mark(instr.args[0]);
+            mark(instr.args[1]);
+            break;
+        case IR_COPY:
+        case IR_PRINT:
+            mark(instr.args[0]);
+            break;
+        default:
+            break;
+        }
+    }
+
+    for (IrBlock& block : program->blocks) {
+        size_t kept = 0;
+        for (uint32_t v : block.code) {
+            if (needed[v]) {
+                block.code[kept++] = v;
+            }
+            else {
+                program->values[v].op = IR_REMOVED;
+                counts.deadRemoved++;
+            }
+        }
+        block.code.resize(kept);
+    }
+}
+
+int emit_ir_main(const string& path) {
+    MappedFile file;
+    if (!file.open(path)) {
+        cerr << "Error: " << file.error() << endl;
+        return 2;
+    }
+
+    CompilationContext context;
+    Lexer lexer(context, file.text());
+    Parser parser(lexer);
+    if (!parser.parse()) {
+        parser.printErrors();
+        return 1;
+    }
+
+    AstArena optimized;
+    Optimizer optimizer;
+    NodeId root = optimizer.optimize(context, parser.getAst(), parser.getParseTree(), optimized);
+
+    IrProgram ir;
+    IrBuilder builder;
+    builder.build(context, optimized, root, ir);
+    cout << "=== SSA FORM ===" << endl;
+    print_ir(ir, context, cout);
+
+    IrOptimizer passes;
+    passes.optimize(ir);
+    string message;
+    if (!verify_ir(ir, message)) {
+        cerr << "Error: invalid IR after optimization: " << message << endl;
+        return 3;
+    }
+    const IrStats& stats = passes.stats();
+    cout << "\n=== OPTIMIZED ===" << endl;
+    print_ir(ir, context, cout);
+    cout << "\n" << stats.instructionsBefore << " -> " << stats.instructionsAfter << " instructions: "
+        << stats.copiesRemoved << " copies, " << stats.constantsFolded << " folded, "
+        << stats.expressionsReused << " reused, " << stats.invariantsHoisted << " hoisted, "
+        << stats.deadRemoved << " dead" << endl;
+
+    Bytecode bytecode;
+    lower_ir(ir, bytecode);
+    cout << "\n=== BYTECODE ===" << endl;
+    print_bytecode(bytecode);
+    return 0;
+}
@@ -0,0 +1,54 @@
+// iropt.h
+#ifndef IROPT_H
+#define IROPT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ir.h"
+
+struct IrStats {
+    size_t instructionsBefore;
+    size_t instructionsAfter;
+    size_t copiesRemoved;       // copies and phis with one incoming value
+    size_t constantsFolded;     // operations on constants, x + 0, x - x
+    size_t expressionsReused;   // the same operation on the same values
+    size_t invariantsHoisted;   // operations moved out of a loop
+    size_t deadRemoved;         // values never printed nor compared, dead stores
+};
+
+// Passes over the SSA form, until none of them finds anything more:
+// copy propagation, constant folding with common subexpression
+// elimination, loop invariant code motion and dead code elimination.
+// Values are only replaced by values computed earlier in layout order,
+// which always dominate them because do-while bodies run at least once.
+class IrOptimizer {
+private:
+    IrProgram* program;
+    IrStats counts;
+    std::vector<uint32_t> forward;      // value replacing each value, itself if kept
+    std::unordered_map<int64_t, uint32_t> constants;
+    std::unordered_map<uint64_t, uint32_t> sums, differences;
+
+    uint32_t resolve(uint32_t v);
+    uint32_t constant(int64_t value);
+    bool isConst(uint32_t v) const { return program->values[v].op == IR_CONST; }
+    void replace(uint32_t v, uint32_t by);
+    bool propagateCopies();
+    bool simplify();
+    void rewrite();
+    void hoistInvariants();
+    void removeDead();
+
+public:
+    void optimize(IrProgram& ir);
+    const IrStats& stats() const { return counts; }
+};
+
+// YPMT1 --emit-ir path: prints the SSA form as built and as optimized,
+// and the bytecode it lowers to
+int emit_ir_main(const std::string& path);
+
+#endif
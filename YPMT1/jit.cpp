@@ -0,0 +1,456 @@
+// jit.cpp
+#include "jit.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef JIT_X86_64
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+using namespace std;
+
+JitProgram::~JitProgram() {
+    release();
+}
+
+void JitProgram::release() {
+#ifdef JIT_X86_64
+    if (code) {
+#ifdef _WIN32
+        VirtualFree(code, 0, MEM_RELEASE);
+#else
+        munmap(code, codeSize);
+#endif
+    }
+#endif
+    code = nullptr;
+    codeSize = 0;
+    entry = nullptr;
+}
+
+VmStatus JitProgram::run(OutputBuffer& out, uint64_t maxIterations) {
+    if (!entry) {
+        return vm.run(program, out, maxIterations);
+    }
+
+    registers.assign(program.registerCount, 0);
+    JitContext context = { &out, maxIterations ? maxIterations : UINT64_MAX };
+    uint64_t left = entry(registers.data(), &context);
+    iterations = context.budget - left;
+    return left == 0 ? VM_LOOP_LIMIT : VM_OK;
+}
+
+#ifndef JIT_X86_64
+
+bool JitProgram::compile(const Bytecode& bytecode) {
+    release();
+    program = bytecode;
+    return false;
+}
+
+#else
+
+namespace {
+
+enum Reg {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// rbx points to the register array, r11 counts down the loop budget,
+// rax is scratch. Homes are the machine registers that hold bytecode
+// registers; the caller-saved ones are saved around calls.
+#ifdef _WIN32
+const Reg ARG0 = RCX, ARG1 = RDX;
+const Reg SAVED[] = { RBX, RBP, RDI, RSI, R12, R13, R14, R15 };
+const Reg HOMES[] = { RBP, RSI, RDI, R12, R13, R14, R15, R8, R9, R10 };
+const size_t CALLEE_SAVED_HOMES = 7;
+#else
+const Reg ARG0 = RDI, ARG1 = RSI;
+const Reg SAVED[] = { RBX, RBP, R12, R13, R14, R15 };
+const Reg HOMES[] = { RBP, R12, R13, R14, R15, RSI, RDI, R8, R9, R10 };
+const size_t CALLEE_SAVED_HOMES = 5;
+#endif
+const size_t HOME_COUNT = sizeof(HOMES) / sizeof(HOMES[0]);
+const size_t SAVED_COUNT = sizeof(SAVED) / sizeof(SAVED[0]);
+
+// Stack frame: 32 bytes of shadow space for calls, slots for the
+// caller-saved homes and r11, the context pointer. The size keeps rsp
+// 16-byte aligned at calls with either number of pushes.
+const int32_t SPILL_SLOTS = 32;
+const int32_t CONTEXT_SLOT = 96;
+const int32_t FRAME_SIZE = 104;
+
+enum Cond : uint8_t {
+    CC_Z = 0x4, CC_NZ = 0x5, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF
+};
+
+// A bytecode register: in a machine register, or in memory at [base + disp]
+struct Loc {
+    int reg;        // -1 if in memory
+    Reg base;
+    int32_t disp;
+};
+
+static Loc inReg(int reg) {
+    return { reg, RAX, 0 };
+}
+
+static Loc inMemory(Reg base, int32_t disp) {
+    return { -1, base, disp };
+}
+
+static void jit_print(OutputBuffer* out, int64_t value) {
+    out->printValue(value);
+}
+
+class X64Emitter {
+public:
+    vector<uint8_t> bytes;
+
+    size_t size() const { return bytes.size(); }
+    void byte(uint8_t b) { bytes.push_back(b); }
+    void dword(uint32_t value) {
+        for (int i = 0; i < 4; i++) byte(static_cast<uint8_t>(value >> (8 * i)));
+    }
+    void qword(uint64_t value) {
+        for (int i = 0; i < 8; i++) byte(static_cast<uint8_t>(value >> (8 * i)));
+    }
+    void patch(size_t at, uint32_t value) {
+        for (int i = 0; i < 4; i++) bytes[at + i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+
+    // 64-bit op with a register (or /digit) and a register or memory operand
+    void op(uint8_t opcode, int reg, const Loc& rm) {
+        int base = rm.reg >= 0 ? rm.reg : rm.base;
+        byte(static_cast<uint8_t>(0x48 | ((reg >> 3) & 1) << 2 | ((base >> 3) & 1)));
+        byte(opcode);
+        if (rm.reg >= 0) {
+            byte(static_cast<uint8_t>(0xC0 | (reg & 7) << 3 | (base & 7)));
+            return;
+        }
+        byte(static_cast<uint8_t>(0x80 | (reg & 7) << 3 | (base & 7)));   // [base + disp32]
+        if ((base & 7) == RSP) {
+            byte(0x24);     // SIB: no index
+        }
+        dword(static_cast<uint32_t>(rm.disp));
+    }
+
+    void load(int reg, const Loc& from) {
+        if (from.reg != reg) op(0x8B, reg, from);
+    }
+    void store(const Loc& to, int reg) {
+        if (to.reg != reg) op(0x89, reg, to);
+    }
+    void move(const Loc& to, const Loc& from) {
+        if (to.reg >= 0) {
+            load(to.reg, from);
+        }
+        else if (from.reg >= 0) {
+            store(to, from.reg);
+        }
+        else if (to.base != from.base || to.disp != from.disp) {
+            load(RAX, from);
+            store(to, RAX);
+        }
+    }
+    void loadImmediate(const Loc& to, int32_t value) {      // sign-extended
+        op(0xC7, 0, to);
+        dword(static_cast<uint32_t>(value));
+    }
+    // add (0), sub (5) or cmp (7) with a sign-extended immediate
+    void arithImmediate(uint8_t digit, const Loc& rm, int32_t value) {
+        op(0x81, digit, rm);
+        dword(static_cast<uint32_t>(value));
+    }
+
+    void push(Reg reg) {
+        if (reg >= R8) byte(0x41);
+        byte(static_cast<uint8_t>(0x50 + (reg & 7)));
+    }
+    void pop(Reg reg) {
+        if (reg >= R8) byte(0x41);
+        byte(static_cast<uint8_t>(0x58 + (reg & 7)));
+    }
+    void stackAdjust(uint8_t digit, int32_t amount) {   // 0 = add, 5 = sub
+        arithImmediate(digit, inReg(RSP), amount);
+    }
+    // Jumps with a rel32 operand to fill in later; return its position
+    size_t jump() {
+        byte(0xE9);
+        dword(0);
+        return size() - 4;
+    }
+    size_t jump(Cond cond) {
+        byte(0x0F);
+        byte(static_cast<uint8_t>(0x80 | cond));
+        dword(0);
+        return size() - 4;
+    }
+    void bind(size_t at, size_t target) {
+        patch(at, static_cast<uint32_t>(static_cast<int32_t>(target) - static_cast<int32_t>(at + 4)));
+    }
+    void decCounter() {     // dec r11
+        byte(0x49);
+        byte(0xFF);
+        byte(0xCB);
+    }
+    void call(const void* function) {
+        byte(0x48);         // mov rax, imm64
+        byte(0xB8);
+        qword(reinterpret_cast<uint64_t>(function));
+        byte(0xFF);         // call rax
+        byte(0xD0);
+    }
+};
+
+// Machine registers for the bytecode registers used most, counting
+// every use inside a loop 8 times per loop level
+static vector<int> assignHomes(const Bytecode& program) {
+    size_t n = program.code.size();
+    vector<int> depth(n + 1, 0);
+    for (size_t i = 0; i < n; i++) {
+        const Instr& in = program.code[i];
+        bool jump = in.op >= OPC_JLT && in.op <= OPC_JMP;
+        if (jump && in.c <= i) {
+            depth[in.c]++;
+            depth[i + 1]--;
+        }
+    }
+
+    vector<uint64_t> weight(program.registerCount, 0);
+    int level = 0;
+    for (size_t i = 0; i < n; i++) {
+        level += depth[i];
+        uint64_t w = uint64_t(1) << (3 * min(level, 16));
+        const Instr& in = program.code[i];
+        switch (in.op) {
+        case OPC_MOV: weight[in.a] += w; weight[in.b] += w; break;
+        case OPC_LOADK: weight[in.a] += w; break;
+        case OPC_ADD:
+        case OPC_SUB: weight[in.a] += w; weight[in.b] += w; weight[in.c] += w; break;
+        case OPC_ADDK:
+        case OPC_SUBK: weight[in.a] += w; weight[in.b] += w; break;
+        case OPC_JLT:
+        case OPC_JGT: weight[in.a] += w; weight[in.b] += w; break;
+        case OPC_JLTK:
+        case OPC_JGTK:
+        case OPC_PRINT: weight[in.a] += w; break;
+        default: break;
+        }
+    }
+
+    vector<uint32_t> order;
+    for (uint32_t r = 0; r < program.registerCount; r++) {
+        if (weight[r] > 0) order.push_back(r);
+    }
+    stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return weight[a] > weight[b]; });
+
+    vector<int> home(program.registerCount, -1);
+    for (size_t k = 0; k < order.size() && k < HOME_COUNT; k++) {
+        home[order[k]] = static_cast<int>(k);
+    }
+    return home;
+}
+
+} // namespace
+
+bool JitProgram::compile(const Bytecode& bytecode) {
+    release();
+    program = bytecode;
+
+    vector<int> home = assignHomes(program);
+    auto loc = [&](uint32_t r) {
+        return home[r] >= 0 ? inReg(HOMES[home[r]]) : inMemory(RBX, static_cast<int32_t>(8 * r));
+    };
+    vector<uint32_t> homed;     // bytecode registers in machine registers
+    for (uint32_t r = 0; r < program.registerCount; r++) {
+        if (home[r] >= 0) homed.push_back(r);
+    }
+
+    X64Emitter x;
+    for (Reg reg : SAVED) {
+        x.push(reg);
+    }
+    x.stackAdjust(5, FRAME_SIZE);
+    x.load(RBX, inReg(ARG0));
+    x.store(inMemory(RSP, CONTEXT_SLOT), ARG1);
+    x.load(R11, inMemory(ARG1, offsetof(JitContext, budget)));
+    for (uint32_t r : homed) {
+        x.load(HOMES[home[r]], inMemory(RBX, static_cast<int32_t>(8 * r)));
+    }
+
+    // Jumps to bytecode targets and to the exit, patched at the end
+    vector<size_t> start(program.code.size() + 1);
+    vector<pair<size_t, uint32_t>> targets;
+    vector<size_t> exits;
+
+    auto arith = [&](const Instr& in, bool sub) {
+        Loc a = loc(in.a), b = loc(in.b), c = loc(in.c);
+        if (in.a == in.c && (sub || in.a == in.b)) {
+            x.load(RAX, b);
+            x.op(sub ? 0x2B : 0x03, RAX, c);
+            x.store(a, RAX);
+            return;
+        }
+        if (in.a == in.c) {
+            swap(b, c);     // a = c + a
+        }
+        if (a.reg >= 0) {
+            x.load(a.reg, b);
+            x.op(sub ? 0x2B : 0x03, a.reg, c);      // reg -= / += r/m
+        }
+        else {
+            x.move(a, b);
+            if (c.reg < 0) {
+                x.load(RAX, c);
+                c = inReg(RAX);
+            }
+            x.op(sub ? 0x29 : 0x01, c.reg, a);      // r/m -= / += reg
+        }
+    };
+
+    // Taken jumps count down the budget like the interpreter
+    auto branch = [&](Cond cond, uint32_t target) {
+        size_t skip = x.jump(static_cast<Cond>(cond ^ 1));
+        x.decCounter();
+        targets.push_back({ x.jump(CC_NZ), target });
+        exits.push_back(x.jump());
+        x.bind(skip, x.size());
+    };
+
+    for (size_t i = 0; i < program.code.size(); i++) {
+        start[i] = x.size();
+        const Instr& in = program.code[i];
+        int32_t imm = static_cast<int32_t>(in.op == OPC_LOADK || in.op == OPC_JLTK || in.op == OPC_JGTK ? in.b : in.c);
+
+        switch (in.op) {
+        case OPC_MOV:
+            x.move(loc(in.a), loc(in.b));
+            break;
+        case OPC_LOADK:
+            x.loadImmediate(loc(in.a), imm);
+            break;
+        case OPC_ADD:
+        case OPC_SUB:
+            arith(in, in.op == OPC_SUB);
+            break;
+        case OPC_ADDK:
+        case OPC_SUBK:
+            x.move(loc(in.a), loc(in.b));
+            x.arithImmediate(in.op == OPC_ADDK ? 0 : 5, loc(in.a), imm);
+            break;
+        case OPC_JLT:
+        case OPC_JGT: {
+            Loc a = loc(in.a), b = loc(in.b);
+            if (a.reg < 0 && b.reg < 0) {
+                x.load(RAX, a);
+                a = inReg(RAX);
+            }
+            if (a.reg >= 0) {
+                x.op(0x3B, a.reg, b);   // cmp a, b
+            }
+            else {
+                x.op(0x39, b.reg, a);   // cmp a, b with a in memory
+            }
+            branch(in.op == OPC_JLT ? CC_L : CC_G, in.c);
+            break;
+        }
+        case OPC_JLTK:
+        case OPC_JGTK:
+            x.arithImmediate(7, loc(in.a), imm);
+            branch(in.op == OPC_JLTK ? CC_L : CC_G, in.c);
+            break;
+        case OPC_JMP:
+            x.decCounter();
+            targets.push_back({ x.jump(CC_NZ), in.c });
+            exits.push_back(x.jump());
+            break;
+        case OPC_PRINT: {
+            int32_t slot = SPILL_SLOTS;
+            for (uint32_t r : homed) {
+                if (static_cast<size_t>(home[r]) >= CALLEE_SAVED_HOMES) {
+                    x.store(inMemory(RSP, slot), HOMES[home[r]]);
+                    slot += 8;
+                }
+            }
+            x.store(inMemory(RSP, slot), R11);
+
+            x.load(RAX, loc(in.a));
+            x.load(ARG1, inReg(RAX));
+            x.load(ARG0, inMemory(RSP, CONTEXT_SLOT));
+            x.load(ARG0, inMemory(ARG0, offsetof(JitContext, out)));
+            x.call(reinterpret_cast<const void*>(&jit_print));
+
+            slot = SPILL_SLOTS;
+            for (uint32_t r : homed) {
+                if (static_cast<size_t>(home[r]) >= CALLEE_SAVED_HOMES) {
+                    x.load(HOMES[home[r]], inMemory(RSP, slot));
+                    slot += 8;
+                }
+            }
+            x.load(R11, inMemory(RSP, slot));
+            break;
+        }
+        case OPC_HALT:
+            exits.push_back(x.jump());
+            break;
+        }
+    }
+    start[program.code.size()] = x.size();
+
+    // Exit: registers go back to the array, the budget left is returned
+    size_t exit = x.size();
+    for (uint32_t r : homed) {
+        x.store(inMemory(RBX, static_cast<int32_t>(8 * r)), HOMES[home[r]]);
+    }
+    x.load(RAX, inReg(R11));
+    x.stackAdjust(0, FRAME_SIZE);
+    for (size_t i = SAVED_COUNT; i-- > 0;) {
+        x.pop(SAVED[i]);
+    }
+    x.byte(0xC3);   // ret
+
+    for (const auto& t : targets) {
+        x.bind(t.first, start[t.second]);
+    }
+    for (size_t at : exits) {
+        x.bind(at, exit);
+    }
+
+    // Written while the pages are writable, then made executable
+#ifdef _WIN32
+    void* pages = VirtualAlloc(nullptr, x.size(), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!pages) {
+        return false;
+    }
+    memcpy(pages, x.bytes.data(), x.size());
+    DWORD old;
+    if (!VirtualProtect(pages, x.size(), PAGE_EXECUTE_READ, &old)) {
+        VirtualFree(pages, 0, MEM_RELEASE);
+        return false;
+    }
+    FlushInstructionCache(GetCurrentProcess(), pages, x.size());
+#else
+    void* pages = mmap(nullptr, x.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pages == MAP_FAILED) {
+        return false;
+    }
+    memcpy(pages, x.bytes.data(), x.size());
+    if (mprotect(pages, x.size(), PROT_READ | PROT_EXEC) != 0) {
+        munmap(pages, x.size());
+        return false;
+    }
+#endif
+
+    code = pages;
+    codeSize = x.size();
+    entry = reinterpret_cast<Entry>(pages);
+    return true;
+}
+
+#endif
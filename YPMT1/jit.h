@@ -0,0 +1,56 @@
+// jit.h
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "vm.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define JIT_X86_64 1
+#endif
+
+// Arguments of the generated code
+struct JitContext {
+    OutputBuffer* out;
+    uint64_t budget;        // backward jumps left before the loop limit
+};
+
+// Native x86-64 code for a bytecode program. The most used registers,
+// weighted by loop depth, live in machine registers for the whole run;
+// the others stay in the register array. print calls the buffered
+// output routine. Where there is no x86-64 code generator, run()
+// interprets the bytecode instead.
+class JitProgram {
+private:
+    typedef uint64_t (*Entry)(int64_t* registers, JitContext* context);
+
+    Bytecode program;           // for the interpreter fallback
+    Entry entry = nullptr;
+    void* code = nullptr;       // executable pages
+    size_t codeSize = 0;
+    std::vector<int64_t> registers;
+    uint64_t iterations = 0;
+    Vm vm;
+
+    void release();
+
+public:
+    JitProgram() {}
+    JitProgram(const JitProgram&) = delete;
+    JitProgram& operator=(const JitProgram&) = delete;
+    ~JitProgram();
+
+    // Generates native code; false if the program will be interpreted
+    bool compile(const Bytecode& bytecode);
+    // Same contract as Vm::run
+    VmStatus run(OutputBuffer& out, uint64_t maxIterations = 0);
+
+    bool native() const { return entry != nullptr; }
+    size_t nativeSize() const { return codeSize; }
+    int64_t reg(uint32_t index) const { return entry ? registers[index] : vm.reg(index); }
+    uint64_t iterationCount() const { return entry ? iterations : vm.iterationCount(); }
+};
+
+#endif
@@ -0,0 +1,271 @@
+// language.h
+#ifndef LANGUAGE_H
+#define LANGUAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include "ast.h"
+#include "scanner.h"
+
+// The language in one place: keywords, operators and the grammar. The
+// scanner's keyword hash and operator bytes, the parser's predict table
+// and the names in diagnostics are all computed from these tables at
+// compile time.
+
+// Codes of TOKEN_WORD tokens, in the order of WORDS
+enum WordCode : int {
+    WORD_NONE,
+    WORD_DO,
+    WORD_WHILE,
+    WORD_PRINT,
+    WORD_ASSIGN,        // =
+    WORD_LESS,          // <
+    WORD_GREATER,       // >
+    WORD_PLUS,          // +
+    WORD_MINUS,         // -
+    WORD_SEMICOLON,     // ;
+    WORD_COUNT
+};
+
+struct WordSpec {
+    std::string_view spelling;  // keywords are letters, operators one other byte
+    OpKind op;                  // of a comparison or an additive operator
+};
+
+constexpr WordSpec WORDS[WORD_COUNT] = {
+    { "", OP_NONE },
+    { "do", OP_NONE },
+    { "while", OP_NONE },
+    { "print", OP_NONE },
+    { "=", OP_NONE },
+    { "<", OP_LT },
+    { ">", OP_GT },
+    { "+", OP_ADD },
+    { "-", OP_SUB },
+    { ";", OP_NONE },
+};
+
+constexpr bool is_letter(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+constexpr bool is_keyword(int code) {
+    return code > WORD_NONE && code < WORD_COUNT && is_letter(WORDS[code].spelling[0]);
+}
+
+constexpr bool is_operator(int code) {
+    return code > WORD_NONE && code < WORD_COUNT && !is_letter(WORDS[code].spelling[0]);
+}
+
+constexpr OpKind word_op(int code) {
+    return code > WORD_NONE && code < WORD_COUNT ? WORDS[code].op : OP_NONE;
+}
+
+constexpr bool is_relation(OpKind op) { return op == OP_LT || op == OP_GT; }
+constexpr bool is_additive(OpKind op) { return op == OP_ADD || op == OP_SUB; }
+
+// Operator byte -> code, 0 for bytes that are not operators
+struct OperatorTable {
+    uint8_t code[256];
+};
+
+constexpr OperatorTable makeOperatorTable() {
+    OperatorTable t{};
+    for (int code = WORD_NONE + 1; code < WORD_COUNT; code++) {
+        if (is_operator(code)) {
+            t.code[static_cast<uint8_t>(WORDS[code].spelling[0])] = static_cast<uint8_t>(code);
+        }
+    }
+    return t;
+}
+
+constexpr OperatorTable OPERATORS = makeOperatorTable();
+
+// Keywords by a perfect hash of their first and last letters and length.
+// The multiplier is searched for at compile time, so a new keyword only
+// has to be added to WORDS.
+struct KeywordTable {
+    static const size_t SLOTS = 16;
+    uint32_t multiplier;
+    size_t minLength, maxLength;
+    uint8_t code[SLOTS];        // WORD_NONE in empty slots
+
+    static constexpr size_t slot(std::string_view word, uint32_t multiplier) {
+        uint32_t first = static_cast<uint8_t>(word.front());
+        uint32_t last = static_cast<uint8_t>(word.back());
+        return (first * multiplier + last + static_cast<uint32_t>(word.size())) % SLOTS;
+    }
+};
+
+constexpr KeywordTable makeKeywordTable() {
+    for (uint32_t multiplier = 1; multiplier < 256; multiplier++) {
+        KeywordTable t{};
+        t.multiplier = multiplier;
+        t.minLength = SIZE_MAX;
+        bool collision = false;
+        for (int code = WORD_NONE + 1; code < WORD_COUNT && !collision; code++) {
+            if (!is_keyword(code)) {
+                continue;
+            }
+            std::string_view word = WORDS[code].spelling;
+            size_t s = KeywordTable::slot(word, multiplier);
+            collision = t.code[s] != WORD_NONE;
+            t.code[s] = static_cast<uint8_t>(code);
+            t.minLength = word.size() < t.minLength ? word.size() : t.minLength;
+            t.maxLength = word.size() > t.maxLength ? word.size() : t.maxLength;
+        }
+        if (!collision) {
+            return t;
+        }
+    }
+    return KeywordTable{};
+}
+
+constexpr KeywordTable KEYWORDS = makeKeywordTable();
+static_assert(KEYWORDS.multiplier != 0, "no perfect hash for the keywords, enlarge KeywordTable::SLOTS");
+
+// Keyword code of word, WORD_NONE if it is not one
+constexpr int keyword_code(std::string_view word) {
+    if (word.size() < KEYWORDS.minLength || word.size() > KEYWORDS.maxLength) {
+        return WORD_NONE;
+    }
+    int code = KEYWORDS.code[KeywordTable::slot(word, KEYWORDS.multiplier)];
+    return WORDS[code].spelling == word ? code : WORD_NONE;
+}
+
+// Terminals of the grammar: the words by code, then the other token kinds
+enum : int {
+    TERM_ID = WORD_COUNT,
+    TERM_DIG,
+    TERM_END,
+    TERMINAL_COUNT
+};
+
+constexpr int terminal_of(TokenTypeEnum type, int code) {
+    switch (type) {
+    case TOKEN_ID: return TERM_ID;
+    case TOKEN_DIG: return TERM_DIG;
+    case TOKEN_WORD: return code > WORD_NONE && code < WORD_COUNT ? code : WORD_NONE;
+    default: return TERM_END;
+    }
+}
+
+enum Nonterminal : uint8_t {
+    NT_S,
+    NT_B,
+    NT_E,
+    NT_T,
+    NT_COUNT
+};
+
+// A symbol of a right-hand side: a terminal, or NONTERMINAL + Nonterminal
+const int NONTERMINAL = TERMINAL_COUNT;
+const int END_OF_RULE = -1;
+
+enum Production : uint8_t {
+    PROD_NONE,
+    PROD_DO_WHILE,      // S → do S{;S} while B
+    PROD_ASSIGN,        // S → id = E
+    PROD_PRINT,         // S → print id
+    PROD_RELATION,      // B → E < E | E > E
+    PROD_SUM,           // E → T {+T | -T}
+    PROD_ID,            // T → id
+    PROD_NUM,           // T → num
+    PROD_COUNT
+};
+
+// Repetitions and alternatives inside a production are handled by the
+// parser; the predict table only needs the leading symbols, and no
+// production derives the empty string.
+struct ProductionSpec {
+    Nonterminal left;
+    int right[2];       // first symbols, END_OF_RULE after the last
+};
+
+constexpr ProductionSpec GRAMMAR[PROD_COUNT] = {
+    { NT_COUNT, { END_OF_RULE } },
+    { NT_S, { WORD_DO, NONTERMINAL + NT_S } },
+    { NT_S, { TERM_ID, WORD_ASSIGN } },
+    { NT_S, { WORD_PRINT, TERM_ID } },
+    { NT_B, { NONTERMINAL + NT_E, END_OF_RULE } },
+    { NT_E, { NONTERMINAL + NT_T, END_OF_RULE } },
+    { NT_T, { TERM_ID, END_OF_RULE } },
+    { NT_T, { TERM_DIG, END_OF_RULE } },
+};
+
+// predict[nonterminal][terminal]: the production to expand, PROD_NONE
+// where the terminal cannot start the nonterminal
+struct PredictTable {
+    uint8_t predict[NT_COUNT][TERMINAL_COUNT];
+    bool conflict;
+};
+
+constexpr PredictTable makePredictTable() {
+    // FIRST sets of the nonterminals, to a fixed point
+    bool first[NT_COUNT][TERMINAL_COUNT] = {};
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (int p = PROD_NONE + 1; p < PROD_COUNT; p++) {
+            int lead = GRAMMAR[p].right[0];
+            for (int t = 0; t < TERMINAL_COUNT; t++) {
+                bool starts = lead < NONTERMINAL ? t == lead : first[lead - NONTERMINAL][t];
+                if (starts && !first[GRAMMAR[p].left][t]) {
+                    first[GRAMMAR[p].left][t] = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    PredictTable table{};
+    for (int p = PROD_NONE + 1; p < PROD_COUNT; p++) {
+        int lead = GRAMMAR[p].right[0];
+        for (int t = 0; t < TERMINAL_COUNT; t++) {
+            bool starts = lead < NONTERMINAL ? t == lead : first[lead - NONTERMINAL][t];
+            if (!starts) {
+                continue;
+            }
+            uint8_t& entry = table.predict[GRAMMAR[p].left][t];
+            table.conflict = table.conflict || entry != PROD_NONE;
+            entry = static_cast<uint8_t>(p);
+        }
+    }
+    return table;
+}
+
+constexpr PredictTable PREDICT = makePredictTable();
+static_assert(!PREDICT.conflict, "the grammar is not LL(1)");
+
+constexpr Production predict(Nonterminal nonterminal, TokenTypeEnum type, int code) {
+    return static_cast<Production>(PREDICT.predict[nonterminal][terminal_of(type, code)]);
+}
+
+// Quoted spellings for diagnostics: 'do', '='
+struct WordNames {
+    static const size_t MAX = 16;
+    char text[WORD_COUNT][MAX];
+};
+
+constexpr WordNames makeWordNames() {
+    WordNames names{};
+    for (int code = WORD_NONE + 1; code < WORD_COUNT; code++) {
+        std::string_view spelling = WORDS[code].spelling;
+        size_t n = 0;
+        names.text[code][n++] = '\'';
+        for (size_t i = 0; i < spelling.size() && n + 2 < WordNames::MAX; i++) {
+            names.text[code][n++] = spelling[i];
+        }
+        names.text[code][n++] = '\'';
+    }
+    return names;
+}
+
+constexpr WordNames WORD_NAMES = makeWordNames();
+
+// Name of a word in diagnostics, "operator" for unknown codes
+constexpr const char* word_name(int code) {
+    return code > WORD_NONE && code < WORD_COUNT ? WORD_NAMES.text[code] : "operator";
+}
+
+#endif
@@ -0,0 +1,285 @@
+// optimizer.cpp
+#include "optimizer.h"
+#include <cstdint>
+
+using namespace std;
+
+// Arithmetic wraps around like the machine registers do
+static inline int64_t wrapAdd(int64_t a, int64_t b) {
+    return static_cast<int64_t>(static_cast<uint64_t>(a) + static_cast<uint64_t>(b));
+}
+
+static inline int64_t wrapSub(int64_t a, int64_t b) {
+    return static_cast<int64_t>(static_cast<uint64_t>(a) - static_cast<uint64_t>(b));
+}
+
+static size_t countNodes(const AstArena& ast, NodeId root) {
+    vector<NodeId> pending(1, root);
+    size_t count = 0;
+    while (!pending.empty()) {
+        NodeId id = pending.back();
+        pending.pop_back();
+        count++;
+        const NodeId* kids = ast.childrenOf(id);
+        pending.insert(pending.end(), kids, kids + ast[id].childCount);
+    }
+    return count;
+}
+
+NodeId Optimizer::optimize(CompilationContext& ctx, const AstArena& tree, NodeId root, AstArena& result) {
+    context = &ctx;
+    in = &tree;
+    out = &result;
+    counts = OptimizeStats();
+    result.reset();
+    if (root == NO_NODE) {
+        return NO_NODE;
+    }
+
+    counts.nodesBefore = countNodes(tree, root);
+    coefficients.assign(ctx.identifiers.size() + 1, 0);
+    statements.clear();
+    loops.clear();
+    optimizeStatement(root, false);
+    while (!loops.empty()) {
+        LoopFrame& frame = loops.back();
+        const AstNode& node = (*in)[frame.id];
+        if (frame.next + 1 < node.childCount) {
+            optimizeStatement(in->child(frame.id, frame.next++), true);
+            continue;
+        }
+        LoopFrame done = frame;
+        loops.pop_back();
+        finishLoop(done);
+    }
+
+    counts.nodesAfter = result.size();
+    return statements.back();
+}
+
+// Appends the optimized statement to statements. A do-while only gets
+// its frame, optimize() walks the body and calls finishLoop().
+void Optimizer::optimizeStatement(NodeId id, bool inBody) {
+    const AstNode& node = (*in)[id];
+
+    switch (node.type) {
+    case NODE_DO_WHILE:
+        loops.push_back({ id, 0, statements.size(), inBody });
+        break;
+    case NODE_ASSIGNMENT: {
+        NodeId kids[2];
+        kids[0] = out->addLeaf(NODE_IDENTIFIER, (*in)[in->child(id, 0)].value);
+        kids[1] = optimizeExpr(in->child(id, 1));
+        statements.push_back(out->addNode(NODE_ASSIGNMENT, OP_NONE, kids, 2));
+        break;
+    }
+    case NODE_PRINT: {
+        NodeId name = out->addLeaf(NODE_IDENTIFIER, (*in)[in->child(id, 0)].value);
+        statements.push_back(out->addNode(NODE_PRINT, OP_NONE, &name, 1));
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Builds the loop from its optimized body; a loop whose condition is
+// false leaves its body in place of itself
+void Optimizer::finishLoop(const LoopFrame& frame) {
+    const AstNode& node = (*in)[frame.id];
+    int known;
+    NodeId condition = optimizeCondition(in->child(frame.id, node.childCount - 1), known);
+    if (known == 0 && frame.inBody) {
+        counts.loopsRemoved++;     // the body runs once
+        return;
+    }
+    if (condition == NO_NODE) {
+        NodeId kids[2] = { constant(0), constant(known) };
+        condition = out->addNode(NODE_COMPARISON, OP_LT, kids, 2);
+    }
+    statements.push_back(condition);
+
+    NodeId loop = out->addNode(NODE_DO_WHILE, OP_NONE, statements.data() + frame.mark,
+        static_cast<uint32_t>(statements.size() - frame.mark));
+    statements.resize(frame.mark);
+    statements.push_back(loop);
+}
+
+NodeId Optimizer::optimizeExpr(NodeId id) {
+    if ((*in)[id].type != NODE_BINARY_OP) {
+        return copyExpr(id);
+    }
+    Sum sum = collect(id, left);
+    return sum.fits ? buildSum(left, sum.constant, sum) : copyExpr(id);
+}
+
+// known is 0 or 1 if the value of the condition is known, then no
+// nodes are built; -1 otherwise
+NodeId Optimizer::optimizeCondition(NodeId id, int& known) {
+    const AstNode& node = (*in)[id];
+    NodeId leftId = in->child(id, 0);
+    NodeId rightId = in->child(id, 1);
+    Sum l = collect(leftId, left);
+    Sum r = collect(rightId, right);
+
+    known = -1;
+    if (left.empty() && right.empty()) {
+        known = (node.op == OP_LT) ? l.constant < r.constant : l.constant > r.constant;
+    }
+    else if (l.constant == r.constant && sameTerms(left, right)) {
+        known = 0;      // both sides have the same value
+    }
+    if (known >= 0) {
+        counts.comparisonsFolded++;
+        counts.constantsFolded += l.constants + r.constants;
+        counts.termsCancelled += (l.occurrences + r.occurrences) / 2;
+        return NO_NODE;
+    }
+
+    NodeId kids[2];
+    kids[0] = l.fits ? buildSum(left, l.constant, l) : copyExpr(leftId);
+    kids[1] = r.fits ? buildSum(right, r.constant, r) : copyExpr(rightId);
+    return out->addNode(NODE_COMPARISON, node.op, kids, 2);
+}
+
+// Net count of each identifier of an expression, in the order they first
+// appear, and the sum of its constants
+Optimizer::Sum Optimizer::collect(NodeId id, vector<Term>& terms) {
+    Sum sum = { 0, 0, 0, true };
+    addTerms(id, false, sum);
+
+    terms.clear();
+    for (uint32_t code : seen) {
+        if (coefficients[code] != 0) {
+            terms.push_back({ code, coefficients[code] });
+            coefficients[code] = 0;
+        }
+    }
+    seen.clear();
+
+    sum.fits = sum.constant >= -INT32_MAX && sum.constant <= INT32_MAX;
+    return sum;
+}
+
+void Optimizer::addTerms(NodeId id, bool negate, Sum& sum) {
+    // E is a left-deep chain: walk down its spine, then add the operands
+    // from the innermost one outwards
+    size_t mark = operands.size();
+    while ((*in)[id].type == NODE_BINARY_OP) {
+        operands.push_back(id);
+        id = in->child(id, 0);
+    }
+    addOperand(id, negate, sum);
+
+    for (size_t i = operands.size(); i > mark; i--) {
+        NodeId op = operands[i - 1];
+        addOperand(in->child(op, 1), negate != ((*in)[op].op == OP_SUB), sum);
+    }
+    operands.resize(mark);
+}
+
+void Optimizer::addOperand(NodeId id, bool negate, Sum& sum) {
+    const AstNode& node = (*in)[id];
+
+    if (node.type == NODE_CONSTANT) {
+        int64_t value = context->val_dig(node.value);
+        sum.constant = negate ? wrapSub(sum.constant, value) : wrapAdd(sum.constant, value);
+        sum.constants++;
+    }
+    else if (node.type == NODE_IDENTIFIER) {
+        if (coefficients[node.value] == 0) {
+            seen.push_back(node.value);
+        }
+        coefficients[node.value] += negate ? -1 : 1;
+        sum.occurrences++;
+    }
+    else {
+        addTerms(id, negate, sum);
+    }
+}
+
+bool Optimizer::sameTerms(const vector<Term>& a, const vector<Term>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (const Term& term : a) {
+        coefficients[term.id] += term.count;
+    }
+    for (const Term& term : b) {
+        coefficients[term.id] -= term.count;
+    }
+    bool same = true;
+    for (const Term& term : a) {
+        same = same && coefficients[term.id] == 0;
+        coefficients[term.id] = 0;
+    }
+    for (const Term& term : b) {
+        coefficients[term.id] = 0;
+    }
+    return same;
+}
+
+// Builds id + id ... - id ... + value. The first operand is added, so it is
+// an identifier with a positive count, or the constant.
+NodeId Optimizer::buildSum(const vector<Term>& terms, int64_t value, const Sum& sum) {
+    size_t lead = 0;
+    while (lead < terms.size() && terms[lead].count < 0) {
+        lead++;
+    }
+
+    NodeId acc;
+    size_t remaining = 0;
+    size_t constants = 0;
+    if (lead == terms.size()) {
+        acc = constant(value);
+        value = 0;
+        constants++;
+    }
+    else {
+        acc = out->addLeaf(NODE_IDENTIFIER, terms[lead].id);
+        remaining++;
+    }
+
+    for (size_t i = 0; i < terms.size(); i++) {
+        int64_t count = terms[i].count - (i == lead ? 1 : 0);
+        OpKind op = count > 0 ? OP_ADD : OP_SUB;
+        for (int64_t k = count > 0 ? count : -count; k > 0; k--) {
+            NodeId kids[2] = { acc, out->addLeaf(NODE_IDENTIFIER, terms[i].id) };
+            acc = out->addNode(NODE_BINARY_OP, op, kids, 2);
+            remaining++;
+        }
+    }
+
+    if (value != 0) {
+        NodeId kids[2] = { acc, constant(value > 0 ? value : -value) };
+        acc = out->addNode(NODE_BINARY_OP, value > 0 ? OP_ADD : OP_SUB, kids, 2);
+        constants++;
+    }
+
+    if (sum.constants > constants) {
+        counts.constantsFolded += sum.constants - constants;
+    }
+    counts.termsCancelled += (sum.occurrences - remaining) / 2;
+    return acc;
+}
+
+NodeId Optimizer::copyExpr(NodeId id) {
+    size_t mark = operands.size();
+    while ((*in)[id].type == NODE_BINARY_OP) {
+        operands.push_back(id);
+        id = in->child(id, 0);
+    }
+
+    NodeId acc = out->addLeaf((*in)[id].type, (*in)[id].value);
+    for (size_t i = operands.size(); i > mark; i--) {
+        NodeId op = operands[i - 1];
+        NodeId kids[2] = { acc, copyExpr(in->child(op, 1)) };
+        acc = out->addNode(NODE_BINARY_OP, (*in)[op].op, kids, 2);
+    }
+    operands.resize(mark);
+    return acc;
+}
+
+NodeId Optimizer::constant(int64_t value) {
+    return out->addLeaf(NODE_CONSTANT, context->make_dig(static_cast<int>(value)));
+}
@@ -0,0 +1,82 @@
+// optimizer.h
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "ast.h"
+#include "tables.h"
+
+struct OptimizeStats {
+    size_t nodesBefore;         // nodes reachable from the root
+    size_t nodesAfter;
+    size_t constantsFolded;     // constant operands merged into another one or dropped
+    size_t termsCancelled;      // x - x pairs
+    size_t comparisonsFolded;   // conditions known at compile time
+    size_t loopsRemoved;        // do-whiles with a false condition, body kept inline
+
+    size_t eliminated() const { return nodesBefore - nodesAfter; }
+};
+
+// Constant folding and algebraic simplification over the parse tree.
+// Each sum is regrouped as identifiers times their net count plus one
+// constant: 1 + 2 - 3 becomes 0, x + 1 - x + y becomes y + 1. Arithmetic
+// wraps around like in the VM, so regrouping gives the same values.
+// A condition with a known value becomes 0 < 1 or 0 < 0, and a
+// do-while inside a body whose condition is false is replaced by its
+// statements. The result is written bottom-up into another arena.
+class Optimizer {
+private:
+    struct Term {
+        uint32_t id;            // identifiers table code
+        int64_t count;          // net count, negative if subtracted
+    };
+
+    struct Sum {
+        int64_t constant;       // all constants together
+        size_t constants;       // constant operands
+        size_t occurrences;     // identifier operands
+        bool fits;              // constant fits in a constants table entry
+    };
+
+    // A do-while whose body is being optimized; bodies are walked with
+    // this stack instead of recursion
+    struct LoopFrame {
+        NodeId id;
+        uint32_t next;          // next body statement
+        size_t mark;            // statements before the body
+        bool inBody;
+    };
+
+    CompilationContext* context;
+    const AstArena* in;
+    AstArena* out;
+    OptimizeStats counts;
+
+    std::vector<NodeId> statements;     // bodies under construction
+    std::vector<LoopFrame> loops;
+    std::vector<NodeId> operands;       // right operands of a chain
+    std::vector<int64_t> coefficients;  // net count of each identifier in the current sum
+    std::vector<uint32_t> seen;         // identifiers in the order they appear
+    std::vector<Term> left, right;      // identifier terms of the sides of a comparison
+
+    void optimizeStatement(NodeId id, bool inBody);
+    void finishLoop(const LoopFrame& frame);
+    NodeId optimizeExpr(NodeId id);
+    NodeId optimizeCondition(NodeId id, int& known);
+    Sum collect(NodeId id, std::vector<Term>& terms);
+    void addTerms(NodeId id, bool negate, Sum& sum);
+    void addOperand(NodeId id, bool negate, Sum& sum);
+    bool sameTerms(const std::vector<Term>& a, const std::vector<Term>& b);
+    NodeId buildSum(const std::vector<Term>& terms, int64_t value, const Sum& sum);
+    NodeId copyExpr(NodeId id);
+    NodeId constant(int64_t value);
+
+public:
+    // Returns the root of the optimized tree in result, which is cleared first
+    NodeId optimize(CompilationContext& ctx, const AstArena& tree, NodeId root, AstArena& result);
+    const OptimizeStats& stats() const { return counts; }
+};
+
+#endif
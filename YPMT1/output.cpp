@@ -0,0 +1,462 @@
+// output.cpp
+#include "output.h"
+#include "language.h"
+#include "parser.h"
+#include "source.h"
+#include "tables.h"
+#include <chrono>
+#include <iostream>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+using namespace std;
+
+OutputBuffer::OutputBuffer(FILE* out, size_t flushAt) : sink(out), flushSize(flushAt) {
+}
+
+OutputBuffer::~OutputBuffer() {
+    flush();
+}
+
+// Doubles the room, the new bytes are written only once
+void OutputBuffer::grow(size_t needed) {
+    size_t size = buffer.size() < 256 ? 256 : buffer.size();
+    while (size - used < needed) {
+        size *= 2;
+    }
+    buffer.resize(size);
+}
+
+void OutputBuffer::fill(char c, size_t count) {
+    char* p = room(count);
+    for (size_t i = 0; i < count; i++) {
+        p[i] = c;
+    }
+}
+
+// "00" .. "99", two digits per division
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+void OutputBuffer::number(uint64_t value) {
+    char digits[20];
+    char* p = digits + sizeof digits;
+    while (value >= 100) {
+        const char* pair = DIGIT_PAIRS + 2 * (value % 100);
+        value /= 100;
+        *--p = pair[1];
+        *--p = pair[0];
+    }
+    if (value >= 10) {
+        *--p = DIGIT_PAIRS[2 * value + 1];
+        *--p = DIGIT_PAIRS[2 * value];
+    }
+    else {
+        *--p = static_cast<char>('0' + value);
+    }
+    put(string_view(p, static_cast<size_t>(digits + sizeof digits - p)));
+}
+
+void OutputBuffer::signedNumber(int64_t value) {
+    if (value < 0) {
+        put('-');
+        number(0 - static_cast<uint64_t>(value));
+    }
+    else {
+        number(static_cast<uint64_t>(value));
+    }
+}
+
+void OutputBuffer::put32(uint32_t value) {
+    char bytes[4];
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = static_cast<char>(value >> (8 * i));
+    }
+    put(string_view(bytes, sizeof bytes));
+}
+
+void OutputBuffer::patch32(size_t position, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        buffer[position + i] = static_cast<char>(value >> (8 * i));
+    }
+}
+
+void OutputBuffer::printValue(int64_t value) {
+    signedNumber(value);
+    put('\n');
+    flushIfFull();
+}
+
+void OutputBuffer::flush() {
+    if (sink && used > 0) {
+        // Whatever went to cout before the buffer comes out before it
+        cout.flush();
+        fwrite(buffer.data(), 1, used, sink);
+        fflush(sink);
+        flushed += used;
+        used = 0;
+    }
+}
+
+bool parse_format(string_view name, OutputFormat& format) {
+    static const char* const names[] = { "text", "json", "binary" };
+    for (int i = 0; i < 3; i++) {
+        if (name == names[i]) {
+            format = static_cast<OutputFormat>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+static const string_view TOKEN_KINDS[] = { "ID", "DIG", "WORD", "END" };
+
+static const string_view NODE_NAMES[] = {
+    "PROGRAM", "DO-WHILE", "ASSIGN", "PRINT", "BIN_OP", "COMPARE", "ID", "CONST", "EXPR", "TERM", "FACTOR"
+};
+
+static const char* op_spelling(OpKind op) {
+    switch (op) {
+    case OP_ADD: return "+";
+    case OP_SUB: return "-";
+    case OP_LT: return "<";
+    case OP_GT: return ">";
+    default: return nullptr;
+    }
+}
+
+static void json_string(OutputBuffer& out, string_view text) {
+    static const char hex[] = "0123456789abcdef";
+    out.put('"');
+    size_t plain = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out.put(text.substr(plain, i - plain));
+        out.put('\\');
+        if (c == '"' || c == '\\') {
+            out.put(static_cast<char>(c));
+        }
+        else {
+            out.put("u00");
+            out.put(hex[c >> 4]);
+            out.put(hex[c & 15]);
+        }
+        plain = i + 1;
+    }
+    out.put(text.substr(plain));
+    out.put('"');
+}
+
+Emitter::Emitter(OutputBuffer& output, OutputFormat outputFormat) : out(output), format(outputFormat) {
+}
+
+void Emitter::token(TokenTypeEnum kind, int code, bool first) {
+    switch (format) {
+    case FORMAT_TEXT:
+        out.put('(');
+        out.put(TOKEN_KINDS[kind]);
+        out.put(',');
+        out.number(kind == TOKEN_END ? 0 : static_cast<uint32_t>(code));
+        out.put(") ");
+        break;
+    case FORMAT_JSON:
+        out.put(first ? "{\"kind\":\"" : ",{\"kind\":\"");
+        out.put(TOKEN_KINDS[kind]);
+        out.put("\",\"code\":");
+        out.number(static_cast<uint32_t>(code));
+        out.put('}');
+        break;
+    case FORMAT_BINARY:
+        out.put32(static_cast<uint32_t>(code) << 4 | kind);
+        break;
+    }
+}
+
+void Emitter::tokens(const vector<Token>& tokens) {
+    if (format == FORMAT_JSON) {
+        out.put("{\"tokens\":[");
+    }
+    else if (format == FORMAT_BINARY) {
+        out.put(static_cast<char>(RECORD_TOKENS));
+        out.put32(static_cast<uint32_t>(tokens.size()));
+    }
+    for (size_t i = 0; i < tokens.size(); i++) {
+        token(tokens[i].type, tokens[i].code, i == 0);
+        out.flushIfFull();
+    }
+    out.put(format == FORMAT_JSON ? "]}\n" : format == FORMAT_TEXT ? "\n" : "");
+    out.flushIfFull();
+}
+
+void Emitter::tokens(const TokenBuffer& tokens) {
+    if (format == FORMAT_JSON) {
+        out.put("{\"tokens\":[");
+    }
+    else if (format == FORMAT_BINARY) {
+        out.put(static_cast<char>(RECORD_TOKENS));
+        out.put32(static_cast<uint32_t>(tokens.size()));
+    }
+    const PackedToken* packed = tokens.tokens();
+    for (size_t i = 0; i < tokens.size(); i++) {
+        token(token_kind(packed[i]), token_code(packed[i]), i == 0);
+        out.flushIfFull();
+    }
+    out.put(format == FORMAT_JSON ? "]}\n" : format == FORMAT_TEXT ? "\n" : "");
+    out.flushIfFull();
+}
+
+void Emitter::lexemes(string_view source, const vector<Token>& tokens) {
+    size_t count = 0;
+    for (const Token& token : tokens) {
+        count += token.type != TOKEN_END;
+    }
+    if (format == FORMAT_JSON) {
+        out.put("{\"lexemes\":[");
+    }
+    else if (format == FORMAT_BINARY) {
+        out.put(static_cast<char>(RECORD_LEXEMES));
+        out.put32(static_cast<uint32_t>(count));
+    }
+
+    bool first = true;
+    for (const Token& token : tokens) {
+        if (token.type == TOKEN_END) {
+            continue;
+        }
+        string_view text = token.lexeme(source);
+        string_view kind = token.type != TOKEN_WORD ? TOKEN_KINDS[token.type]
+            : is_keyword(token.code) ? "KEYWORD" : "OPERATOR";
+        switch (format) {
+        case FORMAT_TEXT:
+            out.put(text);
+            out.put(" \t-> (");
+            out.put(kind);
+            out.put(',');
+            out.number(static_cast<uint32_t>(token.code));
+            out.put(")\n");
+            break;
+        case FORMAT_JSON:
+            out.put(first ? "{\"text\":" : ",{\"text\":");
+            json_string(out, text);
+            out.put(",\"kind\":\"");
+            out.put(kind);
+            out.put("\",\"code\":");
+            out.number(static_cast<uint32_t>(token.code));
+            out.put(",\"offset\":");
+            out.number(token.offset());
+            out.put('}');
+            break;
+        case FORMAT_BINARY:
+            out.put32(static_cast<uint32_t>(token.code) << 4 | token.type);
+            out.put32(static_cast<uint32_t>(token.offset()));
+            out.put32(static_cast<uint32_t>(token.length()));
+            break;
+        }
+        first = false;
+        out.flushIfFull();
+    }
+    if (format == FORMAT_JSON) {
+        out.put("]}\n");
+    }
+    out.flushIfFull();
+}
+
+void Emitter::node(const AstArena& ast, NodeId id, int depth) {
+    const AstNode& node = ast[id];
+    const char* op = op_spelling(node.op);
+    bool hasOp = op && (node.type == NODE_BINARY_OP || node.type == NODE_COMPARISON);
+    bool hasValue = node.type == NODE_IDENTIFIER || node.type == NODE_CONSTANT;
+
+    switch (format) {
+    case FORMAT_TEXT:
+        out.fill(' ', 2 * static_cast<size_t>(depth));
+        out.put('[');
+        out.put(NODE_NAMES[node.type]);
+        switch (node.type) {
+        case NODE_DO_WHILE: out.put(": do-while"); break;
+        case NODE_ASSIGNMENT: out.put(": ="); break;
+        case NODE_PRINT: out.put(": print"); break;
+        default:
+            if (hasValue) {
+                out.put(": ");
+                out.number(node.value);
+            }
+            else if (hasOp) {
+                out.put(": ");
+                out.put(op);
+            }
+            break;
+        }
+        out.put("]\n");
+        break;
+    case FORMAT_JSON:
+        // depth is the index among the siblings here
+        out.put(depth > 0 ? ",{\"type\":\"" : "{\"type\":\"");
+        out.put(NODE_NAMES[node.type]);
+        out.put('"');
+        if (hasValue) {
+            out.put(",\"value\":");
+            out.number(node.value);
+        }
+        else if (hasOp) {
+            out.put(",\"op\":\"");
+            out.put(op);
+            out.put('"');
+        }
+        out.put(node.childCount > 0 ? ",\"children\":[" : "}");
+        break;
+    case FORMAT_BINARY:
+        out.put(static_cast<char>(node.type));
+        out.put(static_cast<char>(node.op));
+        out.put32(node.value);
+        out.put32(node.childCount);
+        break;
+    }
+}
+
+void Emitter::tree(const AstArena& ast, NodeId root, int depth) {
+    // Preorder with an explicit stack, nesting depth is not limited
+    size_t countAt = 0;
+    uint32_t count = 0;
+    if (format == FORMAT_BINARY) {
+        out.put(static_cast<char>(RECORD_TREE));
+        countAt = out.size();
+        out.put32(0);
+    }
+    pending.clear();
+    pending.push_back({ root, format == FORMAT_JSON ? 0 : depth });
+    while (!pending.empty()) {
+        Pending next = pending.back();
+        pending.pop_back();
+        if (next.id == NO_NODE) {
+            out.put("]}");
+            continue;
+        }
+        node(ast, next.id, next.depth);
+        count++;
+
+        const AstNode& current = ast[next.id];
+        const NodeId* kids = ast.childrenOf(next.id);
+        if (format == FORMAT_JSON && current.childCount > 0) {
+            pending.push_back({ NO_NODE, 0 });
+        }
+        for (uint32_t i = current.childCount; i > 0; i--) {
+            int childDepth = format == FORMAT_JSON ? static_cast<int>(i - 1) : next.depth + 1;
+            pending.push_back({ kids[i - 1], childDepth });
+        }
+        // The binary count is patched at the end, so the record stays in the buffer
+        if (format != FORMAT_BINARY) {
+            out.flushIfFull();
+        }
+    }
+
+    if (format == FORMAT_JSON) {
+        out.put('\n');
+    }
+    else if (format == FORMAT_BINARY) {
+        out.patch32(countAt, count);
+    }
+    out.flushIfFull();
+}
+
+void Emitter::beginErrors() {
+    errorCount = 0;
+    if (format == FORMAT_JSON) {
+        out.put("{\"errors\":[");
+    }
+    else if (format == FORMAT_BINARY) {
+        out.put(static_cast<char>(RECORD_ERRORS));
+        errorsAt = out.size();
+        out.put32(0);
+    }
+}
+
+void Emitter::error(string_view message) {
+    switch (format) {
+    case FORMAT_TEXT:
+        out.put(message);
+        out.put('\n');
+        break;
+    case FORMAT_JSON:
+        if (errorCount > 0) {
+            out.put(',');
+        }
+        json_string(out, message);
+        break;
+    case FORMAT_BINARY:
+        out.put32(static_cast<uint32_t>(message.size()));
+        out.put(message);
+        break;
+    }
+    errorCount++;
+}
+
+void Emitter::endErrors() {
+    switch (format) {
+    case FORMAT_TEXT:
+        if (errorCount > 1) {
+            out.number(errorCount);
+            out.put(" errors\n");
+        }
+        else if (errorCount == 0) {
+            out.put("No parsing errors!\n");
+        }
+        break;
+    case FORMAT_JSON:
+        out.put("]}\n");
+        break;
+    case FORMAT_BINARY:
+        out.patch32(errorsAt, static_cast<uint32_t>(errorCount));
+        break;
+    }
+    out.flushIfFull();
+}
+
+int dump_main(const string& path, OutputFormat format) {
+    MappedFile file;
+    if (!file.open(path)) {
+        cerr << "Error: " << file.error() << endl;
+        return 2;
+    }
+
+    auto start = chrono::steady_clock::now();
+    CompilationContext context;
+    TokenBuffer tokens;
+    if (!scanner(context, file.text(), tokens)) {
+        return 2;
+    }
+    Parser parser(tokens, context, file.text());
+    bool accepted = parser.parse();
+    double parseSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+#ifdef _WIN32
+    if (format == FORMAT_BINARY) {
+        _setmode(_fileno(stdout), _O_BINARY);
+    }
+#endif
+    start = chrono::steady_clock::now();
+    OutputBuffer out;
+    Emitter emitter(out, format);
+    emitter.tokens(tokens);
+    if (accepted) {
+        emitter.tree(parser.getAst(), parser.getParseTree());
+    }
+    else {
+        parser.printErrors(emitter);
+    }
+    out.flush();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cerr << "Dumped " << tokens.size() << " tokens and " << parser.getAst().size() << " nodes, "
+        << out.total() << " bytes in " << seconds * 1000 << " ms (scan and parse "
+        << parseSeconds * 1000 << " ms)" << endl;
+    return accepted ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+// output.h
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ast.h"
+#include "scanner.h"
+
+const size_t OUTPUT_FLUSH_SIZE = 1 << 20;
+
+// Output collected in one reusable buffer and written with a single
+// fwrite once it holds flushSize bytes, or on flush(). Numbers are
+// formatted by hand, without streams or locales.
+class OutputBuffer {
+private:
+    FILE* sink;          // nullptr keeps everything in memory
+    size_t flushSize;
+    uint64_t flushed = 0;
+    std::string buffer;  // bytes [0, used) are output, the rest is room
+    size_t used = 0;
+
+    void grow(size_t needed);
+    char* room(size_t n) {
+        if (buffer.size() - used < n) {
+            grow(n);
+        }
+        char* p = buffer.data() + used;
+        used += n;
+        return p;
+    }
+
+public:
+    explicit OutputBuffer(FILE* out = stdout, size_t flushAt = OUTPUT_FLUSH_SIZE);
+    ~OutputBuffer();
+
+    void put(char c) { *room(1) = c; }
+    void put(std::string_view text) { text.copy(room(text.size()), text.size()); }
+    void fill(char c, size_t count);
+    void number(uint64_t value);
+    void signedNumber(int64_t value);
+
+    // Little-endian binary fields; patch32 rewrites one that has not
+    // been flushed yet
+    void put32(uint32_t value);
+    void patch32(size_t position, uint32_t value);
+    size_t size() const { return used; }
+
+    // A print statement: the value on a line of its own
+    void printValue(int64_t value);
+
+    void flushIfFull() {
+        if (sink && used >= flushSize) {
+            flush();
+        }
+    }
+    void flush();
+    std::string_view text() const { return std::string_view(buffer.data(), used); }
+    void clear() { used = 0; }
+    uint64_t total() const { return flushed + used; }     // bytes so far
+};
+
+enum OutputFormat : uint8_t {
+    FORMAT_TEXT,        // as the demonstration prints it
+    FORMAT_JSON,        // one object per line
+    FORMAT_BINARY
+};
+
+// "text", "json" or "binary"; false for other names
+bool parse_format(std::string_view name, OutputFormat& format);
+
+// Binary records, all integers little-endian:
+//
+//   u8 kind, u32 count, count items
+//   'K' tokens:  u32 packed token (kind in the low 4 bits, code above)
+//   'L' lexemes: u32 packed token, u32 offset, u32 length
+//   'T' tree:    nodes in preorder, u8 type, u8 op, u32 value, u32 child count
+//   'E' errors:  u32 length, text
+enum BinaryRecord : uint8_t {
+    RECORD_TOKENS = 'K',
+    RECORD_LEXEMES = 'L',
+    RECORD_TREE = 'T',
+    RECORD_ERRORS = 'E'
+};
+
+// Writes tokens, trees and diagnostics to a buffer in one format. The
+// text format is the one print_tokens, printTreeHelper and
+// Parser::printErrors have always printed.
+class Emitter {
+private:
+    struct Pending {
+        NodeId id;      // NO_NODE closes the children of a JSON node
+        int depth;
+    };
+
+    OutputBuffer& out;
+    OutputFormat format;
+    std::vector<Pending> pending;
+    size_t errorCount = 0;
+    size_t errorsAt = 0;        // of the binary count
+
+    void token(TokenTypeEnum kind, int code, bool first);
+    void node(const AstArena& ast, NodeId id, int depth);
+
+public:
+    explicit Emitter(OutputBuffer& output, OutputFormat outputFormat = FORMAT_TEXT);
+
+    void tokens(const std::vector<Token>& tokens);
+    void tokens(const TokenBuffer& tokens);
+    // Tokens with their source text, without the END token
+    void lexemes(std::string_view source, const std::vector<Token>& tokens);
+    void tree(const AstArena& ast, NodeId root, int depth = 0);
+
+    void beginErrors();
+    void error(std::string_view message);
+    void endErrors();
+};
+
+// YPMT1 --dump <file> [--format text|json|binary]: the tokens of a
+// program, then its tree or its errors, to stdout
+int dump_main(const std::string& path, OutputFormat format);
+
+#endif
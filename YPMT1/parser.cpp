@@ -1,354 +1,557 @@
 ﻿#include "parser.h"
+#include "language.h"
+#include "stats.h"
 #include <iostream>
 #include <stack>
 #include <iomanip>
+#include <limits>
+#include <algorithm>
 
 using namespace std;
 
-Parser::Parser(const vector<Token>& tokenList)
-    : tokens(tokenList), currentPos(0), root(nullptr), errorFlag(false) {
+Parser::Parser(const vector<Token>& tokenList, CompilationContext& ctx, string_view text)
+    : packed(nullptr), starts(nullptr), scanErrors(nullptr), tokens(&tokenList), lexer(nullptr), context(&ctx), source(text), currentPos(0), root(NO_NODE),
+    maxErrors(numeric_limits<size_t>::max()), errorLimit(maxErrors), panic(false) {
+    fetch(current);
+    fetch(lookahead);
+}
+
+Parser::Parser(const TokenBuffer& buffer, CompilationContext& ctx, string_view text)
+    : packed(buffer.tokens()), starts(buffer.starts()), scanErrors(&buffer.errors()), tokens(nullptr), lexer(nullptr), context(&ctx),
+    source(text), currentPos(0), root(NO_NODE),
+    maxErrors(numeric_limits<size_t>::max()), errorLimit(maxErrors), panic(false) {
+    fetch(current);
+    fetch(lookahead);
+}
+
+Parser::Parser(Lexer& tokenSource)
+    : packed(nullptr), starts(nullptr), scanErrors(nullptr), tokens(nullptr), lexer(&tokenSource), context(&tokenSource.context()),
+    source(tokenSource.source()), currentPos(0), root(NO_NODE),
+    maxErrors(numeric_limits<size_t>::max()), errorLimit(maxErrors), panic(false) {
+    fetch(current);
+    fetch(lookahead);
 }
 
 Parser::~Parser() {
-    if (root) {
-        delete root;
-    }
 }
 
-Token Parser::currentToken() const {
-    if (currentPos < tokens.size()) {
-        return tokens[currentPos];
+void Parser::fetch(Token& token) {
+    if (packed) {
+        // The parser stops at the END token, so the sentinels after it
+        // are as far as the lookahead gets. Lengths are filled in for
+        // diagnostics only.
+        PackedToken next = packed[currentPos];
+        token.type = token_kind(next);
+        token.code = token_code(next);
+        token.span = starts[currentPos];
+        currentPos++;
+    }
+    else if (lexer) {
+        lexer->next(token);     // an END token once the input is exhausted
+    }
+    else if (currentPos < tokens->size()) {
+        token = (*tokens)[currentPos++];
+    }
+    else {
+        size_t endOffset = tokens->empty() ? 0 : tokens->back().offset() + tokens->back().length();
+        token = { TOKEN_END, 0 };
+        token.setSpan(endOffset, 0);
+        currentPos++;
     }
-    return { TOKEN_END, 0 };
 }
 
-Token Parser::peekToken() const {
-    if (currentPos + 1 < tokens.size()) {
-        return tokens[currentPos + 1];
-    }
-    return { TOKEN_END, 0 };
+// Restarts reading the token vector at index
+void Parser::seek(size_t index) {
+    currentPos = index;
+    fetch(current);
+    fetch(lookahead);
+}
+
+void Parser::setTokens(const TokenBuffer& buffer, string_view text) {
+    packed = buffer.tokens();
+    starts = buffer.starts();
+    scanErrors = &buffer.errors();
+    tokens = nullptr;
+    lexer = nullptr;
+    source = text;
+    seek(0);
 }
 
 void Parser::consumeToken() {
-    if (currentPos < tokens.size()) {
-        currentPos++;
-    }
+    current = lookahead;
+    fetch(lookahead);
 }
 
 void Parser::match(TokenTypeEnum expectedType, int expectedCode) {
-    Token current = currentToken();
+    const Token& current = currentToken();
 
     if (current.type == TOKEN_END && expectedType == TOKEN_END) {
         return;
     }
 
     if (current.type != expectedType) {
-        string typeName;
-        switch (expectedType) {
-        case TOKEN_ID: typeName = "identifier"; break;
-        case TOKEN_DIG: typeName = "number"; break;
-        case TOKEN_WORD:
-            if (expectedCode == 1) typeName = "'do'";
-            else if (expectedCode == 2) typeName = "'while'";
-            else if (expectedCode == 3) typeName = "'print'";
-            else if (expectedCode == 4) typeName = "'='";
-            else if (expectedCode == 5) typeName = "'<'";
-            else if (expectedCode == 6) typeName = "'>'";
-            else if (expectedCode == 7) typeName = "'+'";
-            else if (expectedCode == 8) typeName = "'-'";
-            else if (expectedCode == 9) typeName = "';'";
-            else typeName = "operator";
-            break;
-        case TOKEN_END: typeName = "end of program (#)"; break;
-        }
-        error("expected " + typeName);
+        error(ERR_EXPECTED_TOKEN, expectedType, expectedCode);
         return;
     }
 
     if (expectedCode != -1 && current.code != expectedCode) {
-        error("unexpected token code");
+        error(ERR_UNEXPECTED_CODE);
         return;
     }
 
     consumeToken();
 }
 
-void Parser::error(const string& message) {
-    if (!errorFlag) {
-        errorFlag = true;
-        errorMessage = "Error: " + message;
+void Parser::error(ParseErrorCode code, TokenTypeEnum expected, int expectedCode) {
+    // Errors until the next sync point usually follow from this one
+    if (!panic) {
+        panic = true;
+        diagnostics.push_back({ code, expected, expectedCode, currentToken() });
+        if (packed) {
+            Token& at = diagnostics.back().at;
+            at.setSpan(at.offset(), token_length(source, at.offset()));
+        }
+        STATS_ADD(errors, 1);
     }
 }
 
-bool Parser::parse() {
-    root = parseS();
+// Panic mode: skips to the next ';', 'while' or '#' outside of nested
+// do-whiles. False if the parse has to stop at the error limit.
+bool Parser::recover() {
+    if (!panic) {
+        return true;
+    }
+    if (diagnostics.size() >= errorLimit) {
+        return false;
+    }
 
-    if (currentToken().type != TOKEN_END) {
-        error("expected end of program (#)");
+    int depth = 0;
+    for (;;) {
+        const Token& token = currentToken();
+        if (token.type == TOKEN_END) {
+            break;
+        }
+        if (token.type == TOKEN_WORD) {
+            if (token.code == WORD_DO) {
+                depth++;
+            }
+            else if (token.code == WORD_WHILE) {
+                if (depth == 0) {
+                    break;
+                }
+                depth--;
+            }
+            else if (token.code == WORD_SEMICOLON && depth == 0) {
+                break;
+            }
+        }
+        consumeToken();
     }
+    panic = false;
+    return true;
+}
 
-    return !errorFlag;
+static const char* expectedName(TokenTypeEnum type, int code) {
+    switch (type) {
+    case TOKEN_ID: return "identifier";
+    case TOKEN_DIG: return "number";
+    case TOKEN_WORD: return word_name(code);
+    case TOKEN_END: return "end of program (#)";
+    }
+    return "token";
 }
 
-ParseTreeNode* Parser::parseS() {
-    Token current = currentToken();
+static const char* const errorTexts[] = {
+    "expected ",
+    "unexpected token code",
+    "S: expected statement after 'do'",
+    "S: expected 'while' after statements",
+    "S: expected '=' after identifier",
+    "S: expected identifier after 'print'",
+    "S: expected 'do', identifier, or 'print'",
+    "B: expected expression",
+    "B: expected '<' or '>'",
+    "B: expected expression after operator",
+    "E: expected term",
+    "E: expected term after operator",
+    "T: expected identifier or number",
+    "unknown character",
+    "number out of range",
+};
+
+string Parser::formatDiagnostic(const Diagnostic& diagnostic) const {
+    string message = "Error: ";
+    message += errorTexts[diagnostic.code];
+    if (diagnostic.code == ERR_EXPECTED_TOKEN) {
+        message += expectedName(diagnostic.expected, diagnostic.expectedCode);
+    }
+
+    if (!source.empty()) {
+        const Token& at = diagnostic.at;
+        SourcePosition where = at.position(source);
+        message += " (line " + to_string(where.line) + ", column " + to_string(where.column);
+        if (at.length() > 0) {
+            message += ", at '";
+            message += at.lexeme(source);
+            message += "'";
+        }
+        else {
+            message += ", at end of input";
+        }
+        message += ")";
+    }
+    return message;
+}
 
-    if (current.type == TOKEN_WORD && current.code == 1) { // do
-        ParseTreeNode* doWhileNode = new ParseTreeNode(NODE_DO_WHILE, "do-while");
+string Parser::getErrorMessage() const {
+    return diagnostics.empty() ? string() : formatDiagnostic(diagnostics.front());
+}
 
-        match(TOKEN_WORD, 1);
+bool Parser::parse() {
+    STATS_PHASE(PHASE_PARSE);
+    if (tokens || packed) {
+        seek(0);    // the tokens can be parsed again
+    }
+    diagnostics.clear();
+    errorLimit = maxErrors;
+    panic = false;
+    ast.reset();
+    scratch.clear();
+    frames.clear();
+    doDepth = 0;
+    root = parseS();
 
-        vector<ParseTreeNode*> statements = parseStatementList();
-        if (statements.empty()) {
-            error("S: expected statement after 'do'");
-            delete doWhileNode;
-            return nullptr;
+    // The program is one statement. Whatever follows it is reported once
+    // and checked on its own, up to the next extra 'while'.
+    while (currentToken().type != TOKEN_END) {
+        error(ERR_EXPECTED_TOKEN, TOKEN_END);
+        if (!recover()) {
+            break;
         }
-        for (auto stmt : statements) {
-            doWhileNode->children.push_back(stmt);
+        if (currentToken().type == TOKEN_WORD && currentToken().code == WORD_WHILE) {
+            consumeToken();
+            parseB();
+            if (!recover()) {
+                break;
+            }
         }
-
-        if (currentToken().type == TOKEN_WORD && currentToken().code == 2) {
-            match(TOKEN_WORD, 2); // while
+        if (currentToken().type == TOKEN_WORD && currentToken().code == WORD_SEMICOLON) {
+            consumeToken();
+            size_t mark = scratch.size();
+            parseStatementList();
+            scratch.resize(mark);
         }
-        else {
-            error("S: expected 'while' after statements");
-            delete doWhileNode;
-            return nullptr;
+    }
+
+    // Lexical errors of the tokens read, merged in by position; they do
+    // not stop the parse, the lexer has skipped or clamped the bytes
+    const vector<Diagnostic>* scanned = lexer ? &lexer->errors() : scanErrors;
+    if (scanned && !scanned->empty()) {
+        size_t middle = diagnostics.size();
+        diagnostics.insert(diagnostics.end(), scanned->begin(), scanned->end());
+        inplace_merge(diagnostics.begin(), diagnostics.begin() + middle, diagnostics.end(),
+            [](const Diagnostic& a, const Diagnostic& b) { return a.at.offset() < b.at.offset(); });
+        STATS_ADD(errors, scanned->size());
+    }
+
+    STATS_ADD(parses, 1);
+    STATS_ADD(nodes, ast.size());
+    return diagnostics.empty();
+}
+
+bool Parser::parseStatementsAt(size_t first, size_t last, vector<NodeId>& out) {
+    STATS_PHASE(PHASE_PARSE);
+    seek(first);
+    diagnostics.clear();
+    errorLimit = 1;     // the caller falls back to a full parse
+    panic = false;
+    scratch.clear();
+    frames.clear();
+    doDepth = 0;
+
+    for (;;) {
+        NodeId stmt = parseS();
+        if (!diagnostics.empty()) {
+            return false;
         }
+        out.push_back(stmt);
 
-        ParseTreeNode* condition = parseB();
-        if (condition) {
-            doWhileNode->children.push_back(condition);
+        if (tokenIndex() >= last || currentToken().type != TOKEN_WORD || currentToken().code != WORD_SEMICOLON) {
+            break;
         }
-        else {
-            delete doWhileNode;
-            return nullptr;
+        match(TOKEN_WORD, WORD_SEMICOLON);
+        if (currentToken().type == TOKEN_WORD && currentToken().code == WORD_WHILE) {
+            break;      // a ';' before 'while' ends the list, as in parse()
         }
-
-        return doWhileNode;
     }
-    else if (current.type == TOKEN_ID) {
-        ParseTreeNode* assignNode = new ParseTreeNode(NODE_ASSIGNMENT, "=");
 
-        ParseTreeNode* idNode = new ParseTreeNode(NODE_IDENTIFIER,
-            to_string(current.code));
-        assignNode->children.push_back(idNode);
+    return tokenIndex() == last;
+}
+
+NodeId Parser::parseS() {
+    size_t base = frames.size();
+    NodeId statement = beginS();
+    return runFrames(base, statement);
+}
+
+// Parses an assignment or a print. A 'do' only pushes its frame and the
+// frame of its statement list, runFrames() goes on from there.
+NodeId Parser::beginS() {
+    STATS_MAX(maxDepth, doDepth + 1);
+    Token current = currentToken();
+
+    switch (predict(NT_S, current.type, current.code)) {
+    case PROD_DO_WHILE:
+        frames.push_back({ FRAME_DO_BODY, scratch.size(), diagnostics.size() });
+        doDepth++;
+
+        match(TOKEN_WORD, WORD_DO);
+
+        frames.push_back({ FRAME_LIST_NEXT, scratch.size(), 0 });
+        return NO_NODE;
+    case PROD_ASSIGN: {
+        NodeId kids[2];
+        kids[0] = ast.addLeaf(NODE_IDENTIFIER, current.code);
 
         match(TOKEN_ID);
 
-        if (currentToken().type == TOKEN_WORD && currentToken().code == 4) {
-            match(TOKEN_WORD, 4); // =
+        if (currentToken().type == TOKEN_WORD && currentToken().code == WORD_ASSIGN) {
+            match(TOKEN_WORD, WORD_ASSIGN);
         }
         else {
-            error("S: expected '=' after identifier");
-            delete assignNode;
-            return nullptr;
+            error(ERR_ASSIGN_AFTER_ID);
+            return NO_NODE;
         }
 
-        ParseTreeNode* expr = parseE();
-        if (expr) {
-            assignNode->children.push_back(expr);
-        }
-        else {
-            delete assignNode;
-            return nullptr;
+        kids[1] = parseE();
+        if (kids[1] == NO_NODE) {
+            return NO_NODE;
         }
 
-        return assignNode;
+        return ast.addNode(NODE_ASSIGNMENT, OP_NONE, kids, 2);
     }
-    else if (current.type == TOKEN_WORD && current.code == 3) { // print
-        ParseTreeNode* printNode = new ParseTreeNode(NODE_PRINT, "print");
-
-        match(TOKEN_WORD, 3);
+    case PROD_PRINT:
+        match(TOKEN_WORD, WORD_PRINT);
 
         if (currentToken().type == TOKEN_ID) {
-            ParseTreeNode* idNode = new ParseTreeNode(NODE_IDENTIFIER,
-                to_string(currentToken().code));
-            printNode->children.push_back(idNode);
+            NodeId idNode = ast.addLeaf(NODE_IDENTIFIER, currentToken().code);
             match(TOKEN_ID);
+            return ast.addNode(NODE_PRINT, OP_NONE, &idNode, 1);
         }
         else {
-            error("S: expected identifier after 'print'");
-            delete printNode;
-            return nullptr;
+            error(ERR_ID_AFTER_PRINT);
+            return NO_NODE;
         }
-
-        return printNode;
-    }
-    else {
-        error("S: expected 'do', identifier, or 'print'");
-        return nullptr;
+    default:
+        error(ERR_STATEMENT);
+        return NO_NODE;
     }
 }
 
-vector<ParseTreeNode*> Parser::parseStatementList() {
-    vector<ParseTreeNode*> statements;
-
-    ParseTreeNode* stmt = parseS();
-    if (stmt) {
-        statements.push_back(stmt);
-    }
-    else {
-        return statements;
-    }
+// Runs the frames above base until they are done. value is the statement
+// parsed last, for a list waiting for one; the result is the statement
+// of the frame at base.
+NodeId Parser::runFrames(size_t base, NodeId value) {
+    while (frames.size() > base) {
+        Frame& frame = frames.back();
+
+        switch (frame.kind) {
+        case FRAME_LIST_NEXT:
+            frame.kind = FRAME_LIST_RESULT;
+            value = beginS();
+            break;
+        case FRAME_LIST_RESULT: {
+            bool more = true;
+            if (value != NO_NODE) {
+                scratch.push_back(value);
+            }
+            else {
+                more = recover();
+            }
 
-    while (currentToken().type == TOKEN_WORD && currentToken().code == 9) { // ;
-        match(TOKEN_WORD, 9); // ;
+            if (more && currentToken().type == TOKEN_WORD && currentToken().code == WORD_SEMICOLON) {
+                match(TOKEN_WORD, WORD_SEMICOLON);
+                more = currentToken().type != TOKEN_WORD || currentToken().code != WORD_WHILE;
+            }
+            else {
+                more = false;
+            }
 
-        if (currentToken().type != TOKEN_WORD || currentToken().code != 2) { // not 'while'
-            stmt = parseS();
-            if (stmt) {
-                statements.push_back(stmt);
+            if (more) {
+                frame.kind = FRAME_LIST_NEXT;
             }
             else {
-                break;
+                listCount = scratch.size() - frame.mark;
+                frames.pop_back();
             }
+            break;
         }
-        else {
+        default:
+            value = finishDo(frame);
             break;
         }
     }
+    return value;
+}
+
+// The rest of a 'do' once a statement list of its body has ended. Pushes
+// another list if statements follow an error in the body.
+NodeId Parser::finishDo(Frame& frame) {
+    size_t mark = frame.mark;
+    size_t errors = frame.errors;
+
+    if (panic) {
+        scratch.resize(mark);   // at the error limit
+        frames.pop_back();
+        doDepth--;
+        return NO_NODE;
+    }
+    if (frame.kind == FRAME_DO_BODY && listCount == 0 && diagnostics.size() == errors) {
+        error(ERR_STATEMENT_AFTER_DO);
+    }
+
+    // Statements up to the 'while' are still checked after an error
+    while (currentToken().type != TOKEN_WORD || currentToken().code != WORD_WHILE) {
+        error(ERR_WHILE_AFTER_BODY);
+        if (!recover() || currentToken().type == TOKEN_END) {
+            scratch.resize(mark);
+            frames.pop_back();
+            doDepth--;
+            return NO_NODE;
+        }
+        if (currentToken().code == WORD_SEMICOLON) {
+            match(TOKEN_WORD, WORD_SEMICOLON);
+            if (currentToken().type != TOKEN_WORD || currentToken().code != WORD_WHILE) {
+                frame.kind = FRAME_DO_RECOVERY;
+                frames.push_back({ FRAME_LIST_NEXT, scratch.size(), 0 });
+                return NO_NODE;
+            }
+        }
+    }
+    match(TOKEN_WORD, WORD_WHILE);
+    frames.pop_back();
+    doDepth--;
 
-    return statements;
+    NodeId condition = parseB();
+    if (condition == NO_NODE || diagnostics.size() != errors) {
+        scratch.resize(mark);
+        return NO_NODE;
+    }
+    scratch.push_back(condition);
+
+    NodeId doWhileNode = ast.addNode(NODE_DO_WHILE, OP_NONE, scratch.data() + mark,
+        static_cast<uint32_t>(scratch.size() - mark));
+    scratch.resize(mark);
+    return doWhileNode;
+}
+
+size_t Parser::parseStatementList() {
+    size_t base = frames.size();
+    frames.push_back({ FRAME_LIST_NEXT, scratch.size(), 0 });
+    runFrames(base, NO_NODE);
+    return listCount;
 }
 
-ParseTreeNode* Parser::parseB() {
-    ParseTreeNode* comparisonNode = new ParseTreeNode(NODE_COMPARISON);
+NodeId Parser::parseB() {
+    NodeId kids[2];
 
-    ParseTreeNode* leftExpr = parseE();
-    if (!leftExpr) {
-        error("B: expected expression");
-        delete comparisonNode;
-        return nullptr;
+    kids[0] = parseE();
+    if (kids[0] == NO_NODE) {
+        error(ERR_CONDITION);
+        return NO_NODE;
     }
-    comparisonNode->children.push_back(leftExpr);
 
     Token opToken = currentToken();
-    if (opToken.type == TOKEN_WORD && opToken.code == 5) { // <
-        comparisonNode->value = "<";
-        match(TOKEN_WORD, 5);
-    }
-    else if (opToken.type == TOKEN_WORD && opToken.code == 6) { // >
-        comparisonNode->value = ">";
-        match(TOKEN_WORD, 6);
+    OpKind op = opToken.type == TOKEN_WORD ? word_op(opToken.code) : OP_NONE;
+    if (is_relation(op)) {
+        match(TOKEN_WORD, opToken.code);
     }
     else {
-        error("B: expected '<' or '>'");
-        delete comparisonNode;
-        return nullptr;
+        error(ERR_RELATION);
+        return NO_NODE;
     }
 
-    ParseTreeNode* rightExpr = parseE();
-    if (!rightExpr) {
-        error("B: expected expression after operator");
-        delete comparisonNode;
-        return nullptr;
+    kids[1] = parseE();
+    if (kids[1] == NO_NODE) {
+        error(ERR_CONDITION_RIGHT);
+        return NO_NODE;
     }
-    comparisonNode->children.push_back(rightExpr);
 
-    return comparisonNode;
+    return ast.addNode(NODE_COMPARISON, op, kids, 2);
 }
 
-ParseTreeNode* Parser::parseE() {
-    ParseTreeNode* leftTerm = parseT();
-    if (!leftTerm) {
-        error("E: expected term");
-        return nullptr;
-    }
+NodeId Parser::parseE() {
+    NodeId kids[2];
 
-    while (currentToken().type == TOKEN_WORD &&
-        (currentToken().code == 7 || currentToken().code == 8)) {
+    kids[0] = parseT();
+    if (kids[0] == NO_NODE) {
+        error(ERR_TERM);
+        return NO_NODE;
+    }
 
-        string opStr = (currentToken().code == 7) ? "+" : "-";
-        ParseTreeNode* opNode = new ParseTreeNode(NODE_BINARY_OP, opStr);
-        opNode->children.push_back(leftTerm);
+    while (currentToken().type == TOKEN_WORD && is_additive(word_op(currentToken().code))) {
+        OpKind op = word_op(currentToken().code);
 
         match(TOKEN_WORD);
 
-        ParseTreeNode* rightTerm = parseT();
-        if (!rightTerm) {
-            error("E: expected term after operator");
-            delete opNode;
-            return nullptr;
+        kids[1] = parseT();
+        if (kids[1] == NO_NODE) {
+            error(ERR_TERM_AFTER_OP);
+            return NO_NODE;
         }
 
-        opNode->children.push_back(rightTerm);
-        leftTerm = opNode;
+        kids[0] = ast.addNode(NODE_BINARY_OP, op, kids, 2);
     }
 
-    return leftTerm;
+    return kids[0];
 }
 
-ParseTreeNode* Parser::parseT() {
+NodeId Parser::parseT() {
     Token current = currentToken();
 
-    if (current.type == TOKEN_ID) {
-        ParseTreeNode* idNode = new ParseTreeNode(NODE_IDENTIFIER,
-            to_string(current.code));
+    switch (predict(NT_T, current.type, current.code)) {
+    case PROD_ID: {
+        NodeId idNode = ast.addLeaf(NODE_IDENTIFIER, current.code);
         match(TOKEN_ID);
         return idNode;
     }
-    else if (current.type == TOKEN_DIG) {
-        ParseTreeNode* constNode = new ParseTreeNode(NODE_CONSTANT,
-            to_string(current.code));
+    case PROD_NUM: {
+        NodeId constNode = ast.addLeaf(NODE_CONSTANT, current.code);
         match(TOKEN_DIG);
         return constNode;
     }
-    else {
-        error("T: expected identifier or number");
-        return nullptr;
+    default:
+        error(ERR_OPERAND);
+        return NO_NODE;
     }
 }
 
-void printTreeHelper(ParseTreeNode* node, int depth = 0) {
-    if (!node) return;
-
-    for (int i = 0; i < depth; i++) {
-        cout << "  ";
-    }
-
-    string typeStr;
-    switch (node->type) {
-    case NODE_PROGRAM: typeStr = "PROGRAM"; break;
-    case NODE_DO_WHILE: typeStr = "DO-WHILE"; break;
-    case NODE_ASSIGNMENT: typeStr = "ASSIGN"; break;
-    case NODE_PRINT: typeStr = "PRINT"; break;
-    case NODE_BINARY_OP: typeStr = "BIN_OP"; break;
-    case NODE_COMPARISON: typeStr = "COMPARE"; break;
-    case NODE_IDENTIFIER: typeStr = "ID"; break;
-    case NODE_CONSTANT: typeStr = "CONST"; break;
-    case NODE_EXPRESSION: typeStr = "EXPR"; break;
-    case NODE_TERM: typeStr = "TERM"; break;
-    case NODE_FACTOR: typeStr = "FACTOR"; break;
-    }
-
-    cout << "[" << typeStr;
-    if (!node->value.empty()) {
-        cout << ": " << node->value;
-    }
-    cout << "]" << endl;
-
-    for (auto child : node->children) {
-        printTreeHelper(child, depth + 1);
-    }
+void printTreeHelper(const AstArena& ast, NodeId id, int depth) {
+    if (id == NO_NODE) return;
+    OutputBuffer out;
+    Emitter(out).tree(ast, id, depth);
 }
 
 void Parser::printParseTree() const {
-    if (!root) {
+    if (root == NO_NODE) {
         cout << "No parse tree (parsing failed or not performed)" << endl;
         return;
     }
 
     cout << "\n=== PARSE TREE ===" << endl;
-    printTreeHelper(root);
+    printTreeHelper(ast, root);
 }
 
 void Parser::printErrors() const {
-    if (errorFlag) {
-        cout << errorMessage << endl;
-    }
-    else {
-        cout << "No parsing errors!" << endl;
+    OutputBuffer out;
+    Emitter emitter(out);
+    printErrors(emitter);
+}
+
+void Parser::printErrors(Emitter& out) const {
+    out.beginErrors();
+    for (const Diagnostic& diagnostic : diagnostics) {
+        out.error(formatDiagnostic(diagnostic));
     }
+    out.endErrors();
 }
@@ -4,72 +4,119 @@
 #include <vector>
 #include <string>
 #include "scanner.h"
-
-// Node types for parse tree
-enum NodeType {
-    NODE_PROGRAM,
-    NODE_DO_WHILE,
-    NODE_ASSIGNMENT,
-    NODE_PRINT,
-    NODE_BINARY_OP,
-    NODE_COMPARISON,
-    NODE_IDENTIFIER,
-    NODE_CONSTANT,
-    NODE_EXPRESSION,
-    NODE_TERM,
-    NODE_FACTOR
-};
-
-// Parse tree node structure
-struct ParseTreeNode {
-    NodeType type;
-    std::string value;
-    std::vector<ParseTreeNode*> children;
-
-    ParseTreeNode(NodeType t, const std::string& v = "") : type(t), value(v) {}
-    ~ParseTreeNode() {
-        for (auto child : children) {
-            delete child;
-        }
-    }
-};
+#include "ast.h"
+#include "tables.h"
+#include "output.h"
 
 // Parser class
 class Parser {
 private:
-    std::vector<Token> tokens;
+    // A 'do' statement or a statement list being parsed. Nested statements
+    // push frames instead of recursing, so the depth of a program is
+    // limited by the heap only.
+    enum FrameKind : uint8_t {
+        FRAME_DO_BODY,      // 'do' waiting for its statement list
+        FRAME_DO_RECOVERY,  // 'do' waiting for statements after an error in the body
+        FRAME_LIST_NEXT,    // list about to parse a statement
+        FRAME_LIST_RESULT   // list waiting for the statement
+    };
+
+    struct Frame {
+        FrameKind kind;
+        size_t mark;        // scratch size when the frame was pushed
+        size_t errors;      // diagnostics when the 'do' was read
+    };
+
+    const PackedToken* packed;          // token buffer, ends with sentinels, or
+    const uint32_t* starts;
+    const std::vector<Diagnostic>* scanErrors;  // of the token buffer
+    const std::vector<Token>* tokens;   // token vector, or
+    Lexer* lexer;                       // tokens scanned on demand
+    CompilationContext* context;        // tables the token codes refer to
+    std::string_view source;            // scanned text, for error positions
     size_t currentPos;
-    ParseTreeNode* root;
-    bool errorFlag;
-    std::string errorMessage;
+    Token current;                      // one-token lookahead window
+    Token lookahead;
+    AstArena ast;
+    NodeId root;
+    std::vector<NodeId> scratch;    // children of nodes under construction
+    std::vector<Frame> frames;
+    size_t listCount = 0;   // statements of the last list that ended
+    size_t doDepth = 0;     // 'do' frames on the stack
+    std::vector<Diagnostic> diagnostics;
+    size_t maxErrors;       // limit of parse()
+    size_t errorLimit;      // of the current parse
+    bool panic;             // errors are not reported until the next sync point
 
     // Helper functions
-    Token currentToken() const;
-    Token peekToken() const;
+    void fetch(Token& token);
+    void seek(size_t index);
+    const Token& currentToken() const { return current; }
+    const Token& peekToken() const { return lookahead; }
     void consumeToken();
     void match(TokenTypeEnum expectedType, int expectedCode = -1);
-    void error(const std::string& message);
+    void error(ParseErrorCode code, TokenTypeEnum expected = TOKEN_END, int expectedCode = -1);
+    bool recover();
 
     // Grammar rule functions
-    ParseTreeNode* parseS();          // S → do S{;S} while B | id = E | print id
-    ParseTreeNode* parseB();          // B → E < E | E > E
-    ParseTreeNode* parseE();          // E → T {+T | -T}
-    ParseTreeNode* parseT();          // T → num | id
+    NodeId parseS();          // S → do S{;S} while B | id = E | print id
+    NodeId beginS();          // one statement, or a frame for 'do'
+    NodeId finishDo(Frame& frame);
+    NodeId runFrames(size_t base, NodeId value);
+    NodeId parseB();          // B → E < E | E > E
+    NodeId parseE();          // E → T {+T | -T}
+    NodeId parseT();          // T → num | id
 
-    // Multiple statements handling
-    std::vector<ParseTreeNode*> parseStatementList();
+    // Multiple statements handling, pushes statements onto scratch
+    size_t parseStatementList();
 
 public:
-    Parser(const std::vector<Token>& tokenList);
+    // The vector must outlive the parser; text is the scanned source, if known
+    Parser(const std::vector<Token>& tokenList, CompilationContext& ctx = default_context(),
+        std::string_view text = std::string_view());
+    Parser(std::vector<Token>&&, CompilationContext& = default_context(),
+        std::string_view = std::string_view()) = delete;
+    Parser(const TokenBuffer& buffer, CompilationContext& ctx = default_context(),
+        std::string_view text = std::string_view());
+    Parser(TokenBuffer&&, CompilationContext& = default_context(),
+        std::string_view = std::string_view()) = delete;
+    Parser(Lexer& tokenSource); // scanning and parsing in one pass, context of the lexer
     ~Parser();
 
     bool parse();
     void printParseTree() const;
     void printErrors() const;
-    bool hasErrors() const { return errorFlag; }
+    void printErrors(Emitter& out) const;
+    bool hasErrors() const { return !diagnostics.empty(); }
+    std::string getErrorMessage() const;   // the first error, empty if there is none
+
+    // All errors of the last parse, in source order. After an error the
+    // parser skips to the next ';', 'while' or '#' and goes on, parse()
+    // stops after limit errors (default: no limit).
+    const std::vector<Diagnostic>& getDiagnostics() const { return diagnostics; }
+    std::string formatDiagnostic(const Diagnostic& diagnostic) const;
+    void setMaxErrors(size_t limit) { maxErrors = limit > 0 ? limit : 1; }
+    CompilationContext& getContext() const { return *context; }
+
+    // Incremental re-parsing over the token vector (see incremental.h).
+    // Parses statements S {; S} [;] into the existing tree, appending them
+    // to out; true if they cover exactly the tokens [first, last). A
+    // trailing ';' is taken only before 'while', like in a do body.
+    bool parseStatementsAt(size_t first, size_t last, std::vector<NodeId>& out);
+    size_t tokenIndex() const { return currentPos - 2; }   // index of the current token
+    void setSource(std::string_view text) { source = text; }
+    // Reads buffer from now on, after it was filled for another program;
+    // the tree keeps its memory for the next parse()
+    void setTokens(const TokenBuffer& buffer, std::string_view text);
+    void setParseTree(NodeId id) { root = id; }
 
     // Optional: Get parse tree root for further processing
-    ParseTreeNode* getParseTree() const { return root; }
+    NodeId getParseTree() const { return root; }
+    const AstArena& getAst() const { return ast; }
+    AstArena& getAst() { return ast; }
 };
 
+// Prints the subtree of id, indented by depth
+void printTreeHelper(const AstArena& ast, NodeId id, int depth = 0);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,213 @@
+// pipeline.cpp
+#include "pipeline.h"
+#include "scanner.h"
+#include "parser.h"
+#include "compiler.h"
+#include "vm.h"
+#include "tables.h"
+#include "simdscan.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+// A program on its way through the stages. Items are allocated once and
+// go back to the reader when reported, keeping their buffers.
+struct PipelineItem {
+    size_t number;
+    string text;
+    CompilationContext context;
+    TokenBuffer tokens;
+    bool scanned;
+    bool accepted;
+    string message;
+    Bytecode bytecode;
+};
+
+// nullptr marks the end of the stream
+typedef SpscQueue<PipelineItem*> ItemQueue;
+
+// Time a stage spends on its items, not waiting for them
+class BusyTimer {
+private:
+    double& total;
+    chrono::steady_clock::time_point start;
+
+public:
+    explicit BusyTimer(double& seconds) : total(seconds), start(chrono::steady_clock::now()) {}
+    ~BusyTimer() { total += chrono::duration<double>(chrono::steady_clock::now() - start).count(); }
+};
+
+// Splits the input into programs, each one ending with its '#' as in
+// batch mode; text of spaces only is skipped
+static void read_stage(istream& in, ItemQueue& free, ItemQueue& out, size_t readSize, double& busy) {
+    const ScanRuns& runs = active_scan_runs();
+    vector<char> buffer(readSize);
+    string pending;
+    size_t number = 0;
+
+    auto emit = [&]() {
+        const char* p = pending.data();
+        if (runs.skipSpace(p, p + pending.size()) < p + pending.size()) {
+            PipelineItem* item = free.pop();
+            BusyTimer timer(busy);
+            item->number = ++number;
+            item->text.swap(pending);   // pending takes over the old buffer
+            out.push(item);
+        }
+        pending.clear();
+    };
+
+    for (;;) {
+        size_t count;
+        {
+            BusyTimer timer(busy);
+            in.read(buffer.data(), static_cast<streamsize>(buffer.size()));
+            count = static_cast<size_t>(in.gcount());
+        }
+        if (count == 0) {
+            break;
+        }
+        const char* p = buffer.data();
+        const char* end = p + count;
+        while (p < end) {
+            const char* hash = runs.findEnd(p, end);
+            if (hash == end) {
+                pending.append(p, end);
+                break;
+            }
+            pending.append(p, hash + 1);
+            emit();
+            p = hash + 1;
+        }
+    }
+    if (!pending.empty()) {
+        emit();
+    }
+    out.push(nullptr);
+}
+
+static void scan_stage(ItemQueue& in, ItemQueue& out, double& busy) {
+    while (PipelineItem* item = in.pop()) {
+        BusyTimer timer(busy);
+        // Every program gets fresh codes
+        item->context.reset();
+        item->scanned = scanner(item->context, item->text, item->tokens);
+        out.push(item);
+    }
+    out.push(nullptr);
+}
+
+static void parse_stage(ItemQueue& in, ItemQueue& out, bool execute, double& busy) {
+    Compiler compiler;
+    while (PipelineItem* item = in.pop()) {
+        BusyTimer timer(busy);
+        item->message.clear();
+        item->accepted = false;
+        if (!item->scanned) {
+            item->message = "Error: program too large";
+            out.push(item);
+            continue;
+        }
+
+        Parser parser(item->tokens, item->context, item->text);
+        item->accepted = parser.parse();
+        if (!item->accepted) {
+            for (const Diagnostic& diagnostic : parser.getDiagnostics()) {
+                if (!item->message.empty()) {
+                    item->message += "; ";
+                }
+                item->message += parser.formatDiagnostic(diagnostic);
+            }
+        }
+        else if (execute) {
+            compiler.compile(item->context, parser.getAst(), parser.getParseTree(), item->bytecode);
+        }
+        out.push(item);
+    }
+    out.push(nullptr);
+}
+
+// Runs the programs and writes their reports in blocks
+static void execute_stage(ItemQueue& in, ItemQueue& free, ostream& out, const PipelineOptions& options,
+    PipelineStats& stats, double& busy) {
+    const size_t FLUSH_SIZE = 1 << 16;
+    OutputBuffer output(nullptr);
+    Vm vm;
+    string report;
+
+    while (PipelineItem* item = in.pop()) {
+        BusyTimer timer(busy);
+        output.clear();
+        if (item->accepted && options.execute &&
+            vm.run(item->bytecode, output, options.maxIterations) == VM_LOOP_LIMIT) {
+            item->message = "stopped after " + to_string(options.maxIterations) + " loop iterations";
+        }
+
+        report += '#';
+        report += to_string(item->number);
+        report += item->accepted ? ": accepted" : ": rejected";
+        if (!item->message.empty()) {
+            report += " (" + item->message + ")";
+        }
+        report += '\n';
+        report += output.text();
+        stats.programs++;
+        stats.accepted += item->accepted;
+        free.push(item);
+
+        if (report.size() >= FLUSH_SIZE) {
+            out.write(report.data(), static_cast<streamsize>(report.size()));
+            report.clear();
+        }
+    }
+    out.write(report.data(), static_cast<streamsize>(report.size()));
+    out.flush();
+}
+
+PipelineStats run_pipeline(istream& in, ostream& out, const PipelineOptions& options) {
+    PipelineStats stats;
+    size_t inFlight = options.inFlight ? options.inFlight : 1;
+    vector<PipelineItem> items(inFlight);
+
+    // Every queue can hold all the items and the end marker, so only the
+    // reader waits for a free item; that bounds the memory in use
+    ItemQueue free(inFlight + 1), toScan(inFlight + 1), toParse(inFlight + 1), toExecute(inFlight + 1);
+    for (PipelineItem& item : items) {
+        free.push(&item);
+    }
+
+    thread reader(read_stage, ref(in), ref(free), ref(toScan), options.readSize, ref(stats.busySeconds[0]));
+    thread scanning(scan_stage, ref(toScan), ref(toParse), ref(stats.busySeconds[1]));
+    thread parsing(parse_stage, ref(toParse), ref(toExecute), options.execute, ref(stats.busySeconds[2]));
+    execute_stage(toExecute, free, out, options, stats, stats.busySeconds[3]);
+
+    reader.join();
+    scanning.join();
+    parsing.join();
+    return stats;
+}
+
+int pipeline_main(const string& input, const PipelineOptions& options) {
+    ifstream file;
+    if (input != "-") {
+        file.open(input, ios::binary);
+        if (!file) {
+            cerr << "Error: cannot open '" << input << "'" << endl;
+            return 2;
+        }
+    }
+    istream& in = (input == "-") ? cin : file;
+
+    auto start = chrono::steady_clock::now();
+    PipelineStats stats = run_pipeline(in, cout, options);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cerr << stats.programs << " programs, " << stats.accepted << " accepted, "
+        << stats.programs - stats.accepted << " rejected in " << seconds * 1000 << " ms (busy: read "
+        << stats.busySeconds[0] * 1000 << " ms, scan " << stats.busySeconds[1] * 1000 << " ms, parse "
+        << stats.busySeconds[2] * 1000 << " ms, execute " << stats.busySeconds[3] * 1000 << " ms)" << endl;
+    return stats.accepted == stats.programs ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+// pipeline.h
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Bounded single-producer single-consumer ring. Each index is written
+// by one side only, so no locks are needed. A full or empty queue first
+// yields a few times, so the other side can work through a run of items,
+// then blocks in std::atomic::wait; waking a thread for every item
+// would cost more than most items take.
+template <typename T>
+class SpscQueue {
+private:
+    static const int YIELDS = 64;
+
+    std::vector<T> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head{ 0 };     // next to pop, written by the consumer
+    alignas(64) std::atomic<size_t> tail{ 0 };     // next to push, written by the producer
+
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size *= 2;
+        }
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    void push(const T& value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        for (int tries = 0;; tries++) {
+            size_t h = head.load(std::memory_order_acquire);
+            if (t - h < slots.size()) {
+                break;
+            }
+            if (tries < YIELDS) {
+                std::this_thread::yield();
+            }
+            else {
+                head.wait(h, std::memory_order_acquire);
+            }
+        }
+        slots[t & mask] = value;
+        tail.store(t + 1, std::memory_order_release);
+        tail.notify_one();
+    }
+
+    T pop() {
+        size_t h = head.load(std::memory_order_relaxed);
+        for (int tries = 0;; tries++) {
+            size_t t = tail.load(std::memory_order_acquire);
+            if (t != h) {
+                break;
+            }
+            if (tries < YIELDS) {
+                std::this_thread::yield();
+            }
+            else {
+                tail.wait(t, std::memory_order_acquire);
+            }
+        }
+        T value = slots[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        head.notify_one();
+        return value;
+    }
+};
+
+struct PipelineOptions {
+    bool execute = false;
+    uint64_t maxIterations = 1000000;
+    size_t inFlight = 64;           // programs between the reader and the reporter
+    size_t readSize = 1 << 16;      // bytes per read
+};
+
+struct PipelineStats {
+    size_t programs = 0;
+    size_t accepted = 0;
+    double busySeconds[4] = {};     // reader, scanner, parser, executor
+};
+
+// Reads '#'-terminated programs from in and writes one report per
+// program to out, in input order, as batch mode does. Reading, scanning,
+// parsing with compiling, and executing with reporting each run on a
+// thread of their own; at most options.inFlight programs are in memory.
+PipelineStats run_pipeline(std::istream& in, std::ostream& out, const PipelineOptions& options);
+
+// YPMT1 --pipeline <file | -> [--exec]
+int pipeline_main(const std::string& input, const PipelineOptions& options);
+
+#endif
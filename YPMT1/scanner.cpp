@@ -1,156 +1,313 @@
 #include "scanner.h"
+#include "language.h"
 #include "tables.h"
+#include "simdscan.h"
+#include "stats.h"
+#include "output.h"
 #include <iostream>
-#include <cctype>
-#include <map>
+#include <climits>
+#include <cstdint>
 
 using namespace std;
 
-map<char, int> operators = {
-    {'=', 4}, {'<', 5}, {'>', 6},
-    {'+', 7}, {'-', 8}, {';', 9}
+// Byte classes of the scanner automaton
+enum CharClass : uint8_t {
+    CC_OTHER,
+    CC_SPACE,
+    CC_LETTER,
+    CC_DIGIT,
+    CC_OPERATOR,
+    CC_END,         // #
+    CC_COUNT
 };
 
-vector<Token> scanner(const string& input) {
-    vector<Token> tokens;
-    int i = 0;
-    int n = input.length();
+// Automaton states
+enum ScanState : uint8_t {
+    ST_START,
+    ST_SPACE,
+    ST_IDENT,
+    ST_NUMBER,
+    ST_OPERATOR,
+    ST_END,
+    ST_ERROR,
+    ST_COUNT
+};
 
-    while (i < n) {
-        char c = input[i];
+struct ScanTables {
+    uint8_t charClass[256];
+};
 
-        if (isspace(c)) {
-            i++;
-            continue;
-        }
+constexpr ScanTables makeScanTables() {
+    ScanTables t{};
+    for (int c = 0; c < 256; c++) {
+        t.charClass[c] = OPERATORS.code[c] != 0 ? CC_OPERATOR : CC_OTHER;
+    }
+    const char spaces[] = " \t\n\v\f\r";
+    for (int i = 0; spaces[i]; i++) {
+        t.charClass[static_cast<uint8_t>(spaces[i])] = CC_SPACE;
+    }
+    for (int c = 'a'; c <= 'z'; c++) {
+        t.charClass[c] = CC_LETTER;
+        t.charClass[c - 'a' + 'A'] = CC_LETTER;
+    }
+    for (int c = '0'; c <= '9'; c++) {
+        t.charClass[c] = CC_DIGIT;
+    }
+    t.charClass[static_cast<uint8_t>('#')] = CC_END;
+    return t;
+}
 
-        if (c == '#') {
-            tokens.push_back({ TOKEN_END, 0 });
-            break;
+constexpr ScanTables scanTables = makeScanTables();
+
+// transitions[state][class]; a token ends when the automaton leaves its state.
+// The self-loops of SPACE, IDENT and NUMBER are run by the functions from
+// simdscan.h, which accept exactly the same bytes and stop at '#'.
+constexpr uint8_t transitions[ST_COUNT][CC_COUNT] = {
+    //            OTHER     SPACE     LETTER    DIGIT      OPERATOR     END
+    /* START  */ { ST_ERROR, ST_SPACE, ST_IDENT, ST_NUMBER, ST_OPERATOR, ST_END },
+    /* SPACE  */ { ST_START, ST_SPACE, ST_START, ST_START,  ST_START,    ST_START },
+    /* IDENT  */ { ST_START, ST_START, ST_IDENT, ST_IDENT,  ST_START,    ST_START },
+    /* NUMBER */ { ST_START, ST_START, ST_START, ST_NUMBER, ST_START,    ST_START },
+    /* OPER   */ { ST_START, ST_START, ST_START, ST_START,  ST_START,    ST_START },
+    /* END    */ { ST_START, ST_START, ST_START, ST_START,  ST_START,    ST_START },
+    /* ERROR  */ { ST_START, ST_START, ST_START, ST_START,  ST_START,    ST_START }
+};
+
+static inline uint8_t classOf(char c) {
+    return scanTables.charClass[static_cast<uint8_t>(c)];
+}
+
+// False if the number is out of range, value is INT_MAX then
+static bool number_value(const char* s, size_t len, int& value) {
+    if (len <= 9) {
+        value = 0;
+        for (size_t i = 0; i < len; i++) {
+            value = value * 10 + (s[i] - '0');
         }
+        return true;
+    }
 
-        if (isalpha(c)) {
-            string ident;
-            while (i < n && (isalnum(input[i]))) {
-                ident += input[i];
-                i++;
-            }
+    uint64_t wide = 0;
+    for (size_t i = 0; i < len && wide <= INT_MAX; i++) {
+        wide = wide * 10 + (s[i] - '0');
+    }
+    value = wide > INT_MAX ? INT_MAX : static_cast<int>(wide);
+    return wide <= INT_MAX;
+}
+
+Lexer::Lexer(string_view input)
+    : Lexer(default_context(), input) {
+}
+
+Lexer::Lexer(CompilationContext& context, string_view input, size_t start)
+    : begin(input.data()), pos(input.data() + start), end(input.data() + input.size()),
+    runs(&active_scan_runs()), ctx(&context) {
+}
+
+void Lexer::scanError(ParseErrorCode code, const char* start, const char* stop) {
+    Diagnostic diagnostic = { code, TOKEN_END, -1, { TOKEN_END, 0 } };
+    diagnostic.at.setSpan(start - begin, stop - start);
+    scanErrors.push_back(diagnostic);
+}
+
+bool Lexer::next(Token& token) {
+    STATS_PHASE(PHASE_SCAN);
+    const char* p = pos;
 
+    while (p < end) {
+        const char* start = p;
+        uint8_t state = transitions[ST_START][classOf(*p)];
+
+        // Runs of the looping states longer than one byte are skipped in blocks
+        p++;
+        if (p < end && transitions[state][classOf(*p)] == state) {
+            RunFunction run = (state == ST_SPACE) ? runs->skipSpace :
+                (state == ST_IDENT) ? runs->skipAlnum : runs->skipDigits;
+            p = run(p + 1, end);
+        }
+
+        switch (state) {
+        case ST_SPACE:
+            continue;
+        case ST_IDENT: {
+            string_view ident(start, p - start);
             int kw_code = find_word(ident);
             if (kw_code > 0) {
-                tokens.push_back({ TOKEN_WORD, kw_code });
+                token = { TOKEN_WORD, kw_code };
             }
             else {
-                int id_code = make_id(ident);
-                tokens.push_back({ TOKEN_ID, id_code });
+                token = { TOKEN_ID, ctx->make_id(ident) };
             }
-            continue;
+            break;
         }
-
-        if (isdigit(c)) {
-            string num_str;
-            while (i < n && isdigit(input[i])) {
-                num_str += input[i];
-                i++;
+        case ST_NUMBER: {
+            int value;
+            if (!number_value(start, p - start, value)) {
+                scanError(ERR_NUMBER_RANGE, start, p);
             }
-            int value = stoi(num_str);
-            int const_code = make_dig(value);
-            tokens.push_back({ TOKEN_DIG, const_code });
-            continue;
+            token = { TOKEN_DIG, ctx->make_dig(value) };
+            break;
         }
-
-        auto op_it = operators.find(c);
-        if (op_it != operators.end()) {
-            tokens.push_back({ TOKEN_WORD, op_it->second });
-            i++;
+        case ST_OPERATOR:
+            token = { TOKEN_WORD, OPERATORS.code[static_cast<uint8_t>(*start)] };
+            break;
+        case ST_END:
+            token = { TOKEN_END, 0 };
+            token.setSpan(start - begin, 1);
+            pos = end;  // nothing after # is scanned
+            STATS_ADD(tokens, 1);
+            return true;
+        default:
+            scanError(ERR_UNKNOWN_CHARACTER, start, p);
             continue;
         }
 
-        cout << "Error: unknown character '" << c << "'" << endl;
-        i++;
+        token.setSpan(start - begin, p - start);
+        pos = p;
+        STATS_ADD(tokens, 1);
+        return true;
     }
 
-    return tokens;
+    pos = p;
+    token = { TOKEN_END, 0 };
+    token.setSpan(p - begin, 0);
+    return false;
 }
 
-void print_tokens(const vector<Token>& tokens) {
-    for (const auto& token : tokens) {
-        switch (token.type) {
-        case TOKEN_ID:
-            cout << "(ID," << token.code << ") ";
-            break;
-        case TOKEN_DIG:
-            cout << "(DIG," << token.code << ") ";
-            break;
-        case TOKEN_WORD:
-            cout << "(WORD," << token.code << ") ";
-            break;
-        case TOKEN_END:
-            cout << "(END,0) ";
-            break;
+SourcePosition Token::position(string_view source) const {
+    SourcePosition where = { 1, 1 };
+    size_t lineStart = 0;
+    size_t stop = offset() < source.size() ? offset() : source.size();
+    for (size_t i = 0; i < stop; i++) {
+        if (source[i] == '\n') {
+            where.line++;
+            lineStart = i + 1;
         }
     }
-    cout << endl;
+    where.column = stop - lineStart + 1;
+    return where;
 }
 
-void demonstrate_token_correspondence(const string& input, const vector<Token>& tokens) {
-    cout << "\nToken to source code correspondence:" << endl;
+vector<Token> scanner(string_view input) {
+    return scanner(default_context(), input);
+}
 
-    vector<string> token_strings;
-    int i = 0;
-    int n = input.length();
+vector<Token> scanner(CompilationContext& context, string_view input) {
+    STATS_PHASE(PHASE_SCAN);
+    vector<Token> tokens;
+    Lexer lexer(context, input);
+    Token token;
 
-    while (i < n && input[i] != '#') {
-        if (isspace(input[i])) {
-            i++;
-            continue;
-        }
+    while (lexer.next(token)) {
+        tokens.push_back(token);
+    }
 
-        if (isalpha(input[i])) {
-            string ident;
-            while (i < n && isalnum(input[i])) {
-                ident += input[i];
-                i++;
-            }
-            token_strings.push_back(ident);
-            continue;
-        }
+    for (const Diagnostic& error : lexer.errors()) {
+        cout << "Error: " << (error.code == ERR_UNKNOWN_CHARACTER ? "unknown character '" : "number out of range '")
+            << error.at.lexeme(input) << "'" << endl;
+    }
+    return tokens;
+}
 
-        if (isdigit(input[i])) {
-            string num;
-            while (i < n && isdigit(input[i])) {
-                num += input[i];
-                i++;
-            }
-            token_strings.push_back(num);
-            continue;
+size_t token_length(string_view source, size_t offset) {
+    if (offset >= source.size()) {
+        return 0;
+    }
+    uint8_t state = transitions[ST_START][classOf(source[offset])];
+    if (state == ST_SPACE || state == ST_ERROR) {
+        return 0;       // no token starts here
+    }
+    size_t end = offset + 1;
+    if (state == ST_IDENT || state == ST_NUMBER) {
+        while (end < source.size() && transitions[state][classOf(source[end])] == state) {
+            end++;
         }
+    }
+    return end - offset;
+}
 
-        if (operators.find(input[i]) != operators.end()) {
-            token_strings.push_back(string(1, input[i]));
-            i++;
-            continue;
-        }
+void TokenBuffer::reserve(size_t tokens) {
+    packed.reserve(tokens + SENTINELS);
+    offsets.reserve(tokens + SENTINELS);
+}
 
-        i++;
+void TokenBuffer::finish(size_t end) {
+    Token token = { TOKEN_END, 0 };
+    token.setSpan(end, 0);
+    for (size_t i = 0; i <= SENTINELS; i++) {
+        push(token);
     }
+    count = packed.size() - SENTINELS;
+}
 
-    for (size_t j = 0; j < tokens.size() && j < token_strings.size(); j++) {
-        string token_type;
-        switch (tokens[j].type) {
-        case TOKEN_ID: token_type = "ID"; break;
-        case TOKEN_DIG: token_type = "DIG"; break;
-        case TOKEN_WORD:
-            if (keywords.find(token_strings[j]) != keywords.end()) {
-                token_type = "KEYWORD";
-            }
-            else {
-                token_type = "OPERATOR";
-            }
-            break;
-        case TOKEN_END: token_type = "END"; break;
+Token TokenBuffer::at(size_t i, string_view source) const {
+    Token token = { token_kind(packed[i]), token_code(packed[i]) };
+    token.setSpan(offsets[i], token_length(source, offsets[i]));
+    return token;
+}
+
+bool scanner(CompilationContext& context, string_view input, TokenBuffer& out) {
+    STATS_PHASE(PHASE_SCAN);
+    out.clear();
+    if (input.size() > UINT32_MAX) {
+        cout << "Error: input of " << input.size() << " bytes is too large for a token buffer" << endl;
+        out.finish(0);
+        return false;
+    }
+    // About one token per 4 bytes of typical source
+    out.reserve(input.size() / 4 + 16);
+
+    // Without '#' the END token follows the last token, as the parser
+    // does for a token vector
+    Lexer lexer(context, input);
+    Token token;
+    size_t end = 0;
+    while (lexer.next(token)) {
+        if (token.type == TOKEN_END) {
+            end = token.offset();
+            break;      // finish() appends it
         }
+        if (token.code >= PACKED_CODE_LIMIT) {
+            cout << "Error: more than " << PACKED_CODE_LIMIT << " names or constants for a token buffer" << endl;
+            out.clear();
+            out.finish(0);
+            return false;
+        }
+        out.push(token);
+        end = token.offset() + token.length();
+    }
+    out.finish(end);
+    out.setErrors(lexer.errors());
+    return true;
+}
+
+void print_tokens(const vector<Token>& tokens) {
+    OutputBuffer out;
+    Emitter(out).tokens(tokens);
+}
+
+void demonstrate_token_correspondence(string_view input, const vector<Token>& tokens) {
+    OutputBuffer out;
+    out.put("\nToken to source code correspondence:\n");
+    Emitter(out).lexemes(input, tokens);
+}
 
-        cout << token_strings[j] << " \t-> (" << token_type << "," << tokens[j].code << ")" << endl;
+void print_state_diagram() {
+    static const char* stateNames[ST_COUNT] = {
+        "START", "SPACE", "IDENT", "NUMBER", "OPER", "END", "ERROR"
+    };
+
+    cout << "\nSCANNER STATE DIAGRAM (transition table)" << endl;
+    cout << "Classes: OTHER, SPACE, LETTER, DIGIT, OPERATOR (= < > + - ;), END (#)" << endl;
+    cout << "State  \tOTHER\tSPACE\tLETTER\tDIGIT\tOPER\tEND" << endl;
+    for (int st = 0; st < ST_COUNT; st++) {
+        cout << stateNames[st];
+        for (int cc = 0; cc < CC_COUNT; cc++) {
+            cout << "\t" << stateNames[transitions[st][cc]];
+        }
+        cout << endl;
     }
+    cout << "A token is emitted when the automaton returns to START:" << endl;
+    cout << "IDENT -> keyword or (ID,code), NUMBER -> (DIG,code), OPER -> (WORD,code)," << endl;
+    cout << "END -> (END,0), ERROR -> unknown character" << endl;
 }
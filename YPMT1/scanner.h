@@ -2,8 +2,11 @@
 #ifndef SCANNER_H
 #define SCANNER_H
 
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 #include <string>
+#include <string_view>
 
 // Token types
 enum TokenTypeEnum {
@@ -13,16 +16,155 @@ enum TokenTypeEnum {
     TOKEN_END      // end of program #
 };
 
+struct SourcePosition {
+    size_t line;        // from 1
+    size_t column;      // from 1, in bytes
+};
+
 // Token structure
 struct Token {
     TokenTypeEnum type;
     int code;      // code in the corresponding table
+    uint64_t span = 0; // source bytes: offset in the low 40 bits, length in the high 24
+
+    static const uint64_t OFFSET_BITS = 40;
+    static const uint64_t MAX_LENGTH = (1u << 24) - 1;
+
+    size_t offset() const { return static_cast<size_t>(span & ((uint64_t(1) << OFFSET_BITS) - 1)); }
+    size_t length() const { return static_cast<size_t>(span >> OFFSET_BITS); }
+    void setSpan(size_t offset, size_t length) {
+        span = static_cast<uint64_t>(offset) |
+            (static_cast<uint64_t>(length < MAX_LENGTH ? length : MAX_LENGTH) << OFFSET_BITS);
+    }
+
+    // Source text of the token, source is the scanned input
+    std::string_view lexeme(std::string_view source) const { return source.substr(offset(), length()); }
+    // Line and column are counted only when asked for
+    SourcePosition position(std::string_view source) const;
+};
+
+static_assert(sizeof(Token) <= 16, "Token must stay within 16 bytes");
+
+// Lexical and syntax errors. Messages are built from the code only when
+// asked for, see Parser::formatDiagnostic.
+enum ParseErrorCode : uint8_t {
+    ERR_EXPECTED_TOKEN,         // a specific token, see Diagnostic::expected
+    ERR_UNEXPECTED_CODE,
+    ERR_STATEMENT_AFTER_DO,
+    ERR_WHILE_AFTER_BODY,
+    ERR_ASSIGN_AFTER_ID,
+    ERR_ID_AFTER_PRINT,
+    ERR_STATEMENT,
+    ERR_CONDITION,
+    ERR_RELATION,
+    ERR_CONDITION_RIGHT,
+    ERR_TERM,
+    ERR_TERM_AFTER_OP,
+    ERR_OPERAND,
+    ERR_UNKNOWN_CHARACTER,      // found by the lexer, like the next one
+    ERR_NUMBER_RANGE
+};
+
+struct Diagnostic {
+    ParseErrorCode code;
+    TokenTypeEnum expected;     // for ERR_EXPECTED_TOKEN
+    int expectedCode;
+    Token at;                   // token the error was found at
+};
+
+// Packed token: kind in the low 4 bits, table code in the high 28
+typedef uint32_t PackedToken;
+
+const int PACKED_CODE_LIMIT = 1 << 28;     // codes below it fit
+
+inline PackedToken pack_token(TokenTypeEnum type, int code) {
+    return static_cast<uint32_t>(type) | (static_cast<uint32_t>(code) << 4);
+}
+inline TokenTypeEnum token_kind(PackedToken token) { return static_cast<TokenTypeEnum>(token & 15); }
+inline int token_code(PackedToken token) { return static_cast<int>(token >> 4); }
+
+// Length of the token that starts at offset, 0 at the end of the source
+// or where no token starts; the automaton decides it from the first byte
+size_t token_length(std::string_view source, size_t offset);
+
+// Token stream as a structure of arrays: the packed tokens the parser
+// walks, and the offsets of their first bytes (lengths are scanned again
+// when needed). 8 bytes per token instead of 16. The stream always ends
+// with an END token followed by END sentinels, so a reader can look ahead
+// without a bounds check. Sources up to 4 GB, with codes below
+// PACKED_CODE_LIMIT.
+class TokenBuffer {
+private:
+    std::vector<PackedToken> packed;
+    std::vector<uint32_t> offsets;
+    size_t count = 0;       // tokens up to and including the END token
+    std::vector<Diagnostic> scanErrors;
+
+public:
+    static const size_t SENTINELS = 2;
+
+    void clear() { packed.clear(); offsets.clear(); count = 0; scanErrors.clear(); }
+    void reserve(size_t tokens);
+    void push(const Token& token) {
+        packed.push_back(pack_token(token.type, token.code));
+        offsets.push_back(static_cast<uint32_t>(token.offset()));
+    }
+    // Appends the END token at offset end, and the sentinels after it
+    void finish(size_t end);
+
+    size_t size() const { return count; }
+    const PackedToken* tokens() const { return packed.data(); }
+    const uint32_t* starts() const { return offsets.data(); }
+    // Unknown characters and numbers out of range, in source order
+    const std::vector<Diagnostic>& errors() const { return scanErrors; }
+    void setErrors(const std::vector<Diagnostic>& list) { scanErrors = list; }
+    size_t memoryUsed() const { return packed.capacity() * sizeof(PackedToken) + offsets.capacity() * sizeof(uint32_t); }
+
+    // Unpacked token i with its span, source is the scanned input
+    Token at(size_t i, std::string_view source) const;
+};
+
+struct ScanRuns;
+class CompilationContext;
+
+// Pull-based scanner: produces the tokens of the input one at a time
+class Lexer {
+private:
+    const char* begin;
+    const char* pos;
+    const char* end;
+    const ScanRuns* runs;
+    CompilationContext* ctx;
+    std::vector<Diagnostic> scanErrors;
+
+    void scanError(ParseErrorCode code, const char* start, const char* stop);
+
+public:
+    explicit Lexer(std::string_view input);     // default context of the thread
+    // Scanning starts at offset start, spans are relative to the whole input
+    Lexer(CompilationContext& context, std::string_view input, size_t start = 0);
+
+    CompilationContext& context() const { return *ctx; }
+
+    // Stores the next token, returns false when the input is exhausted
+    // (after the END token or at the end of input without '#'); then
+    // token is an END token with an empty span at the end of the input.
+    bool next(Token& token);
+    // Unknown characters (skipped) and numbers out of range (scanned as
+    // INT_MAX) so far, for the parser to report
+    const std::vector<Diagnostic>& errors() const { return scanErrors; }
+
+    std::string_view source() const { return std::string_view(begin, end - begin); }
 };
 
-// Scanner functions
-std::vector<Token> scanner(const std::string& input);
+// Scanner functions. The token vector versions print lexical errors, the
+// token buffer keeps them.
+std::vector<Token> scanner(std::string_view input);
+std::vector<Token> scanner(CompilationContext& context, std::string_view input);
+// Into a token buffer; false if the input is too large for one
+bool scanner(CompilationContext& context, std::string_view input, TokenBuffer& out);
 void print_tokens(const std::vector<Token>& tokens);
-void demonstrate_token_correspondence(const std::string& input,
+void demonstrate_token_correspondence(std::string_view input,
     const std::vector<Token>& tokens);
 void print_state_diagram();
 
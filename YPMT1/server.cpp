@@ -0,0 +1,297 @@
+// server.cpp
+#include "server.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static void put32(char* p, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = static_cast<char>(value >> (8 * i));
+    }
+}
+
+static uint32_t get32(const unsigned char* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// The parser needs tokens to start with: an empty program
+static const TokenBuffer& finished(TokenBuffer& buffer) {
+    buffer.finish(0);
+    return buffer;
+}
+
+CheckServer::CheckServer()
+    : parser(finished(tokens), context), output(nullptr), text(nullptr), plain(text), json(text, FORMAT_JSON) {
+}
+
+void CheckServer::section(string& response, ReplySection kind, string_view data) {
+    char header[5];
+    header[0] = static_cast<char>(kind);
+    put32(header + 1, static_cast<uint32_t>(data.size()));
+    response.append(header, sizeof header);
+    response.append(data);
+}
+
+void CheckServer::handle(uint8_t flags, string_view program, string& response) {
+    response.assign(REQUEST_HEADER_SIZE, '\0');
+    context.reset();
+    if (!scanner(context, program, tokens)) {
+        section(response, REPLY_ERRORS, "Error: program too large for a token buffer\n");
+        put32(&response[0], static_cast<uint32_t>(response.size() - REQUEST_HEADER_SIZE));
+        response[4] = static_cast<char>(RESPONSE_REJECTED);
+        return;
+    }
+    // Unknown characters and numbers out of range come with the tokens,
+    // the parser reports them with its own errors
+    parser.setTokens(tokens, program);
+    bool accepted = parser.parse();
+    ResponseStatus status = accepted ? RESPONSE_ACCEPTED : RESPONSE_REJECTED;
+
+    if (!accepted) {
+        text.clear();
+        for (const Diagnostic& diagnostic : parser.getDiagnostics()) {
+            text.put(parser.formatDiagnostic(diagnostic));
+            text.put('\n');
+        }
+        section(response, REPLY_ERRORS, text.text());
+    }
+
+    Emitter& emitter = (flags & REQUEST_JSON) ? json : plain;
+    if (flags & REQUEST_TOKENS) {
+        text.clear();
+        emitter.tokens(tokens);
+        section(response, REPLY_TOKENS, text.text());
+    }
+
+    if (accepted && (flags & REQUEST_TREE)) {
+        text.clear();
+        emitter.tree(parser.getAst(), parser.getParseTree());
+        section(response, REPLY_TREE, text.text());
+    }
+
+    if (accepted && (flags & REQUEST_EXECUTE)) {
+        compiler.compile(context, parser.getAst(), parser.getParseTree(), bytecode);
+        output.clear();
+        if (vm.run(bytecode, output, maxIterations) == VM_LOOP_LIMIT) {
+            status = RESPONSE_LOOP_LIMIT;
+        }
+        section(response, REPLY_OUTPUT, output.text());
+    }
+
+    put32(&response[0], static_cast<uint32_t>(response.size() - REQUEST_HEADER_SIZE));
+    response[4] = static_cast<char>(status);
+}
+
+#ifdef _WIN32
+static int readSome(int fd, char* data, size_t size) {
+    return _read(fd, data, static_cast<unsigned>(min<size_t>(size, 1 << 30)));
+}
+static int writeSome(int fd, const char* data, size_t size) {
+    return _write(fd, data, static_cast<unsigned>(min<size_t>(size, 1 << 30)));
+}
+#else
+static ssize_t readSome(int fd, char* data, size_t size) {
+    ssize_t n;
+    do {
+        n = read(fd, data, size);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+static ssize_t writeSome(int fd, const char* data, size_t size) {
+    ssize_t n;
+    do {
+        n = write(fd, data, size);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+#endif
+
+// False at the end of the input or on an error
+static bool readFully(int fd, char* data, size_t size) {
+    while (size > 0) {
+        auto n = readSome(fd, data, size);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool writeFully(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        auto n = writeSome(fd, data, size);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Requests until the client closes its end, or sends one that is too large
+static void serve_connection(int in, int out, CheckServer& server) {
+    string request, response;
+    for (;;) {
+        unsigned char header[REQUEST_HEADER_SIZE];
+        if (!readFully(in, reinterpret_cast<char*>(header), sizeof header)) {
+            return;
+        }
+        uint32_t length = get32(header);
+        if (length > MAX_REQUEST_SIZE) {
+            char reply[REQUEST_HEADER_SIZE] = { 0, 0, 0, 0, static_cast<char>(RESPONSE_BAD_REQUEST) };
+            writeFully(out, reply, sizeof reply);
+            return;
+        }
+        request.resize(length);
+        if (!readFully(in, request.data(), length)) {
+            return;
+        }
+        server.handle(header[4], request, response);
+        if (!writeFully(out, response.data(), response.size())) {
+            return;
+        }
+    }
+}
+
+static int serve_stdio(CheckServer& server) {
+    // Responses go to the original stdout; anything else printed on the
+    // way (the reason a scan failed) goes to stderr, not into the frames
+#ifdef _WIN32
+    int out = _dup(1);
+    _dup2(2, 1);
+    _setmode(0, _O_BINARY);
+    _setmode(out, _O_BINARY);
+#else
+    int out = dup(1);
+    dup2(2, 1);
+#endif
+    serve_connection(0, out, server);
+    return 0;
+}
+
+#ifndef _WIN32
+// Frees the socket path for bind. Only a socket nobody listens on any
+// more is removed; any other file, or a socket of a running server,
+// stays and the path is refused.
+static bool claimSocketPath(const string& path, const sockaddr_un& address) {
+    struct stat status;
+    if (lstat(path.c_str(), &status) < 0) {
+        if (errno == ENOENT) {
+            return true;
+        }
+        cerr << "Error: cannot check '" << path << "': " << strerror(errno) << endl;
+        return false;
+    }
+    if (!S_ISSOCK(status.st_mode)) {
+        cerr << "Error: '" << path << "' exists and is not a socket" << endl;
+        return false;
+    }
+
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe < 0) {
+        cerr << "Error: cannot create a socket: " << strerror(errno) << endl;
+        return false;
+    }
+    int connected = connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof address);
+    int reason = errno;
+    close(probe);
+    if (connected == 0) {
+        cerr << "Error: another server is listening on '" << path << "'" << endl;
+        return false;
+    }
+    if (reason != ECONNREFUSED) {
+        cerr << "Error: cannot check '" << path << "': " << strerror(reason) << endl;
+        return false;
+    }
+    // Left behind by a server that did not exit cleanly
+    if (unlink(path.c_str()) < 0) {
+        cerr << "Error: cannot remove the stale socket '" << path << "': " << strerror(errno) << endl;
+        return false;
+    }
+    return true;
+}
+#endif
+
+static int serve_socket(CheckServer& server, const string& path) {
+#ifdef _WIN32
+    (void)server;
+    cerr << "Error: no Unix domain sockets on this host, serving '" << path << "' needs a POSIX system" << endl;
+    return 2;
+#else
+    sockaddr_un address;
+    memset(&address, 0, sizeof address);
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof address.sun_path) {
+        cerr << "Error: socket path '" << path << "' is too long" << endl;
+        return 2;
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    if (!claimSocketPath(path, address)) {
+        return 2;
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        cerr << "Error: cannot create a socket: " << strerror(errno) << endl;
+        return 2;
+    }
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof address) < 0) {
+        cerr << "Error: cannot listen on '" << path << "': " << strerror(errno) << endl;
+        close(listener);
+        return 2;
+    }
+    if (listen(listener, 16) < 0) {
+        cerr << "Error: cannot listen on '" << path << "': " << strerror(errno) << endl;
+        close(listener);
+        unlink(path.c_str());
+        return 2;
+    }
+    // The socket file this process created, the only one it removes
+    struct stat created;
+    bool owned = lstat(path.c_str(), &created) == 0;
+
+    // A client that goes away is noticed by the failing write
+    signal(SIGPIPE, SIG_IGN);
+    cerr << "Listening on " << path << endl;
+    for (;;) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            cerr << "Error: accept failed: " << strerror(errno) << endl;
+            break;
+        }
+        serve_connection(client, client, server);
+        close(client);
+    }
+    close(listener);
+    struct stat current;
+    if (owned && lstat(path.c_str(), &current) == 0 && current.st_dev == created.st_dev && current.st_ino == created.st_ino) {
+        unlink(path.c_str());
+    }
+    return 2;
+#endif
+}
+
+int serve_main(const string& socketPath) {
+    CheckServer server;
+    return socketPath.empty() ? serve_stdio(server) : serve_socket(server, socketPath);
+}
@@ -0,0 +1,82 @@
+// server.h
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "scanner.h"
+#include "parser.h"
+#include "compiler.h"
+#include "vm.h"
+#include "tables.h"
+#include "output.h"
+
+// Check server protocol. All integers are little-endian.
+//
+// Request:  u32 length, u8 flags, length bytes of program text ('#' optional)
+// Response: u32 length, u8 status, length bytes of sections
+// Section:  u8 kind, u32 length, length bytes of text
+//
+// A rejected program always gets an errors section, one diagnostic per
+// line, lexical errors included; the other sections come only when their
+// flag is set.
+enum RequestFlags : uint8_t {
+    REQUEST_TOKENS = 1,
+    REQUEST_TREE = 2,
+    REQUEST_EXECUTE = 4,
+    REQUEST_JSON = 8        // tokens and tree as JSON, see output.h
+};
+
+enum ResponseStatus : uint8_t {
+    RESPONSE_ACCEPTED,
+    RESPONSE_REJECTED,
+    RESPONSE_LOOP_LIMIT,    // accepted, execution stopped after the iteration limit
+    RESPONSE_BAD_REQUEST    // too large; the connection is closed after it
+};
+
+enum ReplySection : uint8_t {
+    REPLY_ERRORS = 'E',
+    REPLY_TOKENS = 'K',
+    REPLY_TREE = 'T',
+    REPLY_OUTPUT = 'O'
+};
+
+const size_t REQUEST_HEADER_SIZE = 5;
+const size_t MAX_REQUEST_SIZE = 1 << 26;
+
+// Handles requests one after another with the same tables, token
+// buffer, tree arena and registers. Once they have grown to fit, checking
+// an accepted program allocates nothing; error messages and trees are
+// still built as strings.
+class CheckServer {
+private:
+    CompilationContext context;
+    TokenBuffer tokens;
+    Parser parser;
+    Compiler compiler;
+    Bytecode bytecode;
+    Vm vm;
+    OutputBuffer output;
+    OutputBuffer text;
+    Emitter plain;
+    Emitter json;
+
+    void section(std::string& response, ReplySection kind, std::string_view data);
+
+public:
+    uint64_t maxIterations = 1000000;
+
+    CheckServer();
+
+    // Replaces response with the frame for the request
+    void handle(uint8_t flags, std::string_view program, std::string& response);
+};
+
+// YPMT1 --serve [socket path]: framed requests on stdin and responses on
+// stdout, or connections on a Unix domain socket, one at a time. A stale
+// socket at the path is replaced; any other file there is an error.
+int serve_main(const std::string& socketPath);
+
+#endif
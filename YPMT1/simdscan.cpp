@@ -0,0 +1,211 @@
+// simdscan.cpp
+#include "simdscan.h"
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMDSCAN_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// Scalar versions
+
+static inline bool isSpaceByte(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline bool isDigitByte(unsigned char c) {
+    return static_cast<unsigned char>(c - '0') < 10;
+}
+
+static inline bool isAlnumByte(unsigned char c) {
+    return isDigitByte(c) || static_cast<unsigned char>((c | 0x20) - 'a') < 26;
+}
+
+static const char* skipSpaceScalar(const char* p, const char* end) {
+    while (p < end && isSpaceByte(*p)) p++;
+    return p;
+}
+
+static const char* skipAlnumScalar(const char* p, const char* end) {
+    while (p < end && isAlnumByte(*p)) p++;
+    return p;
+}
+
+static const char* skipDigitsScalar(const char* p, const char* end) {
+    while (p < end && isDigitByte(*p)) p++;
+    return p;
+}
+
+static const char* findEndScalar(const char* p, const char* end) {
+    while (p < end && *p != '#') p++;
+    return p;
+}
+
+#ifdef SIMDSCAN_X86
+
+static inline unsigned countTrailingZeros(uint32_t mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+// SSE2: 16 bytes per step. Bytes >= 0x80 are negative as signed chars,
+// so the signed range checks below never accept them.
+
+static inline __m128i spaceMask16(__m128i x) {
+    __m128i sp = _mm_cmpeq_epi8(x, _mm_set1_epi8(' '));
+    __m128i ctl = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('\t' - 1)),
+        _mm_cmplt_epi8(x, _mm_set1_epi8('\r' + 1)));
+    return _mm_or_si128(sp, ctl);
+}
+
+static inline __m128i digitMask16(__m128i x) {
+    return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('0' - 1)),
+        _mm_cmplt_epi8(x, _mm_set1_epi8('9' + 1)));
+}
+
+static inline __m128i alnumMask16(__m128i x) {
+    __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+        _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+    return _mm_or_si128(alpha, digitMask16(x));
+}
+
+#define SSE2_RUN(name, maskExpr, scalar)                                      \
+    static const char* name(const char* p, const char* end) {                \
+        while (end - p >= 16) {                                              \
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); \
+            uint32_t stop = ~static_cast<uint32_t>(_mm_movemask_epi8(maskExpr)) & 0xFFFF; \
+            if (stop) return p + countTrailingZeros(stop);                    \
+            p += 16;                                                         \
+        }                                                                    \
+        return scalar(p, end);                                               \
+    }
+
+SSE2_RUN(skipSpaceSse2, spaceMask16(x), skipSpaceScalar)
+SSE2_RUN(skipAlnumSse2, alnumMask16(x), skipAlnumScalar)
+SSE2_RUN(skipDigitsSse2, digitMask16(x), skipDigitsScalar)
+
+static const char* findEndSse2(const char* p, const char* end) {
+    const __m128i hash = _mm_set1_epi8('#');
+    while (end - p >= 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        uint32_t hit = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, hash)));
+        if (hit) return p + countTrailingZeros(hit);
+        p += 16;
+    }
+    return findEndScalar(p, end);
+}
+
+// AVX2: 32 bytes per step
+
+TARGET_AVX2 static inline __m256i spaceMask32(__m256i x) {
+    __m256i sp = _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' '));
+    __m256i ctl = _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('\t' - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), x));
+    return _mm256_or_si256(sp, ctl);
+}
+
+TARGET_AVX2 static inline __m256i digitMask32(__m256i x) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('0' - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), x));
+}
+
+TARGET_AVX2 static inline __m256i alnumMask32(__m256i x) {
+    __m256i lower = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+    __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+    return _mm256_or_si256(alpha, digitMask32(x));
+}
+
+#define AVX2_RUN(name, maskExpr, tail)                                          \
+    TARGET_AVX2 static const char* name(const char* p, const char* end) {      \
+        while (end - p >= 32) {                                                \
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); \
+            uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(maskExpr)); \
+            if (stop) return p + countTrailingZeros(stop);                      \
+            p += 32;                                                           \
+        }                                                                      \
+        return tail(p, end);                                                   \
+    }
+
+AVX2_RUN(skipSpaceAvx2, spaceMask32(x), skipSpaceSse2)
+AVX2_RUN(skipAlnumAvx2, alnumMask32(x), skipAlnumSse2)
+AVX2_RUN(skipDigitsAvx2, digitMask32(x), skipDigitsSse2)
+
+TARGET_AVX2 static const char* findEndAvx2(const char* p, const char* end) {
+    const __m256i hash = _mm256_set1_epi8('#');
+    while (end - p >= 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        uint32_t hit = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, hash)));
+        if (hit) return p + countTrailingZeros(hit);
+        p += 32;
+    }
+    return findEndSse2(p, end);
+}
+
+static bool cpuHasAvx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+static const ScanRuns scalarRuns = {
+    "scalar", skipSpaceScalar, skipAlnumScalar, skipDigitsScalar, findEndScalar
+};
+
+#ifdef SIMDSCAN_X86
+static const ScanRuns sse2Runs = {
+    "sse2", skipSpaceSse2, skipAlnumSse2, skipDigitsSse2, findEndSse2
+};
+
+static const ScanRuns avx2Runs = {
+    "avx2", skipSpaceAvx2, skipAlnumAvx2, skipDigitsAvx2, findEndAvx2
+};
+#endif
+
+const ScanRuns& scalar_scan_runs() {
+    return scalarRuns;
+}
+
+const ScanRuns& simd_scan_runs() {
+#ifdef SIMDSCAN_X86
+    static const ScanRuns& best = cpuHasAvx2() ? avx2Runs : sse2Runs;
+    return best;
+#else
+    return scalarRuns;
+#endif
+}
+
+static const ScanRuns* activeRuns = &simd_scan_runs();
+
+const ScanRuns& active_scan_runs() {
+    return *activeRuns;
+}
+
+void select_scan_runs(const ScanRuns& runs) {
+    activeRuns = &runs;
+}
@@ -0,0 +1,26 @@
+// simdscan.h
+#ifndef SIMDSCAN_H
+#define SIMDSCAN_H
+
+// Each function returns the first position in [p, end) that does not
+// belong to the run (or end); find_end returns the first '#' (or end).
+typedef const char* (*RunFunction)(const char* p, const char* end);
+
+struct ScanRuns {
+    const char* name;
+    RunFunction skipSpace;
+    RunFunction skipAlnum;
+    RunFunction skipDigits;
+    RunFunction findEnd;
+};
+
+// Implementations; the SIMD one is the best the CPU supports
+// (AVX2, SSE2) or the scalar one on other hosts.
+const ScanRuns& scalar_scan_runs();
+const ScanRuns& simd_scan_runs();
+
+// Implementation used by scanner(), chosen at startup
+const ScanRuns& active_scan_runs();
+void select_scan_runs(const ScanRuns& runs);
+
+#endif
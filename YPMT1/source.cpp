@@ -0,0 +1,145 @@
+// source.cpp
+#include "source.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+using namespace std;
+
+static const char emptyText[] = "";
+
+#ifdef _WIN32
+
+MappedFile::MappedFile()
+    : data(emptyText), size(0), fileHandle(INVALID_HANDLE_VALUE), mappingHandle(nullptr) {
+}
+
+bool MappedFile::open(const string& path) {
+    close();
+
+    // The sequential scan flag enables aggressive read-ahead
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        errorMessage = "cannot open '" + path + "'";
+        return false;
+    }
+    fileHandle = file;
+
+    LARGE_INTEGER length;
+    if (!GetFileSizeEx(file, &length)) {
+        errorMessage = "cannot get size of '" + path + "'";
+        close();
+        return false;
+    }
+    if (length.QuadPart == 0) {
+        return true;
+    }
+    if (static_cast<unsigned long long>(length.QuadPart) > SIZE_MAX) {
+        errorMessage = "'" + path + "' is too large to map in this process";
+        close();
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        errorMessage = "cannot map '" + path + "'";
+        close();
+        return false;
+    }
+    mappingHandle = mapping;
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        errorMessage = "cannot map '" + path + "'";
+        close();
+        return false;
+    }
+
+    data = static_cast<const char*>(view);
+    size = static_cast<size_t>(length.QuadPart);
+    return true;
+}
+
+void MappedFile::close() {
+    if (size > 0) {
+        UnmapViewOfFile(data);
+    }
+    if (mappingHandle) {
+        CloseHandle(mappingHandle);
+    }
+    if (fileHandle != INVALID_HANDLE_VALUE) {
+        CloseHandle(fileHandle);
+    }
+    data = emptyText;
+    size = 0;
+    mappingHandle = nullptr;
+    fileHandle = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+MappedFile::MappedFile() : data(emptyText), size(0), fd(-1) {
+}
+
+bool MappedFile::open(const string& path) {
+    close();
+
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        errorMessage = "cannot open '" + path + "': " + strerror(errno);
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        errorMessage = "cannot stat '" + path + "': " + strerror(errno);
+        close();
+        return false;
+    }
+    if (info.st_size == 0) {
+        return true;
+    }
+
+    void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED) {
+        errorMessage = "cannot map '" + path + "': " + strerror(errno);
+        close();
+        return false;
+    }
+
+    // The file is read front to back once
+    madvise(view, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+
+    data = static_cast<const char*>(view);
+    size = static_cast<size_t>(info.st_size);
+    return true;
+}
+
+void MappedFile::close() {
+    if (size > 0) {
+        munmap(const_cast<char*>(data), size);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    data = emptyText;
+    size = 0;
+    fd = -1;
+}
+
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
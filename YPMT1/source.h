@@ -0,0 +1,36 @@
+// source.h
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Read-only memory mapping of a source file. The text is scanned in
+// place; it does not have to end with '#'.
+class MappedFile {
+private:
+    const char* data;
+    size_t size;
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#else
+    int fd;
+#endif
+    std::string errorMessage;
+
+public:
+    MappedFile();
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);     // false on error, see error()
+    void close();
+
+    std::string_view text() const { return std::string_view(data, size); }
+    const std::string& error() const { return errorMessage; }
+};
+
+#endif
@@ -0,0 +1,160 @@
+// stats.cpp
+#include "stats.h"
+#include <chrono>
+#include <iostream>
+#include <mutex>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define STATS_HAS_TSC 1
+#endif
+
+using namespace std;
+
+static const char* phaseNames[PHASE_COUNT] = { "other", "scan", "tables", "parse" };
+
+#ifdef YPMT_STATS
+
+static mutex exitedMutex;
+static Stats exited = {};         // phase times in ticks
+
+static inline uint64_t steadyNanoseconds() {
+    return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Phase switches read the time stamp counter where there is one, it is
+// cheaper than the steady clock. Ticks are converted to nanoseconds by
+// comparing both clocks since the start of the program.
+static inline uint64_t now() {
+#ifdef STATS_HAS_TSC
+    return __rdtsc();
+#else
+    return steadyNanoseconds();
+#endif
+}
+
+static const uint64_t startTicks = now();
+static const uint64_t startNanoseconds = steadyNanoseconds();
+
+static double nanosecondsPerTick() {
+#ifdef STATS_HAS_TSC
+    uint64_t ticks = now() - startTicks;
+    uint64_t nanoseconds = steadyNanoseconds() - startNanoseconds;
+    return ticks > 0 ? static_cast<double>(nanoseconds) / static_cast<double>(ticks) : 1.0;
+#else
+    return 1.0;
+#endif
+}
+
+static void merge(Stats& total, const Stats& part) {
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        total.nanoseconds[p] += part.nanoseconds[p];
+    }
+    total.tokens += part.tokens;
+    total.nameHits += part.nameHits;
+    total.nameInserts += part.nameInserts;
+    total.constantHits += part.constantHits;
+    total.constantInserts += part.constantInserts;
+    total.keywordLookups += part.keywordLookups;
+    total.parses += part.parses;
+    total.nodes += part.nodes;
+    total.errors += part.errors;
+    if (part.maxDepth > total.maxDepth) {
+        total.maxDepth = part.maxDepth;
+    }
+}
+
+// Counters of one thread, added to the totals when the thread exits
+struct ThreadStats {
+    Stats stats = {};
+    StatsPhase current = PHASE_OTHER;
+    uint64_t since = now();         // start of the current phase, in ticks
+
+    void enter(StatsPhase phase) {
+        uint64_t t = now();
+        stats.nanoseconds[current] += t - since;
+        since = t;
+        current = phase;
+    }
+
+    ~ThreadStats() {
+        enter(PHASE_OTHER);
+        lock_guard<mutex> lock(exitedMutex);
+        merge(exited, stats);
+    }
+};
+
+static thread_local ThreadStats local;
+
+Stats& thread_stats() {
+    return local.stats;
+}
+
+// Nested timers of the same phase, like Lexer::next inside scanner(),
+// do not read the clock
+PhaseTimer::PhaseTimer(StatsPhase phase) : previous(local.current) {
+    if (phase != previous) {
+        local.enter(phase);
+    }
+}
+
+PhaseTimer::~PhaseTimer() {
+    if (local.current != previous) {
+        local.enter(previous);
+    }
+}
+
+Stats stats_snapshot() {
+    local.enter(local.current);
+    lock_guard<mutex> lock(exitedMutex);
+    Stats total = exited;
+    merge(total, local.stats);
+    double scale = nanosecondsPerTick();
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        total.nanoseconds[p] = static_cast<uint64_t>(static_cast<double>(total.nanoseconds[p]) * scale);
+    }
+    return total;
+}
+
+#else
+
+Stats stats_snapshot() {
+    return Stats();
+}
+
+#endif
+
+void print_stats(const Stats& stats, bool json) {
+    if (json) {
+        cerr << "{\"enabled\":" << (stats_enabled() ? "true" : "false") << ",\"phases_ns\":{";
+        for (int p = PHASE_SCAN; p < PHASE_COUNT; p++) {
+            cerr << (p == PHASE_SCAN ? "" : ",") << "\"" << phaseNames[p] << "\":" << stats.nanoseconds[p];
+        }
+        cerr << "},\"tokens\":" << stats.tokens << ",\"name_hits\":" << stats.nameHits
+            << ",\"name_inserts\":" << stats.nameInserts << ",\"constant_hits\":" << stats.constantHits
+            << ",\"constant_inserts\":" << stats.constantInserts << ",\"keyword_lookups\":" << stats.keywordLookups
+            << ",\"parses\":" << stats.parses << ",\"nodes\":" << stats.nodes << ",\"max_depth\":" << stats.maxDepth
+            << ",\"errors\":" << stats.errors << "}" << endl;
+        return;
+    }
+
+    cerr << "\n=== STATISTICS ===" << endl;
+    if (!stats_enabled()) {
+        cerr << "not compiled in, build with YPMT_STATS defined" << endl;
+        return;
+    }
+    for (int p = PHASE_SCAN; p < PHASE_COUNT; p++) {
+        cerr << phaseNames[p] << ": " << stats.nanoseconds[p] / 1e6 << " ms" << endl;
+    }
+    cerr << "tokens: " << stats.tokens << endl;
+    cerr << "names: " << stats.nameHits << " hits, " << stats.nameInserts << " inserts" << endl;
+    cerr << "constants: " << stats.constantHits << " hits, " << stats.constantInserts << " inserts" << endl;
+    cerr << "keyword lookups: " << stats.keywordLookups << endl;
+    cerr << "parses: " << stats.parses << ", nodes: " << stats.nodes << ", max depth: " << stats.maxDepth
+        << ", errors: " << stats.errors << endl;
+}
@@ -0,0 +1,82 @@
+// stats.h
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Phases the time of a thread is charged to. Timers nest: time spent in
+// the tables while scanning counts for the tables only.
+enum StatsPhase : uint8_t {
+    PHASE_OTHER,
+    PHASE_SCAN,         // Lexer::next, scanner()
+    PHASE_TABLES,       // InternTable::intern, ConstTable::intern
+    PHASE_PARSE,        // Parser::parse, without the scanning it pulls
+    PHASE_COUNT
+};
+
+struct Stats {
+    uint64_t nanoseconds[PHASE_COUNT];      // ticks until stats_snapshot()
+    uint64_t tokens;
+    uint64_t nameHits;          // InternTable::intern found the name
+    uint64_t nameInserts;
+    uint64_t constantHits;
+    uint64_t constantInserts;
+    uint64_t keywordLookups;
+    uint64_t parses;
+    uint64_t nodes;
+    uint64_t maxDepth;          // of nested statements in the parser
+    uint64_t errors;
+};
+
+// Instrumentation is compiled in with YPMT_STATS (the Debug configurations
+// define it). Without it the macros below expand to nothing.
+#ifdef YPMT_STATS
+
+Stats& thread_stats();
+
+class PhaseTimer {
+private:
+    StatsPhase previous;
+
+public:
+    explicit PhaseTimer(StatsPhase phase);
+    ~PhaseTimer();
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+};
+
+inline void stats_max(uint64_t& field, uint64_t value) {
+    if (value > field) {
+        field = value;
+    }
+}
+
+#define STATS_PHASE(phase) PhaseTimer statsPhaseTimer(phase)
+#define STATS_ADD(field, n) (thread_stats().field += (n))
+#define STATS_MAX(field, n) stats_max(thread_stats().field, (n))
+
+#else
+
+#define STATS_PHASE(phase) ((void)0)
+#define STATS_ADD(field, n) ((void)0)
+#define STATS_MAX(field, n) ((void)0)
+
+#endif
+
+constexpr bool stats_enabled() {
+#ifdef YPMT_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Totals of the threads that have exited and of the calling thread; all
+// zero without YPMT_STATS
+Stats stats_snapshot();
+
+// Report on stderr, as text or as one JSON object
+void print_stats(const Stats& stats, bool json);
+
+#endif
@@ -1,46 +1,205 @@
 // tables.cpp
 #include "tables.h"
+#include "language.h"
+#include "stats.h"
+#include <cstring>
 #include <iostream>
 
 using namespace std;
 
-// Variable definitions
-map<string, int> keywords;
-map<string, int> identifiers;
-map<int, int> constToCode;
-map<int, int> codeToConst;
-int nextId = 1;
-int nextConstCode = 1;
+const size_t INITIAL_SLOTS = 64;
 
-// Function implementations
-void initKeywords() {
-    keywords["do"] = 1;
-    keywords["while"] = 2;
-    keywords["print"] = 3;
+static inline uint64_t mix(uint64_t h) {
+    h ^= h >> 32;
+    h *= 0xD6E8FEB86659FD93ull;
+    h ^= h >> 32;
+    return h;
+}
+
+// Hashes 8 bytes per step
+uint32_t hash_bytes(const char* data, size_t length) {
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ length;
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        h = mix(h ^ word);
+        data += 8;
+        length -= 8;
+    }
+    if (length > 0) {
+        uint64_t word = 0;
+        memcpy(&word, data, length);
+        h = mix(h ^ word);
+    }
+    return static_cast<uint32_t>(mix(h));
+}
+
+static inline uint32_t hash_int(int value) {
+    return static_cast<uint32_t>(mix(static_cast<uint32_t>(value) * 0x9E3779B97F4A7C15ull));
 }
 
-int find_word(const string& word) {
-    auto it = keywords.find(word);
-    return (it != keywords.end()) ? it->second : 0;
+InternTable::InternTable() {
+    clear();
 }
 
-int make_id(const string& name) {
-    if (identifiers.find(name) != identifiers.end()) {
-        return identifiers[name];
+void InternTable::clear() {
+    slots.assign(INITIAL_SLOTS, { 0, 0 });
+    mask = INITIAL_SLOTS - 1;
+    pool.clear();
+    offsets.assign(1, 0);
+}
+
+int InternTable::find(string_view name) const {
+    uint32_t h = hash_bytes(name.data(), name.size());
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+        const Slot& slot = slots[i];
+        if (slot.code == 0) {
+            return 0;
+        }
+        if (slot.hash == h && this->name(slot.code) == name) {
+            return slot.code;
+        }
     }
-    identifiers[name] = nextId;
-    return nextId++;
 }
 
-int make_dig(int value) {
-    if (constToCode.find(value) != constToCode.end()) {
-        return constToCode[value];
+int InternTable::intern(string_view name) {
+    STATS_PHASE(PHASE_TABLES);
+    uint32_t h = hash_bytes(name.data(), name.size());
+    size_t i = h & mask;
+    for (;; i = (i + 1) & mask) {
+        const Slot& slot = slots[i];
+        if (slot.code == 0) {
+            break;
+        }
+        if (slot.hash == h && this->name(slot.code) == name) {
+            STATS_ADD(nameHits, 1);
+            return slot.code;
+        }
+    }
+
+    STATS_ADD(nameInserts, 1);
+    pool.insert(pool.end(), name.begin(), name.end());
+    offsets.push_back(pool.size());
+    uint32_t code = static_cast<uint32_t>(size());
+    slots[i] = { h, code };
+
+    // Keep the load factor at or below 1/2
+    if (size() * 2 > slots.size()) {
+        grow();
     }
-    constToCode[value] = nextConstCode;
-    codeToConst[nextConstCode] = value;
-    return nextConstCode++;
+    return code;
+}
+
+string_view InternTable::name(int code) const {
+    return string_view(pool.data() + offsets[code - 1], offsets[code] - offsets[code - 1]);
+}
+
+void InternTable::grow() {
+    vector<Slot> old(slots.size() * 2, { 0, 0 });
+    old.swap(slots);
+    mask = slots.size() - 1;
+    for (const Slot& slot : old) {
+        if (slot.code != 0) {
+            size_t i = slot.hash & mask;
+            while (slots[i].code != 0) {
+                i = (i + 1) & mask;
+            }
+            slots[i] = slot;
+        }
+    }
+}
+
+ConstTable::ConstTable() {
+    clear();
+}
+
+void ConstTable::clear() {
+    slots.assign(INITIAL_SLOTS, { 0, 0 });
+    mask = INITIAL_SLOTS - 1;
+    values.clear();
+}
+
+int ConstTable::intern(int value) {
+    STATS_PHASE(PHASE_TABLES);
+    size_t i = hash_int(value) & mask;
+    for (;; i = (i + 1) & mask) {
+        const Slot& slot = slots[i];
+        if (slot.code == 0) {
+            break;
+        }
+        if (slot.value == value) {
+            STATS_ADD(constantHits, 1);
+            return slot.code;
+        }
+    }
+
+    STATS_ADD(constantInserts, 1);
+    values.push_back(value);
+    uint32_t code = static_cast<uint32_t>(values.size());
+    slots[i] = { value, code };
+
+    if (values.size() * 2 > slots.size()) {
+        grow();
+    }
+    return code;
+}
+
+void ConstTable::grow() {
+    vector<Slot> old(slots.size() * 2, { 0, 0 });
+    old.swap(slots);
+    mask = slots.size() - 1;
+    for (const Slot& slot : old) {
+        if (slot.code != 0) {
+            size_t i = hash_int(slot.value) & mask;
+            while (slots[i].code != 0) {
+                i = (i + 1) & mask;
+            }
+            slots[i] = slot;
+        }
+    }
+}
+
+void CompilationContext::reset() {
+    identifiers.clear();
+    constants.clear();
+}
+
+int CompilationContext::find_word(string_view word) const {
+    return ::find_word(word);
+}
+
+void print_tables(const CompilationContext& context) {
+    cout << "\nIdentifiers table:" << endl;
+    for (size_t code = 1; code <= context.identifiers.size(); code++) {
+        cout << "  " << context.identifiers.name(static_cast<int>(code)) << " -> code " << code << endl;
+    }
+
+    cout << "\nConstants table:" << endl;
+    for (size_t code = 1; code <= context.constants.size(); code++) {
+        cout << "  code " << code << " -> value " << context.val_dig(static_cast<int>(code)) << endl;
+    }
+}
+
+CompilationContext& default_context() {
+    static thread_local CompilationContext context;
+    return context;
+}
+
+// Function implementations
+// Perfect hash from language.h, then one comparison of the spelling
+int find_word(string_view word) {
+    STATS_ADD(keywordLookups, 1);   // too short to time
+    return keyword_code(word);
+}
+
+int make_id(string_view name) {
+    return default_context().make_id(name);
+}
+
+int make_dig(int value) {
+    return default_context().make_dig(value);
 }
 
 int val_dig(int code) {
-    return (codeToConst.find(code) != codeToConst.end()) ? codeToConst[code] : -1;
-}
\ No newline at end of file
+    return default_context().val_dig(code);
+}
@@ -2,22 +2,93 @@
 #ifndef TABLES_H
 #define TABLES_H
 
-#include <map>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <vector>
+
+// Interning table for names: open addressing over a power-of-two slot
+// array, spellings are appended to a string pool. Codes start at 1.
+class InternTable {
+private:
+    struct Slot {
+        uint32_t hash;
+        uint32_t code;      // 0 = empty slot
+    };
+
+    std::vector<Slot> slots;
+    std::vector<char> pool;         // all spellings, back to back
+    std::vector<size_t> offsets;    // spelling of code c is pool[offsets[c-1], offsets[c])
+    size_t mask;
+
+    void grow();
+
+public:
+    InternTable();
+
+    int find(std::string_view name) const;      // 0 if absent
+    int intern(std::string_view name);          // existing or new code
+    std::string_view name(int code) const;
+    size_t size() const { return offsets.size() - 1; }
+    void clear();
+};
+
+// Interning table for integer constants; values are kept in a dense
+// vector indexed by code, so the reverse lookup needs no hashing.
+class ConstTable {
+private:
+    struct Slot {
+        int32_t value;
+        uint32_t code;      // 0 = empty slot
+    };
+
+    std::vector<Slot> slots;
+    std::vector<int> values;        // values[code - 1]
+    size_t mask;
+
+    void grow();
+
+public:
+    ConstTable();
+
+    int intern(int value);
+    int value(int code) const {     // -1 if there is no such code
+        return (code > 0 && static_cast<size_t>(code) <= values.size()) ? values[code - 1] : -1;
+    }
+    size_t size() const { return values.size(); }
+    void clear();
+};
+
+uint32_t hash_bytes(const char* data, size_t length);
+
+// Symbol tables of one compilation. Contexts share no mutable state, so
+// independent programs can be compiled concurrently, each in its own
+// context. reset() keeps the allocated memory for the next program.
+class CompilationContext {
+public:
+    InternTable identifiers;
+    ConstTable constants;
+
+    void reset();
+
+    int find_word(std::string_view word) const;
+    int make_id(std::string_view name) { return identifiers.intern(name); }
+    int make_dig(int value) { return constants.intern(value); }
+    int val_dig(int code) const { return constants.value(code); }
+};
+
+// Context of the current thread, used by the functions below and by
+// scanner()/Lexer/Parser when no context is given
+CompilationContext& default_context();
+
+// Prints the identifiers and constants tables of a context
+void print_tables(const CompilationContext& context);
 
 // Function declarations for tables
-void initKeywords();
-int find_word(const std::string& word);
-int make_id(const std::string& name);
+int find_word(std::string_view word);
+int make_id(std::string_view name);
 int make_dig(int value);
 int val_dig(int code);
 
-// External variables
-extern std::map<std::string, int> keywords;
-extern std::map<std::string, int> identifiers;
-extern std::map<int, int> constToCode;
-extern std::map<int, int> codeToConst;
-extern int nextId;
-extern int nextConstCode;
-
-#endif
\ No newline at end of file
+#endif
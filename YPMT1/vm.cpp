@@ -0,0 +1,109 @@
+// vm.cpp
+#include "vm.h"
+#include <iostream>
+
+using namespace std;
+
+// Arithmetic wraps around like the machine registers do
+static inline int64_t wrapAdd(int64_t a, int64_t b) {
+    return static_cast<int64_t>(static_cast<uint64_t>(a) + static_cast<uint64_t>(b));
+}
+
+static inline int64_t wrapSub(int64_t a, int64_t b) {
+    return static_cast<int64_t>(static_cast<uint64_t>(a) - static_cast<uint64_t>(b));
+}
+
+static inline int64_t imm(uint32_t operand) {
+    return static_cast<int32_t>(operand);
+}
+
+VmStatus Vm::run(const Bytecode& program, OutputBuffer& out, uint64_t maxIterations) {
+    registers.assign(program.registerCount, 0);
+    iterations = 0;
+
+    int64_t* r = registers.data();
+    const Instr* code = program.code.data();
+    const Instr* ip = code;
+    uint64_t budget = maxIterations ? maxIterations : UINT64_MAX;
+    uint64_t taken = 0;
+
+    for (;;) {
+        const Instr& in = *ip++;
+        switch (in.op) {
+        case OPC_MOV:
+            r[in.a] = r[in.b];
+            break;
+        case OPC_LOADK:
+            r[in.a] = imm(in.b);
+            break;
+        case OPC_ADD:
+            r[in.a] = wrapAdd(r[in.b], r[in.c]);
+            break;
+        case OPC_SUB:
+            r[in.a] = wrapSub(r[in.b], r[in.c]);
+            break;
+        case OPC_ADDK:
+            r[in.a] = wrapAdd(r[in.b], imm(in.c));
+            break;
+        case OPC_SUBK:
+            r[in.a] = wrapSub(r[in.b], imm(in.c));
+            break;
+        case OPC_JLT:
+            if (r[in.a] < r[in.b]) goto jump;
+            break;
+        case OPC_JGT:
+            if (r[in.a] > r[in.b]) goto jump;
+            break;
+        case OPC_JLTK:
+            if (r[in.a] < imm(in.b)) goto jump;
+            break;
+        case OPC_JGTK:
+            if (r[in.a] > imm(in.b)) goto jump;
+            break;
+        case OPC_JMP:
+            goto jump;
+        case OPC_PRINT:
+            out.printValue(r[in.a]);
+            break;
+        case OPC_HALT:
+            iterations = taken;
+            return VM_OK;
+        }
+        continue;
+
+    jump:
+        ip = code + in.c;
+        if (++taken == budget) {
+            iterations = taken;
+            return VM_LOOP_LIMIT;
+        }
+    }
+}
+
+void print_bytecode(const Bytecode& program) {
+    static const char* names[] = {
+        "MOV", "LOADK", "ADD", "SUB", "ADDK", "SUBK",
+        "JLT", "JGT", "JLTK", "JGTK", "JMP", "PRINT", "HALT"
+    };
+
+    for (size_t i = 0; i < program.code.size(); i++) {
+        const Instr& in = program.code[i];
+        cout << "  " << i << ": " << names[in.op];
+        switch (in.op) {
+        case OPC_MOV: cout << " r" << in.a << ", r" << in.b; break;
+        case OPC_LOADK: cout << " r" << in.a << ", " << imm(in.b); break;
+        case OPC_ADD:
+        case OPC_SUB: cout << " r" << in.a << ", r" << in.b << ", r" << in.c; break;
+        case OPC_ADDK:
+        case OPC_SUBK: cout << " r" << in.a << ", r" << in.b << ", " << imm(in.c); break;
+        case OPC_JLT:
+        case OPC_JGT: cout << " r" << in.a << ", r" << in.b << ", @" << in.c; break;
+        case OPC_JLTK:
+        case OPC_JGTK: cout << " r" << in.a << ", " << imm(in.b) << ", @" << in.c; break;
+        case OPC_JMP: cout << " @" << in.c; break;
+        case OPC_PRINT: cout << " r" << in.a; break;
+        case OPC_HALT: break;
+        }
+        cout << endl;
+    }
+}
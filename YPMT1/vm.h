@@ -0,0 +1,61 @@
+// vm.h
+#ifndef VM_H
+#define VM_H
+
+#include <cstdint>
+#include <vector>
+#include "output.h"
+
+// Register bytecode. Registers 1..N are the identifiers (slot = code in
+// the identifiers table), registers above them are temporaries.
+// Constant operands are stored as immediate values.
+enum OpCode : uint8_t {
+    OPC_MOV,       // r[a] = r[b]
+    OPC_LOADK,     // r[a] = b
+    OPC_ADD,       // r[a] = r[b] + r[c]
+    OPC_SUB,       // r[a] = r[b] - r[c]
+    OPC_ADDK,      // r[a] = r[b] + c
+    OPC_SUBK,      // r[a] = r[b] - c
+    OPC_JLT,       // if (r[a] < r[b]) goto c
+    OPC_JGT,       // if (r[a] > r[b]) goto c
+    OPC_JLTK,      // if (r[a] < b) goto c
+    OPC_JGTK,      // if (r[a] > b) goto c
+    OPC_JMP,       // goto c
+    OPC_PRINT,     // print r[a]
+    OPC_HALT
+};
+
+struct Instr {
+    OpCode op;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+};
+
+struct Bytecode {
+    std::vector<Instr> code;
+    uint32_t registerCount = 1;
+};
+
+enum VmStatus {
+    VM_OK,
+    VM_LOOP_LIMIT      // stopped after maxIterations backward jumps
+};
+
+// Bytecode interpreter
+class Vm {
+private:
+    std::vector<int64_t> registers;
+    uint64_t iterations = 0;
+
+public:
+    // maxIterations limits taken backward jumps, 0 means no limit
+    VmStatus run(const Bytecode& program, OutputBuffer& out, uint64_t maxIterations = 0);
+
+    int64_t reg(uint32_t index) const { return registers[index]; }
+    uint64_t iterationCount() const { return iterations; }
+};
+
+void print_bytecode(const Bytecode& program);
+
+#endif